@@ -0,0 +1,906 @@
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "assembler.hpp"
+#include "loader.hpp"
+#include "memory.hpp"
+
+using namespace std;
+
+namespace {
+
+const RegisterId zero = RegisterId{0};
+const RegisterId at = RegisterId{1};
+
+const char* const register_names[32] = {
+    "zero", "at", "v0", "v1", "a0", "a1", "a2", "a3",
+    "t0", "t1", "t2", "t3", "t4", "t5", "t6", "t7",
+    "s0", "s1", "s2", "s3", "s4", "s5", "s6", "s7",
+    "t8", "t9", "k0", "k1", "gp", "sp", "fp", "ra",
+};
+
+// Function fields of the R-type instructions, and opcodes of the I-type ones
+const map<string, Word> alu_functions = {
+    {"add", 32}, {"addu", 33}, {"sub", 34}, {"subu", 35},
+    {"and", 36}, {"or", 37}, {"xor", 38}, {"nor", 39}, {"slt", 42}, {"sltu", 43},
+};
+const map<string, Word> immediate_opcodes = {
+    {"addi", 8}, {"addiu", 9}, {"slti", 10}, {"sltiu", 11}, {"andi", 12}, {"ori", 13}, {"xori", 14},
+};
+const map<string, Word> shift_functions = {
+    {"sll", 0}, {"srl", 2}, {"sra", 3}, {"sllv", 4}, {"srlv", 6}, {"srav", 7},
+};
+const map<string, Word> multiply_functions = {
+    {"mult", 24}, {"multu", 25}, {"div", 26}, {"divu", 27},
+};
+const map<string, Word> memory_opcodes = {
+    {"lb", 32}, {"lh", 33}, {"lwl", 34}, {"lw", 35}, {"lbu", 36}, {"lhu", 37}, {"lwr", 38},
+    {"sb", 40}, {"sh", 41}, {"sw", 43}, {"ll", 48}, {"sc", 56},
+};
+const map<string, Word> regimm_codes = {
+    {"bltz", 0}, {"bgez", 1}, {"bltzal", 16}, {"bgezal", 17},
+};
+
+struct Statement {
+    size_t line;
+    vector<string> labels;
+    // Lower case
+    string op;
+    vector<string> args;
+};
+
+/**
+ * The value of an expression. Labels are addresses a linker could move, so as never uses a
+ * shorter encoding for them, and neither do we
+ */
+struct Value {
+    int64_t value = 0;
+    bool relocatable = false;
+    // False if it refers to a label that isn't defined yet (only in the first pass)
+    bool known = true;
+};
+
+string trim(const string& text) {
+    size_t first = text.find_first_not_of(" \t\r");
+    if (first == string::npos) return "";
+    size_t last = text.find_last_not_of(" \t\r");
+    return text.substr(first, last - first + 1);
+}
+
+string lower(string text) {
+    for (char& c : text) c = tolower(static_cast<unsigned char>(c));
+    return text;
+}
+
+bool is_symbol_char(char c, bool first) {
+    return isalpha(static_cast<unsigned char>(c)) || c == '_' || c == '.' || c == '$'
+        || (!first && isdigit(static_cast<unsigned char>(c)));
+}
+
+// Everything before a # that isn't in a string or character literal
+string strip_comment(const string& line) {
+    char quote = 0;
+    for (size_t i = 0; i < line.size(); i++) {
+        if (quote && line[i] == '\\') i++;
+        else if (quote && line[i] == quote) quote = 0;
+        else if (!quote && (line[i] == '"' || line[i] == '\'')) quote = line[i];
+        else if (!quote && line[i] == '#') return line.substr(0, i);
+    }
+    return line;
+}
+
+vector<string> split_arguments(const string& text) {
+    vector<string> args;
+    string current;
+    char quote = 0;
+    for (size_t i = 0; i < text.size(); i++) {
+        char c = text[i];
+        if (quote && c == '\\' && i + 1 < text.size()) {
+            current += c;
+            c = text[++i];
+        } else if (quote && c == quote) {
+            quote = 0;
+        } else if (!quote && (c == '"' || c == '\'')) {
+            quote = c;
+        } else if (!quote && c == ',') {
+            args.push_back(trim(current));
+            current.clear();
+            continue;
+        }
+        current += c;
+    }
+    if (!trim(current).empty() || !args.empty()) args.push_back(trim(current));
+    return args;
+}
+
+class Assembler {
+    private:
+        const string& name;
+        vector<Statement> statements;
+
+        map<string, Address> labels;
+        map<string, Value> set_symbols;
+        bool final_pass = false;
+        bool reorder = true;
+        bool in_text = true;
+        bool in_bss = false;
+        string text;
+        string data;
+        // .bss only takes up space, after all of .data: from data_start + bss_offset, which is
+        // the end of the data in the last pass aligned to bss_alignment
+        size_t bss_size = 0;
+        size_t bss_offset = 0;
+        size_t bss_alignment = 16;
+        size_t line = 0;
+
+        [[noreturn]] void error(const string& message) const {
+            throw AssemblyError(name + ":" + to_string(line) + ": " + message);
+        }
+
+        Address location() const {
+            if (in_bss) return data_start + bss_offset + bss_size;
+            return in_text ? instruction_start + text.size() : data_start + data.size();
+        }
+        string& section() { return in_text ? text : data; }
+
+        void parse(const string& source);
+        void run_pass();
+        void statement(const Statement& statement);
+        void directive(const string& op, const vector<string>& args);
+        void instruction(const string& op, const vector<string>& args);
+
+        Value evaluate(const string& expression) const;
+        Value term(const string& text) const;
+        int64_t number(const string& expression) const;
+        bool constant(const string& expression, int64_t& value) const;
+        RegisterId reg(const string& text) const;
+        bool is_register(const string& text) const;
+        string string_literal(const string& text) const;
+        void expect(const vector<string>& args, size_t count) const;
+
+        void align(size_t alignment);
+        void emit_bytes(Word value, size_t count);
+        void emit(Word word);
+        void emit_r(Word function, RegisterId rd, RegisterId rs, RegisterId rt, Word shift = 0);
+        void emit_i(Word opcode, RegisterId rt, RegisterId rs, int64_t immediate);
+        void delay_slot();
+        int64_t branch_offset(const string& target);
+        void branch(Word opcode, RegisterId rs, RegisterId rt, const string& target);
+        void regimm(Word code, RegisterId rs, const string& target);
+        void jump(Word opcode, const string& target);
+        void load_immediate(RegisterId rt, const string& expression);
+        void immediate_operation(const string& op, RegisterId rt, RegisterId rs, const string& expression);
+        void memory_access(Word opcode, RegisterId rt, const string& address);
+        void compare_branch(const string& op, const vector<string>& args);
+
+    public:
+        Assembler(const string& i_name) : name(i_name) {}
+        AssembledProgram assemble(const string& source);
+};
+
+void Assembler::parse(const string& source) {
+    size_t start = 0;
+    vector<string> pending_labels;
+    for (line = 1; start <= source.size(); line++) {
+        size_t end = source.find('\n', start);
+        if (end == string::npos) end = source.size();
+        string text = trim(strip_comment(source.substr(start, end - start)));
+        start = end + 1;
+
+        // Any number of labels, then maybe a statement
+        while (!text.empty() && is_symbol_char(text[0], true)) {
+            size_t i = 1;
+            while (i < text.size() && is_symbol_char(text[i], false)) i++;
+            if (i >= text.size() || text[i] != ':') break;
+            pending_labels.push_back(text.substr(0, i));
+            text = trim(text.substr(i + 1));
+        }
+        if (text.empty()) continue;
+
+        Statement statement;
+        statement.line = line;
+        statement.labels.swap(pending_labels);
+        size_t space = text.find_first_of(" \t");
+        statement.op = lower(text.substr(0, space));
+        if (space != string::npos) statement.args = split_arguments(text.substr(space + 1));
+        statements.push_back(statement);
+    }
+
+    // Labels at the end of the source
+    if (!pending_labels.empty()) {
+        Statement end;
+        end.line = line - 1;
+        end.labels.swap(pending_labels);
+        statements.push_back(end);
+    }
+}
+
+AssembledProgram Assembler::assemble(const string& source) {
+    parse(source);
+
+    // The first pass finds the labels. Instructions are the same size in both passes, since
+    // only constants known in the first pass ever make them shorter
+    run_pass();
+    // Labels in .bss depend on the size of all of the data, which is only known now
+    if (bss_size > 0) {
+        labels.clear();
+        run_pass();
+    }
+    final_pass = true;
+    run_pass();
+
+    AssembledProgram program;
+    program.text = words_from_bytes(text);
+    program.data = data;
+    program.bss_offset = bss_offset;
+    program.bss_size = bss_size;
+    for (const auto& label : labels) program.symbols[label.first] = label.second;
+    for (const auto& symbol : set_symbols) program.symbols[symbol.first] = symbol.second.value;
+    return program;
+}
+
+void Assembler::run_pass() {
+    set_symbols.clear();
+    text.clear();
+    data.clear();
+    bss_size = 0;
+    reorder = true;
+    in_text = true;
+    in_bss = false;
+    for (const Statement& current : statements) statement(current);
+    bss_offset = (data.size() + bss_alignment - 1) / bss_alignment * bss_alignment;
+}
+
+void Assembler::statement(const Statement& current) {
+    line = current.line;
+
+    // Everything in .text starts on a word, like instructions, and .word/.half are aligned in
+    // .data. So are the labels in front of them
+    const string& op = current.op;
+    if (!op.empty() && op[0] != '.' && !in_text) error("instructions must be in .text");
+    if (in_text || op == ".word") align(4);
+    else if (op == ".half")       align(2);
+
+    for (const string& label : current.labels) {
+        if (!final_pass) {
+            if (labels.count(label)) error("label " + label + " is already defined");
+            labels[label] = location();
+        } else if (labels[label] != location()) {
+            error("label " + label + " moved between passes");
+        }
+    }
+
+    if (op.empty()) return;
+    if (op[0] == '.') directive(op, current.args);
+    else              instruction(op, current.args);
+
+    if (text.size() > instruction_size) error("the program doesn't fit in instruction memory");
+    if (data.size() > data_size) error("the data doesn't fit in data memory");
+}
+
+void Assembler::directive(const string& op, const vector<string>& args) {
+    if (op == ".text" || op == ".data" || op == ".bss") {
+        in_text = op == ".text";
+        in_bss = op == ".bss";
+    } else if (in_bss && (op == ".word" || op == ".half" || op == ".byte" || op == ".ascii" || op == ".asciz" || op == ".asciiz")) {
+        error("only .space and .align can be used in .bss");
+    } else if (op == ".set" && args.size() == 1) {
+        if      (args[0] == "noreorder") reorder = false;
+        else if (args[0] == "reorder")   reorder = true;
+        // Other options (noat, mips1, ...) don't change what we emit
+    } else if (op == ".set" || op == ".equ") {
+        expect(args, 2);
+        if (args[0].empty() || !is_symbol_char(args[0][0], true)) error("bad symbol name " + args[0]);
+        set_symbols[args[0]] = evaluate(args[1]);
+    } else if (op == ".word" || op == ".half" || op == ".byte") {
+        size_t size = op == ".word" ? 4 : op == ".half" ? 2 : 1;
+        for (const string& arg : args) emit_bytes(static_cast<Word>(evaluate(arg).value), size);
+    } else if (op == ".ascii" || op == ".asciz" || op == ".asciiz") {
+        for (const string& arg : args) {
+            section() += string_literal(arg);
+            if (op != ".ascii") section() += '\0';
+        }
+    } else if (op == ".space" || op == ".skip") {
+        if (args.empty() || args.size() > 2) error(op + " takes a size and an optional fill byte");
+        int64_t size = number(args[0]);
+        if (size < 0 || size > data_size) error("bad size for " + op);
+        if (in_bss) {
+            if (args.size() == 2 && number(args[1]) != 0) error(".bss can only hold zeros");
+            bss_size += size;
+            if (bss_offset + bss_size > data_size) error("the data doesn't fit in data memory");
+            return;
+        }
+        section().append(size, static_cast<char>(args.size() == 2 ? number(args[1]) : 0));
+    } else if (op == ".align") {
+        expect(args, 1);
+        int64_t power = number(args[0]);
+        if (power < 0 || power > 12) error("bad alignment");
+        align(size_t(1) << power);
+    } else if (op == ".globl" || op == ".global" || op == ".ent" || op == ".end" || op == ".type" || op == ".size") {
+        // Only matter to the linker
+    } else {
+        error("unknown directive " + op);
+    }
+}
+
+void Assembler::instruction(const string& op, const vector<string>& args) {
+    if (op == "nop") {
+        expect(args, 0);
+        emit(0);
+    } else if (op == "move") {
+        expect(args, 2);
+        emit_r(alu_functions.at("addu"), reg(args[0]), reg(args[1]), zero);
+    } else if (op == "li") {
+        expect(args, 2);
+        load_immediate(reg(args[0]), args[1]);
+    } else if (op == "la") {
+        // The low half is added sign-extended, so the high half makes up for it
+        expect(args, 2);
+        RegisterId rt = reg(args[0]);
+        Word address = static_cast<Word>(evaluate(args[1]).value);
+        emit_i(15, rt, zero, (address + 0x8000) >> 16);
+        emit_i(9, rt, rt, address & 0xFFFF);
+    } else if (op == "not") {
+        expect(args, 2);
+        emit_r(alu_functions.at("nor"), reg(args[0]), reg(args[1]), zero);
+    } else if (op == "neg" || op == "negu") {
+        expect(args, 2);
+        emit_r(alu_functions.at(op == "neg" ? "sub" : "subu"), reg(args[0]), zero, reg(args[1]));
+    } else if (alu_functions.count(op)) {
+        // Also rd, rt for rd, rd, rt, and an immediate for the third register
+        if (args.size() != 2 && args.size() != 3) error(op + " takes 3 operands");
+        RegisterId rd = reg(args[0]);
+        RegisterId rs = reg(args[args.size() - 2]);
+        const string& last = args.back();
+        if (is_register(last))  emit_r(alu_functions.at(op), rd, rs, reg(last));
+        else if (op == "nor")   error("nor takes 3 registers");
+        else                    immediate_operation(op, rd, rs, last);
+    } else if (immediate_opcodes.count(op)) {
+        if (args.size() != 2 && args.size() != 3) error(op + " takes 3 operands");
+        immediate_operation(op, reg(args[0]), reg(args[args.size() - 2]), args.back());
+    } else if (op == "lui") {
+        expect(args, 2);
+        int64_t value = number(args[1]);
+        if (final_pass && (value < -0x8000 || value > 0xFFFF)) error("immediate out of range");
+        emit_i(15, reg(args[0]), zero, value);
+    } else if (shift_functions.count(op)) {
+        expect(args, 3);
+        Word function = shift_functions.at(op);
+        if (function < 4 && is_register(args[2])) function += 4;
+        if (function >= 4) {
+            emit_r(function, reg(args[0]), reg(args[2]), reg(args[1]));
+        } else {
+            int64_t shift = number(args[2]);
+            if (shift < 0 || shift > 31) error("shift amount out of range");
+            emit_r(function, reg(args[0]), zero, reg(args[1]), shift);
+        }
+    } else if (multiply_functions.count(op)) {
+        // div rd, rs, rt is div rs, rt then mflo rd (as also traps division by zero)
+        if (args.size() != 2 && args.size() != 3) error(op + " takes 2 operands");
+        size_t first = args.size() - 2;
+        emit_r(multiply_functions.at(op), zero, reg(args[first]), reg(args[first + 1]));
+        if (args.size() == 3 && reg(args[0]) != zero) emit_r(18, reg(args[0]), zero, zero);
+    } else if (op == "mfhi" || op == "mflo") {
+        expect(args, 1);
+        emit_r(op == "mfhi" ? 16 : 18, reg(args[0]), zero, zero);
+    } else if (op == "mthi" || op == "mtlo") {
+        expect(args, 1);
+        emit_r(op == "mthi" ? 17 : 19, zero, reg(args[0]), zero);
+    } else if (op == "jr") {
+        expect(args, 1);
+        emit_r(8, zero, reg(args[0]), zero);
+        delay_slot();
+    } else if (op == "jalr") {
+        if (args.size() != 1 && args.size() != 2) error("jalr takes 1 or 2 operands");
+        emit_r(9, args.size() == 2 ? reg(args[0]) : RegisterId{31}, reg(args.back()), zero);
+        delay_slot();
+    } else if (op == "syscall" || op == "sync" || op == "break") {
+        if (args.size() > 1) error(op + " takes at most 1 operand");
+        Word code = args.empty() ? 0 : static_cast<Word>(number(args[0])) & 0xFFFFF;
+        emit((op == "break" ? code << 6 : 0) | (op == "syscall" ? 12 : op == "sync" ? 15 : 13));
+    } else if (memory_opcodes.count(op)) {
+        expect(args, 2);
+        memory_access(memory_opcodes.at(op), reg(args[0]), args[1]);
+    } else if (op == "beq" || op == "bne") {
+        expect(args, 3);
+        Word opcode = op == "beq" ? 4 : 5;
+        if (is_register(args[1])) {
+            branch(opcode, reg(args[0]), reg(args[1]), args[2]);
+        } else {
+            load_immediate(at, args[1]);
+            branch(opcode, reg(args[0]), at, args[2]);
+        }
+    } else if (op == "beqz" || op == "bnez") {
+        expect(args, 2);
+        branch(op == "beqz" ? 4 : 5, reg(args[0]), zero, args[1]);
+    } else if (op == "blez" || op == "bgtz") {
+        expect(args, 2);
+        branch(op == "blez" ? 6 : 7, reg(args[0]), zero, args[1]);
+    } else if (regimm_codes.count(op)) {
+        expect(args, 2);
+        regimm(regimm_codes.at(op), reg(args[0]), args[1]);
+    } else if (op == "b") {
+        expect(args, 1);
+        branch(4, zero, zero, args[0]);
+    } else if (op == "bal") {
+        expect(args, 1);
+        regimm(regimm_codes.at("bgezal"), zero, args[0]);
+    } else if (op == "blt" || op == "bgt" || op == "ble" || op == "bge"
+               || op == "bltu" || op == "bgtu" || op == "bleu" || op == "bgeu") {
+        compare_branch(op, args);
+    } else if (op == "j" || op == "jal") {
+        expect(args, 1);
+        if (is_register(args[0])) {
+            emit_r(op == "j" ? 8 : 9, op == "j" ? zero : RegisterId{31}, reg(args[0]), zero);
+            delay_slot();
+        } else {
+            jump(op == "j" ? 2 : 3, args[0]);
+        }
+    } else {
+        error("unknown instruction " + op);
+    }
+}
+
+/**
+ * blt/bgt/ble/bge and their unsigned versions: set $at with SLT(U), then branch on it. An
+ * immediate is loaded into $at first
+ */
+void Assembler::compare_branch(const string& op, const vector<string>& args) {
+    expect(args, 3);
+    bool is_unsigned = op.back() == 'u';
+    string kind = op.substr(0, 3);
+    RegisterId rs = reg(args[0]);
+    Word slt = alu_functions.at(is_unsigned ? "sltu" : "slt");
+
+    // blt and bge test rs < rt, bgt and ble test rt < rs
+    bool swapped = kind == "bgt" || kind == "ble";
+    bool taken_if_set = kind == "blt" || kind == "bgt";
+
+    RegisterId rt = at;
+    if (is_register(args[1])) rt = reg(args[1]);
+    else                      load_immediate(at, args[1]);
+    if (swapped) emit_r(slt, at, rt, rs);
+    else         emit_r(slt, at, rs, rt);
+    branch(taken_if_set ? 5 : 4, at, zero, args[2]);
+}
+
+/**
+ * li as as expands it: ADDIU or ORI from $zero if the value fits in 16 bits, LUI on its own if
+ * the low half is 0, and LUI then ORI otherwise. An address only gets its low half, like
+ * as's ADDIU with %lo(): use la for the whole of it
+ */
+void Assembler::load_immediate(RegisterId rt, const string& expression) {
+    Value value = evaluate(expression);
+    if (value.relocatable) {
+        emit_i(9, rt, zero, value.value & 0xFFFF);
+        return;
+    }
+    if (value.value < -0x80000000LL || value.value > 0xFFFFFFFFLL) error("immediate out of range");
+    Word word = static_cast<Word>(value.value);
+    int32_t signed_word = static_cast<int32_t>(word);
+    if (signed_word >= -0x8000 && signed_word < 0x8000) {
+        emit_i(9, rt, zero, signed_word);
+    } else if (word <= 0xFFFF) {
+        emit_i(13, rt, zero, word);
+    } else {
+        emit_i(15, rt, zero, word >> 16);
+        if ((word & 0xFFFF) != 0) emit_i(13, rt, rt, word & 0xFFFF);
+    }
+}
+
+/**
+ * An ALU operation with an immediate, in the I-type form if the immediate fits and through
+ * $at if it doesn't
+ */
+void Assembler::immediate_operation(const string& op, RegisterId rt, RegisterId rs, const string& expression) {
+    static const map<string, string> register_forms = {
+        {"addi", "add"}, {"addiu", "addu"}, {"slti", "slt"}, {"sltiu", "sltu"},
+        {"andi", "and"}, {"ori", "or"}, {"xori", "xor"},
+        {"add", "add"}, {"addu", "addu"}, {"sub", "sub"}, {"subu", "subu"},
+        {"slt", "slt"}, {"sltu", "sltu"}, {"and", "and"}, {"or", "or"}, {"xor", "xor"},
+    };
+    static const map<string, string> immediate_forms = {
+        {"add", "addi"}, {"addu", "addiu"}, {"sub", "addi"}, {"subu", "addiu"},
+        {"slt", "slti"}, {"sltu", "sltiu"}, {"and", "andi"}, {"or", "ori"}, {"xor", "xori"},
+    };
+
+    string immediate_op = immediate_opcodes.count(op) ? op : immediate_forms.at(op);
+
+    // Any 16-bit immediate, signed or not, or the low half of an address
+    Value value = evaluate(expression);
+    if (op == "sub" || op == "subu") value.value = -value.value;
+    if (value.relocatable || (value.value >= -0x8000 && value.value <= 0xFFFF)) {
+        emit_i(immediate_opcodes.at(immediate_op), rt, rs, value.value);
+        return;
+    }
+    load_immediate(at, expression);
+    emit_r(alu_functions.at(register_forms.at(op)), rt, rs, at);
+}
+
+/**
+ * A load or store to offset(base), (base) or an absolute address. Offsets that don't fit in 16
+ * bits go through $at
+ */
+void Assembler::memory_access(Word opcode, RegisterId rt, const string& address) {
+    string offset = address;
+    RegisterId base = zero;
+    bool has_base = false;
+    if (!address.empty() && address.back() == ')') {
+        size_t open = address.rfind('(');
+        if (open == string::npos) error("bad address " + address);
+        base = reg(address.substr(open + 1, address.size() - open - 2));
+        offset = trim(address.substr(0, open));
+        has_base = true;
+    }
+    if (offset.empty()) offset = "0";
+
+    int64_t value;
+    if (constant(offset, value) && value >= -0x8000 && value < 0x8000) {
+        emit_i(opcode, rt, base, value);
+        return;
+    }
+
+    Word word = static_cast<Word>(evaluate(offset).value);
+    emit_i(15, at, zero, (word + 0x8000) >> 16);
+    if (has_base) emit_r(alu_functions.at("addu"), at, at, base);
+    emit_i(opcode, rt, at, word & 0xFFFF);
+}
+
+void Assembler::align(size_t alignment) {
+    if (in_bss) {
+        bss_alignment = max(bss_alignment, alignment);
+        bss_size = (bss_size + alignment - 1) / alignment * alignment;
+        return;
+    }
+    string& bytes = section();
+    while (bytes.size() % alignment != 0) bytes += '\0';
+}
+
+void Assembler::emit_bytes(Word value, size_t count) {
+    for (size_t i = count; i > 0; i--) section() += static_cast<char>(value >> (8 * (i - 1)));
+}
+
+void Assembler::emit(Word word) {
+    emit_bytes(word, 4);
+}
+
+void Assembler::emit_r(Word function, RegisterId rd, RegisterId rs, RegisterId rt, Word shift) {
+    emit((static_cast<Word>(rs.value) << 21) | (static_cast<Word>(rt.value) << 16)
+         | (static_cast<Word>(rd.value) << 11) | (shift << 6) | function);
+}
+
+void Assembler::emit_i(Word opcode, RegisterId rt, RegisterId rs, int64_t immediate) {
+    emit((opcode << 26) | (static_cast<Word>(rs.value) << 21) | (static_cast<Word>(rt.value) << 16)
+         | (static_cast<Word>(immediate) & 0xFFFF));
+}
+
+void Assembler::delay_slot() {
+    if (reorder) emit(0);
+}
+
+// In instructions from the delay slot, which is where the branch is when it is taken
+int64_t Assembler::branch_offset(const string& target) {
+    Value destination = evaluate(target);
+    int64_t offset = destination.value - (static_cast<int64_t>(location()) + 4);
+    if (final_pass && (offset % 4 != 0 || offset / 4 < -0x8000 || offset / 4 >= 0x8000)) {
+        error("branch target " + target + " out of range");
+    }
+    return offset / 4;
+}
+
+void Assembler::branch(Word opcode, RegisterId rs, RegisterId rt, const string& target) {
+    emit_i(opcode, rt, rs, branch_offset(target));
+    delay_slot();
+}
+
+void Assembler::regimm(Word code, RegisterId rs, const string& target) {
+    emit_i(1, RegisterId{static_cast<uint8_t>(code)}, rs, branch_offset(target));
+    delay_slot();
+}
+
+void Assembler::jump(Word opcode, const string& target) {
+    // Any absolute address is fine, the jump just keeps the low 28 bits
+    Value destination = evaluate(target);
+    Word address = static_cast<Word>(destination.value);
+    Word region = (location() + 4) & 0xF0000000;
+    if (final_pass && (address % 4 != 0 || (destination.relocatable && (address & 0xF0000000) != region))) {
+        error("jump target " + target + " out of range");
+    }
+    emit((opcode << 26) | ((address >> 2) & 0x3FFFFFF));
+    delay_slot();
+}
+
+/**
+ * Sums and differences of numbers, character literals, symbols and %hi()/%lo() of those
+ */
+Value Assembler::evaluate(const string& expression) const {
+    string text = trim(expression);
+    if (text.empty()) error("missing operand");
+
+    Value result;
+    int labels_added = 0;
+    size_t i = 0;
+    while (i < text.size()) {
+        int sign = 1;
+        while (i < text.size() && (text[i] == '+' || text[i] == '-' || isspace(static_cast<unsigned char>(text[i])))) {
+            if (text[i] == '-') sign = -sign;
+            i++;
+        }
+
+        // The term runs to the next + or - outside of parentheses and character literals
+        size_t start = i;
+        int depth = 0;
+        for (; i < text.size(); i++) {
+            char c = text[i];
+            if (c == '\'') {
+                i += (i + 1 < text.size() && text[i + 1] == '\\') ? 3 : 2;
+                continue;
+            }
+            if (c == '(') depth++;
+            if (c == ')') depth--;
+            if (depth == 0 && i > start && (c == '+' || c == '-')) break;
+        }
+        Value part = term(trim(text.substr(start, min(i, text.size()) - start)));
+        result.value += sign * part.value;
+        result.known = result.known && part.known;
+        if (part.relocatable) labels_added += sign;
+    }
+    result.relocatable = labels_added != 0;
+    return result;
+}
+
+Value Assembler::term(const string& text) const {
+    if (text.empty()) error("missing operand");
+    Value result;
+
+    if (text.compare(0, 4, "%hi(") == 0 || text.compare(0, 4, "%lo(") == 0) {
+        if (text.back() != ')') error("bad expression " + text);
+        Value inner = evaluate(text.substr(4, text.size() - 5));
+        Word word = static_cast<Word>(inner.value);
+        result.value = text[1] == 'h' ? ((word + 0x8000) >> 16) : static_cast<int16_t>(word & 0xFFFF);
+        result.known = inner.known;
+        return result;
+    }
+
+    if (text[0] == '\'') {
+        string character = string_literal(text);
+        if (character.size() != 1) error("bad character " + text);
+        result.value = static_cast<unsigned char>(character[0]);
+        return result;
+    }
+
+    if (isdigit(static_cast<unsigned char>(text[0]))) {
+        char* end;
+        result.value = strtoll(text.c_str(), &end, 0);
+        if (*end != '\0') error("bad number " + text);
+        return result;
+    }
+
+    if (!is_symbol_char(text[0], true)) error("bad expression " + text);
+    for (char c : text) {
+        if (!is_symbol_char(c, false)) error("bad expression " + text);
+    }
+
+    auto symbol = set_symbols.find(text);
+    if (symbol != set_symbols.end()) return symbol->second;
+    auto label = labels.find(text);
+    if (label != labels.end()) {
+        result.value = label->second;
+        result.relocatable = true;
+        return result;
+    }
+    if (final_pass) error("undefined symbol " + text);
+    result.known = false;
+    result.relocatable = true;
+    return result;
+}
+
+int64_t Assembler::number(const string& expression) const {
+    Value value = evaluate(expression);
+    if (!value.known) error(expression + " must be defined before it is used here");
+    return value.value;
+}
+
+// A value that can be used to pick a shorter encoding: known in both passes and not an address
+bool Assembler::constant(const string& expression, int64_t& value) const {
+    Value result = evaluate(expression);
+    value = result.value;
+    return result.known && !result.relocatable;
+}
+
+bool Assembler::is_register(const string& text) const {
+    return !text.empty() && text[0] == '$';
+}
+
+RegisterId Assembler::reg(const string& text) const {
+    string name = lower(trim(text));
+    if (name.size() < 2 || name[0] != '$') error("expected a register, not " + text);
+    name = name.substr(1);
+
+    if (isdigit(static_cast<unsigned char>(name[0]))) {
+        char* end;
+        long number = strtol(name.c_str(), &end, 10);
+        if (*end == '\0' && number >= 0 && number < 32) return RegisterId{static_cast<uint8_t>(number)};
+    }
+    if (name == "s8") return RegisterId{30};
+    for (uint8_t i = 0; i < 32; i++) {
+        if (name == register_names[i]) return RegisterId{i};
+    }
+    error("unknown register " + text);
+}
+
+string Assembler::string_literal(const string& text) const {
+    if (text.size() < 2 || (text[0] != '"' && text[0] != '\'') || text.back() != text[0]) {
+        error("expected a string, not " + text);
+    }
+
+    string result;
+    for (size_t i = 1; i + 1 < text.size(); i++) {
+        char c = text[i];
+        if (c != '\\') {
+            result += c;
+            continue;
+        }
+        if (i + 2 >= text.size()) error("bad escape in " + text);
+        c = text[++i];
+        switch (c) {
+            case 'n': result += '\n'; break;
+            case 't': result += '\t'; break;
+            case 'r': result += '\r'; break;
+            case 'b': result += '\b'; break;
+            case 'f': result += '\f'; break;
+            case 'x': {
+                int value = 0;
+                while (i + 2 < text.size() && isxdigit(static_cast<unsigned char>(text[i + 1]))) {
+                    value = value * 16 + stoi(string(1, text[++i]), nullptr, 16);
+                }
+                result += static_cast<char>(value);
+                break;
+            }
+            default:
+                if (c >= '0' && c <= '7') {
+                    int value = c - '0';
+                    for (int digits = 1; digits < 3 && i + 2 < text.size() && text[i + 1] >= '0' && text[i + 1] <= '7'; digits++) {
+                        value = value * 8 + (text[++i] - '0');
+                    }
+                    result += static_cast<char>(value);
+                } else {
+                    result += c;
+                }
+        }
+    }
+    return result;
+}
+
+void Assembler::expect(const vector<string>& args, size_t count) const {
+    if (args.size() != count) error("expected " + to_string(count) + " operands");
+}
+
+void append32(string& out, uint32_t value) {
+    for (int shift = 24; shift >= 0; shift -= 8) out += static_cast<char>(value >> shift);
+}
+
+void append16(string& out, uint16_t value) {
+    out += static_cast<char>(value >> 8);
+    out += static_cast<char>(value);
+}
+
+}
+
+shared_ptr<const ProgramImage> AssembledProgram::image() const {
+    if (data.empty()) return make_shared<const ProgramImage>(text);
+    return make_shared<const ProgramImage>(text, instruction_start, vector<DataSegment>{ DataSegment{data_start, data} });
+}
+
+string AssembledProgram::binary() const {
+    string bytes;
+    for (Word word : text) append32(bytes, word);
+    return bytes;
+}
+
+/**
+ * A big-endian ELF32 executable: a PT_LOAD segment each for the text and the data (whose
+ * size in memory takes in the .bss), and a symbol table of the labels and symbols (as functions in the text, objects elsewhere) for
+ * --intercepts-from
+ */
+string AssembledProgram::elf() const {
+    const size_t header_size = 52;
+    const size_t program_header_size = 32;
+    const size_t section_header_size = 40;
+    const size_t segment_count = data.empty() && bss_size == 0 ? 1 : 2;
+
+    string strings(1, '\0');
+    string symbol_table(16, '\0');
+    for (const auto& symbol : symbols) {
+        append32(symbol_table, strings.size());
+        append32(symbol_table, symbol.second);
+        append32(symbol_table, 0);
+        bool function = is_instruction(symbol.second);
+        symbol_table += static_cast<char>((1 << 4) | (function ? 2 : 1));  // STB_GLOBAL, STT_FUNC/STT_OBJECT
+        symbol_table += '\0';
+        append16(symbol_table, 0xFFF1);  // SHN_ABS
+        strings += symbol.first + '\0';
+    }
+    const string section_names = string("\0.symtab\0.strtab\0.shstrtab\0", 27);
+
+    string contents = binary();
+    size_t text_offset = header_size + segment_count * program_header_size;
+    size_t data_offset = text_offset + contents.size();
+    size_t symbols_offset = data_offset + data.size();
+    size_t strings_offset = symbols_offset + symbol_table.size();
+    size_t names_offset = strings_offset + strings.size();
+    size_t sections_offset = (names_offset + section_names.size() + 3) / 4 * 4;
+
+    string elf("\x7f" "ELF\x01\x02\x01", 7);
+    elf.append(9, '\0');
+    append16(elf, 2);                       // ET_EXEC
+    append16(elf, 8);                       // EM_MIPS
+    append32(elf, 1);                       // EV_CURRENT
+    append32(elf, instruction_start);       // Entry point
+    append32(elf, header_size);             // Program headers
+    append32(elf, sections_offset);         // Section headers
+    append32(elf, 0);                       // Flags
+    append16(elf, header_size);
+    append16(elf, program_header_size);
+    append16(elf, segment_count);
+    append16(elf, section_header_size);
+    append16(elf, 4);                       // Sections
+    append16(elf, 3);                       // Section names
+
+    auto segment = [&] (size_t offset, Address address, size_t size, size_t memory_size, Word flags) {
+        append32(elf, 1);                   // PT_LOAD
+        append32(elf, offset);
+        append32(elf, address);
+        append32(elf, address);
+        append32(elf, size);
+        append32(elf, memory_size);
+        append32(elf, flags);
+        append32(elf, 4);
+    };
+    segment(text_offset, instruction_start, contents.size(), contents.size(), 5);  // R+X
+    if (segment_count == 2) {
+        segment(data_offset, data_start, data.size(), bss_size > 0 ? bss_offset + bss_size : data.size(), 6);  // R+W
+    }
+
+    elf += contents;
+    elf += data;
+    elf += symbol_table;
+    elf += strings;
+    elf += section_names;
+    elf.append(sections_offset - elf.size(), '\0');
+
+    auto section = [&] (Word name, Word type, size_t offset, size_t size, Word link, Word entry_size) {
+        append32(elf, name);
+        append32(elf, type);
+        append32(elf, 0);
+        append32(elf, 0);
+        append32(elf, offset);
+        append32(elf, size);
+        append32(elf, link);
+        append32(elf, type == 2 ? 1 : 0);   // For a symbol table, the first global symbol
+        append32(elf, type == 2 ? 4 : 1);
+        append32(elf, entry_size);
+    };
+    section(0, 0, 0, 0, 0, 0);
+    section(1, 2, symbols_offset, symbol_table.size(), 2, 16);  // .symtab, SHT_SYMTAB
+    section(9, 3, strings_offset, strings.size(), 0, 0);        // .strtab, SHT_STRTAB
+    section(17, 3, names_offset, section_names.size(), 0, 0);   // .shstrtab
+    return elf;
+}
+
+AssembledProgram assemble(const string& source, const string& name) {
+    return Assembler(name).assemble(source);
+}
+
+AssembledProgram assemble_file(const string& path) {
+    ifstream file(path, ios::binary);
+    if (!file.is_open()) throw AssemblyError("Can't open " + path);
+    string source((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+    return assemble(source, path);
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "typedefs.hpp"
+#include "program_image.hpp"
+
+/**
+ * The source doesn't assemble. The message starts with the file name and line
+ */
+class AssemblyError : public std::runtime_error {
+    public:
+        using std::runtime_error::runtime_error;
+};
+
+/**
+ * An assembled program, laid out like testbench/linker.ld does: .text from instruction_start
+ * and .data from data_start. It starts at instruction_start.
+ */
+struct AssembledProgram {
+    std::vector<Word> text;
+    std::string data;
+    // .bss: this many zeros from data_start + bss_offset, after the data
+    size_t bss_offset = 0;
+    size_t bss_size = 0;
+    // Labels and .set symbols
+    std::map<std::string, Address> symbols;
+
+    std::shared_ptr<const ProgramImage> image() const;
+    // The text as a binary, like `objcopy -O binary --only-section=.text`
+    std::string binary() const;
+    // A linked ELF file with the text and data as loadable segments, which load_image() reads
+    std::string elf() const;
+};
+
+/**
+ * Assemble MIPS I source as written in testbench/tests and toys/: the MIPS I instructions,
+ * the usual pseudo-instructions (li, la, move, b, bal, beqz, blt, bgt, ble, bge, ...), labels,
+ * .text/.data/.bss, .word/.half/.byte/.ascii/.asciz/.space/.align, .set NAME, VALUE and
+ * .set noreorder/reorder.
+ *
+ * The output is meant to match the binaries the Makefile builds with the MIPS toolchain (make
+ * check_assembler compares them): li is one instruction when the value fits in 16 bits and
+ * LUI then ORI when it doesn't, immediates for macros go through $at the same way, everything
+ * in .text starts on a word, and in the default reorder mode every branch and jump gets a
+ * no-op in its delay slot (nothing is moved into it).
+ *
+ * Throws AssemblyError, naming `name` and the line.
+ */
+AssembledProgram assemble(const std::string& source, const std::string& name);
+// Throws AssemblyError if the file can't be read
+AssembledProgram assemble_file(const std::string& path);
@@ -0,0 +1,223 @@
+#include <algorithm>
+
+#include "cache_model.hpp"
+#include "memory.hpp"
+#include "show.hpp"
+
+using namespace std;
+
+namespace {
+
+// Instructions listed by print()
+const size_t listed_instructions = 10;
+
+bool power_of_two(uint64_t value) {
+    return value != 0 && (value & (value - 1)) == 0;
+}
+
+unsigned int log2_of(uint32_t power) {
+    unsigned int bits = 0;
+    while ((uint32_t(1) << bits) < power) bits++;
+    return bits;
+}
+
+string show_size(uint32_t bytes) {
+    if (bytes >= 1024 * 1024 && bytes % (1024 * 1024) == 0) return show(bytes / (1024 * 1024)) + " MiB";
+    if (bytes >= 1024 && bytes % 1024 == 0) return show(bytes / 1024) + " KiB";
+    return show(bytes) + " B";
+}
+
+void print_misses(ostream& out, uint64_t misses, uint64_t accesses) {
+    out << misses << " misses";
+    if (accesses > 0) out << " (" << (100.0 * misses / accesses) << "%)";
+}
+
+void print_cache(ostream& out, const string& name, const Cache& cache) {
+    const CacheConfig& config = cache.get_config();
+    const CacheStats& stats = cache.get_stats();
+    out << name << " " << show_size(config.size) << ", " << config.ways << "-way, " << config.line << " B lines, "
+        << (config.replacement == Replacement::LRU ? "LRU" : "random") << ": "
+        << stats.accesses[0] << " reads, ";
+    print_misses(out, stats.misses[0], stats.accesses[0]);
+    if (stats.accesses[1] > 0) {
+        out << "; " << stats.accesses[1] << " writes, ";
+        print_misses(out, stats.misses[1], stats.accesses[1]);
+    }
+    out << "; " << stats.evictions << " evictions, " << stats.writebacks << " writebacks" << endl;
+}
+
+}
+
+bool parse_cache_config(const string& text, CacheConfig& config) {
+    vector<string> fields;
+    size_t start = 0;
+    while (true) {
+        size_t colon = text.find(':', start);
+        fields.push_back(text.substr(start, colon - start));
+        if (colon == string::npos) break;
+        start = colon + 1;
+    }
+    if (fields.size() < 3 || fields.size() > 4) return false;
+
+    uint64_t numbers[3];
+    for (size_t i = 0; i < 3; i++) {
+        const string& field = fields[i];
+        size_t end = 0;
+        try {
+            numbers[i] = stoull(field, &end, 0);
+        } catch (logic_error&) {
+            return false;
+        }
+        if (i == 0 && end + 1 == field.size()) {
+            if      (field[end] == 'k' || field[end] == 'K') { numbers[i] *= 1024; end++; }
+            else if (field[end] == 'm' || field[end] == 'M') { numbers[i] *= 1024 * 1024; end++; }
+        }
+        if (end != field.size() || !power_of_two(numbers[i])) return false;
+    }
+
+    Replacement replacement = Replacement::LRU;
+    if (fields.size() == 4) {
+        if      (fields[3] == "lru")    replacement = Replacement::LRU;
+        else if (fields[3] == "random") replacement = Replacement::RANDOM;
+        else return false;
+    }
+
+    // At least one set, and lines of at least a word
+    uint64_t size = numbers[0], ways = numbers[1], line = numbers[2];
+    if (size > (uint64_t(1) << 30) || line < 4 || ways * line > size) return false;
+
+    config = CacheConfig(size, ways, line, replacement);
+    return true;
+}
+
+Cache::Cache(const CacheConfig& i_config) :
+    config(i_config),
+    line_bits(log2_of(config.line)),
+    set_mask(config.size / config.line / config.ways - 1),
+    lines(config.size / config.line, invalid),
+    last_use(config.size / config.line, 0),
+    dirty(config.size / config.line, 0) {}
+
+/**
+ * The line isn't the one last used: look for it in its set, and replace a line with it if it
+ * isn't there. Empty slots are filled first
+ */
+bool Cache::access_slow(uint32_t line, bool write) {
+    stats.accesses[write]++;
+    clock++;
+
+    size_t first = static_cast<size_t>(line & set_mask) * config.ways;
+    size_t end = first + config.ways;
+    size_t slot = first;
+    for (; slot < end; slot++) {
+        if (lines[slot] == line) break;
+    }
+
+    bool hit = slot < end;
+    evicted_dirty = false;
+    if (!hit) {
+        stats.misses[write]++;
+
+        slot = end;
+        for (size_t candidate = first; candidate < end; candidate++) {
+            if (lines[candidate] == invalid) {
+                slot = candidate;
+                break;
+            }
+        }
+        if (slot == end) {
+            if (config.replacement == Replacement::LRU) {
+                slot = first;
+                for (size_t candidate = first + 1; candidate < end; candidate++) {
+                    if (last_use[candidate] < last_use[slot]) slot = candidate;
+                }
+            } else {
+                // xorshift32
+                random_state ^= random_state << 13;
+                random_state ^= random_state >> 17;
+                random_state ^= random_state << 5;
+                slot = first + (random_state & (config.ways - 1));
+            }
+
+            stats.evictions++;
+            if (dirty[slot]) {
+                stats.writebacks++;
+                evicted_dirty = true;
+                evicted = lines[slot] << line_bits;
+            }
+        }
+        lines[slot] = line;
+        dirty[slot] = 0;
+    }
+
+    last_use[slot] = clock;
+    dirty[slot] |= write;
+    last_line = line;
+    last_slot = slot;
+    return hit;
+}
+
+void Cache::reset() {
+    fill(lines.begin(), lines.end(), invalid);
+    fill(last_use.begin(), last_use.end(), 0);
+    fill(dirty.begin(), dirty.end(), 0);
+    clock = 0;
+    last_line = invalid;
+    last_slot = 0;
+    evicted_dirty = false;
+    stats = CacheStats();
+}
+
+CacheHierarchy::CacheHierarchy(const CacheHierarchyConfig& config, size_t program_size) :
+    l1i(config.instruction),
+    l1d(config.data),
+    l2(config.has_l2 ? config.l2 : CacheConfig(4, 1, 4)),
+    has_l2(config.has_l2),
+    // Data accesses before the first fetch are counted against the first instruction
+    instructions(max(program_size, size_t(1))) {}
+
+void CacheHierarchy::fill(const Cache& l1, Address addr, Address index) {
+    if (!has_l2) return;
+    if (!l2.access(addr, false)) instructions[index].l2_misses++;
+    if (l1.evicted_dirty) l2.access(l1.evicted, true);
+}
+
+void CacheHierarchy::reset() {
+    l1i.reset();
+    l1d.reset();
+    l2.reset();
+    std::fill(instructions.begin(), instructions.end(), InstructionCacheStats());
+    current = 0;
+}
+
+void CacheHierarchy::print(ostream& out, const vector<PredecodedInstruction>& program) const {
+    print_cache(out, "L1I", l1i);
+    print_cache(out, "L1D", l1d);
+    if (has_l2) print_cache(out, "L2 ", l2);
+
+    auto misses = [&] (Address index) {
+        const InstructionCacheStats& stats = instructions[index];
+        return stats.fetch_misses + stats.data_misses;
+    };
+    vector<Address> order;
+    for (Address index = 0; index < instructions.size(); index++) {
+        if (misses(index) > 0) order.push_back(index);
+    }
+    size_t listed = min(order.size(), listed_instructions);
+    partial_sort(order.begin(), order.begin() + listed, order.end(), [&] (Address a, Address b) {
+        return misses(a) != misses(b) ? misses(a) > misses(b) : a < b;
+    });
+
+    if (listed == 0) return;
+    out << "most cache misses:" << endl;
+    for (size_t i = 0; i < listed; i++) {
+        Address index = order[i];
+        const InstructionCacheStats& stats = instructions[index];
+        out << "  " << show(as_hex(instruction_start + 4 * index)) << ": ";
+        if (index < program.size() && program[index].valid) out << show(program[index].instruction);
+        else                                                 out << show(as_hex(index < program.size() ? program[index].word : 0));
+        out << "  fetch " << stats.fetch_misses << ", data " << stats.data_misses << "/" << stats.data_accesses;
+        if (has_l2) out << ", L2 " << stats.l2_misses;
+        out << endl;
+    }
+}
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "typedefs.hpp"
+#include "predecoder.hpp"
+
+enum class Replacement : uint8_t {
+    LRU,
+    RANDOM,
+};
+
+/**
+ * The geometry of one cache. Sizes are in bytes, and all three are powers of 2
+ */
+struct CacheConfig {
+    uint32_t size;
+    uint32_t ways;
+    uint32_t line;
+    Replacement replacement;
+
+    CacheConfig(uint32_t i_size = 16 * 1024, uint32_t i_ways = 2, uint32_t i_line = 32, Replacement i_replacement = Replacement::LRU) :
+        size(i_size), ways(i_ways), line(i_line), replacement(i_replacement) {}
+};
+
+// Read a cache written as SIZE:WAYS:LINE[:lru|random], where the size may end in k or m
+// (e.g. 32k:4:64:random). Returns false if it isn't one, or the geometry is impossible
+bool parse_cache_config(const std::string& text, CacheConfig& config);
+
+/**
+ * Counters of one cache. Accesses and misses are indexed by whether they were writes
+ */
+struct CacheStats {
+    std::array<uint64_t, 2> accesses {};
+    std::array<uint64_t, 2> misses {};
+    // Valid lines replaced, and how many of them were dirty
+    uint64_t evictions = 0;
+    uint64_t writebacks = 0;
+};
+
+/**
+ * A set-associative, write-back and write-allocate cache. It only keeps the tags, not the data.
+ *
+ * The state is in flat arrays indexed by set * ways + way, and the set and tag come out of an
+ * address by shifting and masking. A run of accesses to the same line (say, fetching a basic
+ * block) only compares one line number: the line last used is already the most recently used
+ * of its set, so nothing else has to change.
+ */
+class Cache {
+    private:
+        static const uint32_t invalid = UINT32_MAX;
+
+        CacheConfig config;
+        unsigned int line_bits;
+        uint32_t set_mask;
+
+        // The line number (address >> line_bits) in each slot, or `invalid`
+        std::vector<uint32_t> lines;
+        // When each slot was last used, for LRU
+        std::vector<uint64_t> last_use;
+        std::vector<uint8_t> dirty;
+        uint64_t clock = 0;
+        uint32_t random_state = 0x9E3779B9;
+
+        uint32_t last_line = invalid;
+        size_t last_slot = 0;
+
+        CacheStats stats;
+
+        bool access_slow(uint32_t line, bool write);
+
+    public:
+        explicit Cache(const CacheConfig& config);
+
+        // Set if the last miss evicted a dirty line, which then has to be written to the next
+        // level. This is the address of the line
+        bool evicted_dirty = false;
+        Address evicted = 0;
+
+        // Look up the line with `addr` in it, and fill it on a miss. Returns whether it hit
+        inline bool access(Address addr, bool write) {
+            uint32_t line = addr >> line_bits;
+            if (line == last_line) {
+                stats.accesses[write]++;
+                dirty[last_slot] |= write;
+                return true;
+            }
+            return access_slow(line, write);
+        }
+
+        // Empty the cache and clear its counters
+        void reset();
+
+        const CacheConfig& get_config() const { return config; }
+        const CacheStats& get_stats() const { return stats; }
+};
+
+/**
+ * The caches simulated for a run
+ */
+struct CacheHierarchyConfig {
+    CacheConfig instruction;
+    CacheConfig data {16 * 1024, 4, 32};
+    // A unified L2 behind both, if set
+    bool has_l2 = false;
+    CacheConfig l2 {256 * 1024, 8, 64};
+};
+
+/**
+ * Cache misses of one instruction: fetching it, and the loads and stores it makes
+ */
+struct InstructionCacheStats {
+    uint64_t fetch_misses = 0;
+    uint64_t data_accesses = 0;
+    uint64_t data_misses = 0;
+    uint64_t l2_misses = 0;
+};
+
+/**
+ * L1 instruction and data caches, with an optional unified L2 behind them.
+ *
+ * The CPU reports each instruction fetch, and Memory each load and store to instruction,
+ * data or mapped memory (the devices aren't cached), which are counted against the
+ * instruction last fetched. L1 misses and dirty L1 evictions go to the L2.
+ */
+class CacheHierarchy {
+    private:
+        Cache l1i;
+        Cache l1d;
+        Cache l2;
+        bool has_l2;
+
+        // Indexed like the predecoded program
+        std::vector<InstructionCacheStats> instructions;
+        Address current = 0;
+
+        // After a miss in `l1`: fill the line from the L2, and write back the line it evicted
+        void fill(const Cache& l1, Address addr, Address index);
+
+    public:
+        CacheHierarchy(const CacheHierarchyConfig& config, size_t program_size);
+
+        // Fetch the instruction at `pc`, which is `index` in the program. The loads and stores
+        // from here on are counted against it
+        inline void fetch(Address pc, Address index) {
+            current = index;
+            fetch_next(pc, index);
+        }
+        // Fetch the second instruction of a fused pair, leaving the data accesses counted
+        // against the first
+        inline void fetch_next(Address pc, Address index) {
+            if (!l1i.access(pc, false)) {
+                instructions[index].fetch_misses++;
+                fill(l1i, pc, index);
+            }
+        }
+
+        inline void data(Address addr, bool write) {
+            instructions[current].data_accesses++;
+            if (!l1d.access(addr, write)) {
+                instructions[current].data_misses++;
+                fill(l1d, addr, current);
+            }
+        }
+
+        void reset();
+
+        // The counters of each cache, and the instructions with the most misses
+        void print(std::ostream& out, const std::vector<PredecodedInstruction>& program) const;
+};
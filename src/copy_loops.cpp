@@ -0,0 +1,162 @@
+#include <vector>
+
+#include "copy_loops.hpp"
+
+using namespace std;
+
+namespace {
+
+unsigned int access_width(IOpCode opcode) {
+    switch (opcode) {
+        case IOpCode::LB: case IOpCode::LBU: case IOpCode::SB:
+            return 1;
+        case IOpCode::LH: case IOpCode::LHU: case IOpCode::SH:
+            return 2;
+        case IOpCode::LW: case IOpCode::SW:
+            return 4;
+        default:
+            return 0;
+    }
+}
+
+bool is_store(IOpCode opcode) {
+    return opcode == IOpCode::SB || opcode == IOpCode::SH || opcode == IOpCode::SW;
+}
+
+/**
+ * Check the loop closed by the BNE at `branch` and fill in `loop`. The instructions of an
+ * iteration are the body from the head up to the BNE, then the BNE, then its delay slot.
+ */
+bool analyse_loop(const vector<PredecodedInstruction>& program, Address head, Address branch, CopyLoop& loop) {
+    loop.head = head;
+    loop.branch = branch;
+    loop.length = branch - head + 2;
+
+    vector<Address> order;
+    for (Address index = head; index < branch; index++) order.push_back(index);
+    order.push_back(branch + 1);
+
+    // Position in `order` at which each register is stepped, if it is
+    int step_position[32];
+    for (int& position : step_position) position = -1;
+    int branch_position = branch - head;
+    bool has_load = false;
+    bool has_store = false;
+    int load_position = 0;
+    int store_position = 0;
+
+    for (size_t position = 0; position < order.size(); position++) {
+        const PredecodedInstruction& slot = program[order[position]];
+        if (slot.word == 0) continue;
+        if (!slot.valid || !slot.instruction.is<I_Instruction>()) return false;
+
+        const I_Instruction& inst = slot.instruction.get_unchecked<I_Instruction>();
+        if (inst.opcode == IOpCode::ADDIU) {
+            if (inst.dest != inst.src || inst.dest.value == 0 || inst.immediate == 0) return false;
+            if (step_position[inst.dest.value] >= 0) return false;
+            step_position[inst.dest.value] = position;
+            loop.steps.push_back(LoopStep{inst.dest, inst.immediate});
+        } else if (access_width(inst.opcode) == 0) {
+            return false;
+        } else if (is_store(inst.opcode)) {
+            if (has_store) return false;
+            has_store = true;
+            store_position = position;
+            loop.store = LoopAccess{inst.opcode, inst.dest, inst.src, inst.immediate, false};
+        } else {
+            if (has_load || inst.dest.value == 0) return false;
+            has_load = true;
+            load_position = position;
+            loop.load = LoopAccess{inst.opcode, inst.dest, inst.src, inst.immediate, false};
+        }
+    }
+    if (!has_store) return false;
+
+    auto stepped = [&] (RegisterId reg) { return step_position[reg.value] >= 0; };
+    auto written = [&] (RegisterId reg) { return stepped(reg) || (has_load && reg == loop.load.data); };
+
+    loop.width = access_width(loop.store.opcode);
+    loop.step = loop.step_of(loop.store.base);
+    if (loop.step != static_cast<int32_t>(loop.width) && loop.step != -static_cast<int32_t>(loop.width)) return false;
+    loop.store.after_step = step_position[loop.store.base.value] < store_position;
+
+    loop.copy = has_load;
+    if (loop.copy) {
+        // The stored register is the one just loaded, which is only used for that
+        if (access_width(loop.load.opcode) != loop.width) return false;
+        if (loop.store.data != loop.load.data || load_position > store_position) return false;
+        if (stepped(loop.load.data) || loop.load.data == loop.load.base || loop.load.data == loop.store.base) return false;
+        if (loop.step_of(loop.load.base) != loop.step) return false;
+        loop.load.after_step = step_position[loop.load.base.value] < load_position;
+    } else if (written(loop.store.data)) {
+        return false;
+    }
+
+    const I_Instruction& bne = program[branch].instruction.get_unchecked<I_Instruction>();
+    if (stepped(bne.src) && !written(bne.dest)) {
+        loop.counter = bne.src;
+        loop.limit = bne.dest;
+    } else if (stepped(bne.dest) && !written(bne.src)) {
+        loop.counter = bne.dest;
+        loop.limit = bne.src;
+    } else {
+        return false;
+    }
+    loop.counter_after_step = step_position[loop.counter.value] < branch_position;
+    return true;
+}
+
+// The inverse of an odd number modulo 2^32
+Word inverse(Word odd) {
+    // Newton's method, doubling the number of correct bits each time
+    Word inverse = odd;
+    for (int i = 0; i < 5; i++) inverse *= 2 - odd * inverse;
+    return inverse;
+}
+
+}
+
+int32_t CopyLoop::step_of(RegisterId reg) const {
+    for (const LoopStep& step : steps) {
+        if (step.reg == reg) return step.step;
+    }
+    return 0;
+}
+
+uint64_t CopyLoop::iterations(Word counter, Word limit) const {
+    // The BNE of iteration i (from 0) compares counter + (i + after) * step with the limit, so
+    // the loop stops after the first i for which (i + after) * step = limit - counter (mod 2^32).
+    // Solve k * step = distance for the smallest k: dividing out the common powers of 2
+    // leaves an odd step, which has an inverse modulo the rest
+    Word step = step_of(this->counter);
+    Word distance = limit - counter;
+    unsigned int twos = 0;
+    while (!(step & (1u << twos))) twos++;
+    if (distance & ((1u << twos) - 1)) return 0;
+
+    uint64_t period = uint64_t(1) << (32 - twos);
+    uint64_t k = static_cast<Word>((distance >> twos) * inverse(step >> twos)) % period;
+
+    unsigned int after = counter_after_step ? 1 : 0;
+    if (k < after) k += period;
+    return k - after + 1;
+}
+
+vector<CopyLoop> find_copy_loops(const vector<PredecodedInstruction>& program) {
+    vector<CopyLoop> loops;
+
+    for (Address head = 0; head < program.size(); head++) {
+        // The shortest loop back to here, since one head can only have one loop
+        for (Address branch = head + 1; branch + 1 < program.size() && branch - head < max_copy_loop_length; branch++) {
+            const PredecodedInstruction& slot = program[branch];
+            if (!slot.valid || !slot.instruction.is<I_Instruction>()) continue;
+            const I_Instruction& inst = slot.instruction.get_unchecked<I_Instruction>();
+            if (inst.opcode != IOpCode::BNE || static_cast<int64_t>(branch) + 1 + inst.immediate != head) continue;
+
+            CopyLoop loop;
+            if (analyse_loop(program, head, branch, loop)) loops.push_back(loop);
+            break;
+        }
+    }
+    return loops;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "typedefs.hpp"
+#include "opcodes.hpp"
+#include "predecoder.hpp"
+
+// Longest loop body looked at, in instructions
+const unsigned int max_copy_loop_length = 16;
+
+/**
+ * The load or store of a copy loop
+ */
+struct LoopAccess {
+    IOpCode opcode;
+    // The register loaded or stored
+    RegisterId data;
+    RegisterId base;
+    Offset offset;
+    // The base register is stepped before the access in each iteration
+    bool after_step;
+};
+
+/**
+ * An ADDIU r, r, step in a copy loop
+ */
+struct LoopStep {
+    RegisterId reg;
+    int32_t step;
+};
+
+/**
+ * A loop that does nothing but copy memory to memory, or fill it with a register, an
+ * element at a time:
+ *
+ *   head: LB/LBU/LH/LHU/LW  $t, offset($src)     (only for a copy)
+ *         SB/SH/SW          $t/$value, offset($dst)
+ *         ADDIU             $r, $r, step         (once for each register stepped)
+ *         BNE               $counter, $limit, head
+ *         delay slot        (any of the above, or a no-op)
+ *
+ * in any order, with no-ops anywhere. Both addresses step by one element, in the same
+ * direction, and $counter is any stepped register (say, the source pointer or a count down to
+ * $0). Nothing else is written, so $limit and $value are the same in every iteration.
+ */
+struct CopyLoop {
+    // Indexes in the predecoded program of the first instruction and of the BNE
+    Address head;
+    Address branch;
+    // Instructions in each iteration, including no-ops and the delay slot
+    unsigned int length;
+    // Bytes per element, and the step of both addresses: width or -width
+    unsigned int width;
+    int32_t step;
+
+    bool copy;
+    LoopAccess load;
+    LoopAccess store;
+
+    RegisterId counter;
+    RegisterId limit;
+    // The counter is stepped before the BNE compares it
+    bool counter_after_step;
+    std::vector<LoopStep> steps;
+
+    // Iterations still to go with `counter` and `limit` in their registers at the head
+    // (at least 1, since the BNE comes last), or 0 if the counter would never reach the limit
+    uint64_t iterations(Word counter, Word limit) const;
+    int32_t step_of(RegisterId reg) const;
+};
+
+// The copy loops in a predecoded program, in order of their heads
+std::vector<CopyLoop> find_copy_loops(const std::vector<PredecodedInstruction>& program);
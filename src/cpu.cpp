@@ -1,13 +1,77 @@
 #include <algorithm>
 
 #include "cpu.hpp"
-#include "exceptions.hpp"
+#include "syscalls.hpp"
+#include "fault.hpp"
 #include "opcodes.hpp"
 #include "memory.hpp"
 
+CPU::CPU(std::shared_ptr<const ProgramImage> image) :
+    memory(std::move(image), fault),
+    program(&memory.get_image().get_program()),
+    registers(),
+    PC(memory.get_image().get_entry()),
+    nPC(PC + 4) {
+        target_cache.resize(program->size());
+    }
+
 CPU::CPU(std::unique_ptr<std::vector<Word>> instructions) :
-    memory(std::move(instructions)),
-    registers() {}
+    CPU(std::make_shared<const ProgramImage>(std::move(*instructions))) {}
+
+CPU::CPU(const CPU& other) :
+    fault(other.fault),
+    memory(other.memory, fault),
+    program(other.hooked_program ? other.hooked_program.get() : &memory.get_image().get_program()),
+    registers(other.registers),
+    PC(other.PC),
+    nPC(other.nPC),
+    LO(other.LO),
+    HI(other.HI),
+    fusion(other.fusion),
+    max_instructions(other.max_instructions),
+    stats(other.stats),
+    current_index(other.current_index),
+    target_cache(other.target_cache),
+    return_stack(other.return_stack),
+    return_stack_depth(other.return_stack_depth),
+    predicted(other.predicted),
+    hooked_program(other.hooked_program),
+    routines(other.routines),
+    verify_intercepts(other.verify_intercepts),
+    intercept_stats(other.intercept_stats),
+    verifying_return(other.verifying_return),
+    copy_loops(other.copy_loops),
+    loop_acceleration(other.loop_acceleration) {}
+
+std::unique_ptr<CPU> CPU::fork() const {
+    return std::unique_ptr<CPU>(new CPU(*this));
+}
+
+void CPU::reset() {
+    memory.reset();
+    fault.clear();
+    registers.fill(0);
+    PC = memory.get_image().get_entry();
+    nPC = PC + 4;
+    LO = 0;
+    HI = 0;
+    stats = ExecutionStats();
+    current_index = 0;
+    return_stack_depth = 0;
+    predicted = BranchTarget();
+    intercept_stats = InterceptStats();
+    verifying_return = 0;
+    if (caches) caches->reset();
+}
+
+void CPU::set_caches(const CacheHierarchyConfig& config) {
+    caches.reset(new CacheHierarchy(config, program->size()));
+    memory.set_caches(caches.get());
+}
+
+void CPU::print_cache_stats(std::ostream& out) const {
+    if (caches) caches->print(out, *program);
+}
 
 int CPU::get_register(RegisterId regId) const {
     uint8_t reg = regId.value;
@@ -26,33 +90,517 @@ void CPU::advance_pc(Address offset) {
     nPC += offset;
 }
 
-uint8_t CPU::run() { return run(false); }
+int CPU::run() { return run(false); }
 
-uint8_t CPU::run(bool trace) {
-    try {
-        while (true) {
-            // Jump to 0x0 means terminate
-            if (PC == 0) break;
-            // Executing outside of instruction memory is a a memory error
-            if (!is_instruction(PC)) throw MemoryError("Tried to execute address " + show(as_hex(PC)));
+/**
+ * Run until the program jumps to 0x0 or faults.
+ *
+ * Returns the exit code: the low byte of $v0, or the fault's error code if the program
+ * faulted (see get_fault()).
+ */
+int CPU::run(bool trace) {
+    run_until(max_instructions, trace);
+    return get_exit_code();
+}
+
+RunStatus CPU::step(uint64_t instructions) {
+    uint64_t limit = max_instructions;
+    if (stats.instructions < max_instructions && max_instructions - stats.instructions > instructions) {
+        limit = stats.instructions + instructions;
+    }
+    return run_until(limit, false);
+}
+
+int CPU::get_exit_code() const {
+    if (fault.raised()) return fault.get_error_code();
+    return get_register(RegisterId{2}) & 0xFF;
+}
+
+/**
+ * Check if a load, DMA command or SYSCALL would read getc's input, i.e. it would have to wait
+ * for input
+ */
+bool CPU::reads_input(const PredecodedInstruction& slot) const {
+    if (!slot.instruction.is<I_Instruction>()) {
+        return syscall_reads_input(get_register(RegisterId{2}), get_register(RegisterId{4}));
+    }
+    const I_Instruction& access = slot.instruction.get_unchecked<I_Instruction>();
+    Address address = get_register(access.src) + access.immediate;
+    if (slot.store) return memory.dma_reads_input(address, get_register(access.dest));
+    return is_getc(address);
+}
 
-            Word inst_bin = memory.get_word(PC);
+/**
+ * Check if a load or store would have to wait for a mailbox channel
+ */
+bool CPU::blocks_on_mailbox(const PredecodedInstruction& slot) const {
+    if (!slot.instruction.is<I_Instruction>()) return false;
+    const I_Instruction& access = slot.instruction.get_unchecked<I_Instruction>();
+    return memory.mailbox_blocks(get_register(access.src) + access.immediate, slot.store);
+}
+
+/**
+ * The run loop: run until the program exits or faults, `limit` instructions have been
+ * executed, or it has to wait for input or a mailbox.
+ *
+ * It can be resumed after any of these, since it only ever stops between instructions.
+ */
+RunStatus CPU::run_until(uint64_t limit, bool trace) {
+    const std::vector<PredecodedInstruction>& program = *this->program;
+
+    while (!fault.raised()) {
+        // Jump to 0x0 means terminate
+        if (PC == 0) break;
+        if (stats.instructions >= limit) {
+            if (limit < max_instructions) return RunStatus::PREEMPTED;
+            fault.raise(FaultReason::INSTRUCTION_BUDGET, PC);
+            break;
+        }
+        stats.instructions++;
+        stats.dispatches++;
 
-            // Skip no-ops
-            if (inst_bin == 0) {
+        Address index;
+        if (PC == predicted.target) {
+            // Already checked when the jump was resolved
+            index = predicted.index;
+        } else {
+            // Executing outside of instruction memory is a a memory error
+            if (!is_instruction(PC)) {
+                fault.raise(FaultReason::EXECUTE_OUT_OF_BOUNDS, PC);
+                break;
+            }
+            if (PC % 4 != 0) {
+                fault.raise(FaultReason::UNALIGNED_WORD, PC);
+                break;
+            }
+
+            // Past the end of the program instruction memory reads as no-ops
+            index = (PC - instruction_start) / 4;
+            if (index >= program.size()) {
                 advance_pc(4);
                 continue;
             }
+        }
+        current_index = index;
+        if (caches) caches->fetch(PC, index);
+
+        // Hooks are marked invalid (see rebuild_hooks): unless one runs, carry on with the
+        // original instruction
+        const PredecodedInstruction* hooked = &program[index];
+        if (!hooked->valid && hooked_program) {
+            if (run_hook(index, limit)) continue;
+            hooked = &memory.get_image().get_program()[index];
+        }
+        const PredecodedInstruction& slot = *hooked;
+
+        // Skip no-ops
+        if (slot.word == 0) {
+            advance_pc(4);
+            continue;
+        }
+
+        if (!slot.valid) {
+            fault.raise(FaultReason::INVALID_INSTRUCTION, slot.word);
+            break;
+        }
+
+        // Stop before the load, so that it is executed again when the input arrives
+        if ((slot.load || slot.store) && memory.input_pending() && reads_input(slot)) {
+            stats.instructions--;
+            stats.dispatches--;
+            return RunStatus::WAITING_FOR_INPUT;
+        }
+        if ((slot.load || slot.store) && memory.has_mailboxes() && blocks_on_mailbox(slot)) {
+            stats.instructions--;
+            stats.dispatches--;
+            return RunStatus::WAITING_FOR_MAILBOX;
+        }
+
+        // A pair only runs fused if the second instruction really comes next
+        if (fusion && slot.fusion != Fusion::NONE) {
+            if (nPC == PC + 4 && stats.instructions < limit) {
+                const PredecodedInstruction& next = program[index + 1];
+                if (trace) {
+                    cout << show(as_hex(PC)) << ": " << show(slot.instruction) << endl;
+                    cout << show(as_hex(PC + 4)) << ": " << show(next.instruction) << endl;
+                }
+                stats.instructions++;
+                stats.fused[static_cast<size_t>(slot.fusion)]++;
+                if (caches) caches->fetch_next(PC + 4, index + 1);
+                execute_fused(slot, next);
+                continue;
+            }
+            stats.unfused[static_cast<size_t>(slot.fusion)]++;
+        }
+
+        if (trace) cout << show(as_hex(PC)) << ": " << show(slot.instruction) << endl;
+
+        if (slot.self_loop) {
+            // Taken, and not from a delay slot: the next iteration starts in exactly the same state
+            Address branch = PC;
+            bool sequential = (nPC == PC + 4);
+            execute_instruction(slot.instruction);
+            if (sequential && PC == branch + 4 && nPC == branch) {
+                fault.raise(FaultReason::INFINITE_LOOP, branch);
+            }
+            continue;
+        }
+
+        execute_instruction(slot.instruction);
+    }
+
+    return RunStatus::EXITED;
+}
+
+/**
+ * Execute a fused pair of instructions. Must have exactly the same effect as executing
+ * `first` and then `second`.
+ */
+void CPU::execute_fused(const PredecodedInstruction& first, const PredecodedInstruction& second) {
+    switch (first.fusion) {
+        case Fusion::LUI_ORI: {
+            const I_Instruction& lui = first.instruction.get_unchecked<I_Instruction>();
+            const I_Instruction& ori = second.instruction.get_unchecked<I_Instruction>();
+            set_register(lui.dest, static_cast<uint16_t>(lui.immediate) << 16);
+            set_register(ori.dest, get_register(ori.src) | static_cast<uint16_t>(ori.immediate));
+            advance_pc(4);
+            advance_pc(4);
+            break;
+        }
+        case Fusion::SLT_BRANCH: {
+            if (first.instruction.is<R_Instruction>()) execute_r_type(first.instruction.get_unchecked<R_Instruction>());
+            else                                       execute_i_type(first.instruction.get_unchecked<I_Instruction>());
+
+            const I_Instruction& branch = second.instruction.get_unchecked<I_Instruction>();
+            bool equal = get_register(branch.src) == get_register(branch.dest);
+            if (equal == (branch.opcode == IOpCode::BEQ)) {
+                advance_pc(branch.immediate << 2);
+            } else {
+                advance_pc(4);
+            }
+            break;
+        }
+        case Fusion::LOAD_ALU:
+            execute_i_type(first.instruction.get_unchecked<I_Instruction>());
+            if (fault.raised()) break;
+            if (second.instruction.is<R_Instruction>()) execute_r_type(second.instruction.get_unchecked<R_Instruction>());
+            else                                        execute_i_type(second.instruction.get_unchecked<I_Instruction>());
+            break;
+        case Fusion::NONE:
+            break;
+    }
+}
+
+/**
+ * Check that a jump target is a fetchable instruction of the program and find its index.
+ */
+bool CPU::resolve_target(Address target, BranchTarget& resolved) const {
+    if (!is_instruction(target) || target % 4 != 0) return false;
+
+    Address index = (target - instruction_start) / 4;
+    if (index >= program->size()) return false;
+
+    resolved.target = target;
+    resolved.index = index;
+    return true;
+}
+
+void CPU::push_return(Address return_address) {
+    BranchTarget& entry = return_stack[return_stack_depth % return_stack_size];
+    if (!resolve_target(return_address, entry)) entry = BranchTarget();
+    return_stack_depth++;
+}
+
+/**
+ * Predict the target of a JR/JALR, which is about to jump to `target` after its delay slot.
+ *
+ * Returns (JR $ra) are predicted by the return address stack, everything else by the
+ * last target seen at the same jump site. A correct prediction saves the checks when the
+ * target is fetched.
+ */
+void CPU::jump_register(Address target, bool is_return) {
+    if (is_return && target == verifying_return) verifying_return = 0;
+
+    if (is_return && return_stack_depth > 0) {
+        return_stack_depth--;
+        const BranchTarget& entry = return_stack[return_stack_depth % return_stack_size];
+        if (entry.target == target && target != 0) {
+            stats.return_hits++;
+            predicted = entry;
+            return;
+        }
+        stats.return_misses++;
+    }
+
+    if (current_index >= target_cache.size()) return;
+
+    BranchTarget& entry = target_cache[current_index];
+    if (entry.target == target && target != 0) {
+        stats.indirect_hits++;
+        predicted = entry;
+    } else {
+        stats.indirect_misses++;
+        if (!resolve_target(target, entry)) entry = BranchTarget();
+        else                               predicted = entry;
+    }
+}
 
-            Instruction inst = decode(inst_bin);
-            if (trace) cout << show(as_hex(PC)) << ": " << show(inst) << endl;
-            execute_instruction(inst);
+/**
+ * Point `program` at a copy of the image's program with the entries of intercepted routines
+ * and the heads of copy loops marked invalid, or back at the image's program if there are none.
+ */
+void CPU::rebuild_hooks() {
+    const std::vector<PredecodedInstruction>& original = memory.get_image().get_program();
+    if (routines.empty() && copy_loops.empty()) {
+        hooked_program.reset();
+        program = &original;
+        return;
+    }
+
+    std::shared_ptr<std::vector<PredecodedInstruction>> copy(new std::vector<PredecodedInstruction>(original));
+    for (size_t index = 0; index < routines.size(); index++) {
+        if (routines[index] != Routine::NONE) (*copy)[index].valid = false;
+    }
+    for (const CopyLoop& loop : copy_loops) (*copy)[loop.head].valid = false;
+
+    hooked_program = copy;
+    program = hooked_program.get();
+}
+
+bool CPU::set_intercepts(const std::vector<Intercept>& intercepts, bool verify) {
+    const std::vector<PredecodedInstruction>& original = memory.get_image().get_program();
+    std::vector<Routine> entries(original.size(), Routine::NONE);
+
+    for (const Intercept& intercept : intercepts) {
+        Address index = (intercept.address - instruction_start) / 4;
+        if (!is_instruction(intercept.address) || intercept.address % 4 != 0 || index >= original.size()
+                || !original[index].valid || original[index].word == 0) {
+            return false;
+        }
+        entries[index] = intercept.routine;
+    }
+
+    routines = std::move(entries);
+    verify_intercepts = verify;
+    rebuild_hooks();
+    return true;
+}
+
+void CPU::clear_intercepts() {
+    routines.clear();
+    rebuild_hooks();
+}
+
+void CPU::set_loop_acceleration(bool enabled) {
+    copy_loops = enabled ? find_copy_loops(memory.get_image().get_program()) : std::vector<CopyLoop>();
+    loop_acceleration = enabled;
+    rebuild_hooks();
+}
+
+/**
+ * Execution has reached an instruction marked invalid by rebuild_hooks(). Returns true if it
+ * ran an intercepted routine or a copy loop in one go, false if the original instruction
+ * should be executed as usual.
+ */
+bool CPU::run_hook(Address index, uint64_t limit) {
+    if (!routines.empty() && routines[index] != Routine::NONE) return run_intercept(index);
+
+    auto loop = std::lower_bound(copy_loops.begin(), copy_loops.end(), index,
+                                 [] (const CopyLoop& loop, Address index) { return loop.head < index; });
+    if (loop == copy_loops.end() || loop->head != index) return false;
+    if (run_copy_loop(*loop, limit)) return true;
+    stats.bulk_declined++;
+    return false;
+}
+
+/**
+ * Execution has reached the entry of an intercepted routine. If it was called (rather than
+ * being in a delay slot) and the native version can stand in for it, run that and return to
+ * $ra. The call counts as one instruction (already counted) plus one per byte the routine
+ * handles. A call that would run past the instruction budget runs the guest code instead,
+ * which stops exactly where the budget runs out; a time slice may be overrun.
+ */
+bool CPU::run_intercept(Address index) {
+    Routine routine = routines[index];
+    current_index = index;
+
+    if (nPC != PC + 4) {
+        intercept_stats.declined++;
+        return false;
+    }
+
+    if (verify_intercepts) {
+        if (verifying_return == 0) {
+            verify_intercept(routine);
+            verifying_return = get_register(RegisterId{31});
         }
-        return get_register(RegisterId{2}) & 0xFF;
-    } catch (MIPSError &err) {
-        cerr << err.error_message << endl;
-        std::exit(err.get_error_code());
+        return false;
+    }
+
+    Word result;
+    uint64_t bytes;
+    uint64_t budget = max_instructions > stats.instructions ? max_instructions - stats.instructions : 0;
+    if (!run_routine(routine, memory, get_register(RegisterId{4}), get_register(RegisterId{5}),
+                     get_register(RegisterId{6}), budget, result, bytes)) {
+        intercept_stats.declined++;
+        return false;
+    }
+    stats.instructions += bytes;
+    intercept_stats.calls[static_cast<size_t>(routine)]++;
+    set_register(RegisterId{2}, result);
+
+    Address return_address = get_register(RegisterId{31});
+    jump_register(return_address, true);
+    PC = return_address;
+    nPC = return_address + 4;
+    return true;
+}
+
+/**
+ * Execution has reached the head of a copy loop, at the start of an iteration. Run all the
+ * iterations still to go at once, leaving every register as the loop would and carrying on
+ * after its delay slot. Declines, having changed nothing, if the loop was entered from a delay
+ * slot, would run out of instructions, fault, or touch anything but memory (e.g. getc), or
+ * copy between ranges that overlap.
+ */
+bool CPU::run_copy_loop(const CopyLoop& loop, uint64_t limit) {
+    if (nPC != PC + 4) return false;
+
+    uint64_t iterations = loop.iterations(get_register(loop.counter), get_register(loop.limit));
+    if (iterations == 0 || iterations > data_size) return false;
+    // The head has already been counted
+    if (stats.instructions - 1 + iterations * loop.length > limit) return false;
+
+    auto first_address = [&] (const LoopAccess& access) -> Address {
+        return get_register(access.base) + (access.after_step ? loop.step : 0) + access.offset;
     };
+    uint64_t length = iterations * loop.width;
+    // The lowest address either access makes
+    int64_t span = static_cast<int64_t>(iterations - 1) * loop.step;
+    Address lowest_offset = span < 0 ? static_cast<Address>(span) : 0;
+
+    Address destination = first_address(loop.store);
+    if (destination % loop.width != 0) return false;
+    if (loop.copy) {
+        Address source = first_address(loop.load);
+        if (source % loop.width != 0) return false;
+        if (!memory.copy_block(destination + lowest_offset, source + lowest_offset, length)) return false;
+
+        // The last element loaded is left in its register
+        Address last = source + static_cast<Address>(span);
+        Word value = 0;
+        switch (loop.load.opcode) {
+            case IOpCode::LB:  value = static_cast<int32_t>(static_cast<int8_t>(memory.get_byte(last))); break;
+            case IOpCode::LBU: value = memory.get_byte(last); break;
+            case IOpCode::LH:  value = static_cast<int32_t>(static_cast<int16_t>(memory.get_halfword(last))); break;
+            case IOpCode::LHU: value = memory.get_halfword(last); break;
+            default:           value = memory.get_word(last); break;
+        }
+        set_register(loop.load.data, value);
+    } else {
+        if (!memory.fill_block(destination + lowest_offset, get_register(loop.store.data), loop.width, length)) return false;
+    }
+
+    for (const LoopStep& step : loop.steps) {
+        set_register(step.reg, static_cast<Word>(get_register(step.reg)) + static_cast<Word>(step.step) * static_cast<Word>(iterations));
+    }
+
+    stats.instructions += iterations * loop.length - 1;
+    stats.bulk_loops++;
+    stats.bulk_iterations += iterations;
+
+    PC = instruction_start + 4 * (loop.branch + 2);
+    nPC = PC + 4;
+    return true;
+}
+
+namespace {
+
+bool same_page(const Page* a, const Page* b) {
+    if (a == b) return true;
+    // A page that was never written is all zeros
+    static const Page zeros = Page();
+    return *(a ? a : &zeros) == *(b ? b : &zeros);
+}
+
+}
+
+/**
+ * Run the routine natively on a copy of memory, and as guest code on a fork that returns to
+ * 0x0 (i.e. exits) when the routine returns, and compare what is left of them: $v0, the
+ * registers the routine must preserve, and data memory.
+ */
+void CPU::verify_intercept(Routine routine) {
+    Fault native_fault;
+    Memory native_memory(memory, native_fault);
+    Word result;
+    uint64_t bytes;
+    if (!run_routine(routine, native_memory, get_register(RegisterId{4}), get_register(RegisterId{5}),
+                     get_register(RegisterId{6}), UINT64_MAX, result, bytes)) {
+        intercept_stats.declined++;
+        return;
+    }
+
+    std::unique_ptr<CPU> guest = fork();
+    guest->clear_intercepts();
+    guest->set_register(RegisterId{31}, 0);
+    uint64_t before = guest->stats.instructions;
+    guest->run(false);
+
+    intercept_stats.verified++;
+    intercept_stats.guest_instructions += guest->stats.instructions - before;
+
+    bool same = !guest->fault.raised() && static_cast<Word>(guest->get_register(RegisterId{2})) == result;
+    for (uint8_t reg : { 16, 17, 18, 19, 20, 21, 22, 23, 28, 29, 30 }) {
+        same = same && guest->get_register(RegisterId{reg}) == get_register(RegisterId{reg});
+    }
+    for (size_t page = 0; same && page < data_page_count; page++) {
+        same = same_page(native_memory.get_page(page), guest->memory.get_page(page));
+    }
+
+    if (!same) {
+        intercept_stats.mismatches++;
+        std::cerr << "intercepted " << show(routine) << " at " << show(as_hex(PC))
+                  << " differs from the guest code" << std::endl;
+    }
+}
+
+void CPU::print_stats(std::ostream& out) const {
+    out << "instructions: " << stats.instructions << std::endl;
+    out << "dispatches:   " << stats.dispatches << std::endl;
+    for (size_t kind = 1; kind < fusion_kinds; kind++) {
+        uint64_t fused = stats.fused[kind];
+        uint64_t reached = fused + stats.unfused[kind];
+        out << "fused " << show(static_cast<Fusion>(kind)) << ": " << fused << "/" << reached;
+        if (reached > 0) out << " (" << (100.0 * fused / reached) << "%)";
+        out << std::endl;
+    }
+    out << "indirect jump target cache: " << stats.indirect_hits << " hits, "
+        << stats.indirect_misses << " misses" << std::endl;
+    out << "return address stack:       " << stats.return_hits << " hits, "
+        << stats.return_misses << " misses" << std::endl;
+
+    if (loop_acceleration) {
+        out << "copy loops: " << copy_loops.size() << " found, run in one go " << stats.bulk_loops << " times ("
+            << stats.bulk_iterations << " iterations), declined " << stats.bulk_declined << " times" << std::endl;
+    }
+
+    if (routines.empty()) return;
+    for (size_t routine = 1; routine < routine_count; routine++) {
+        out << "intercepted " << show(static_cast<Routine>(routine)) << ": "
+            << intercept_stats.calls[routine] << " calls" << std::endl;
+    }
+    out << "intercepts declined: " << intercept_stats.declined << std::endl;
+    if (verify_intercepts) {
+        const InterceptStats& verified = intercept_stats;
+        out << "intercepts verified: " << verified.verified << ", " << verified.mismatches << " mismatches, "
+            << verified.guest_instructions << " guest instructions";
+        if (verified.verified > 0) {
+            out << " (" << (static_cast<double>(verified.guest_instructions) / verified.verified)
+                << " per call that a native call replaces)";
+        }
+        out << std::endl;
+    }
 }
 
 void CPU::execute_instruction(Instruction instruction) {
@@ -83,19 +631,23 @@ void CPU::execute_r_type(R_Instruction inst) {
     switch (inst.function) {
         case OpFunction::JALR:
             set_register(inst.dest, PC + 8);
+            push_return(PC + 8);
             PC = nPC;
             nPC = get_register(inst.src1);
+            jump_register(nPC, false);
             break;
         case OpFunction::JR:
             PC = nPC;
             nPC = get_register(inst.src1);
+            jump_register(nPC, inst.src1 == rRA);
             break;
         case OpFunction::SLL:
             set_register(inst.dest, get_register(inst.src2) << inst.shift);
             advance_pc(4);
             break;
         case OpFunction::SLLV:
-            set_register(inst.dest, (unsigned int) get_register(inst.src2) << (unsigned int) get_register(inst.src1));
+            // Only the low 5 bits of the amount count, and shifting by 32 or more is undefined in C++
+            set_register(inst.dest, (unsigned int) get_register(inst.src2) << (get_register(inst.src1) & 0x1F));
             advance_pc(4);
             break;
         case OpFunction::SRA:
@@ -103,7 +655,7 @@ void CPU::execute_r_type(R_Instruction inst) {
             advance_pc(4);
             break;
         case OpFunction::SRAV:
-            set_register(inst.dest, (int) get_register(inst.src2) >> (int) get_register(inst.src1));
+            set_register(inst.dest, (int) get_register(inst.src2) >> (get_register(inst.src1) & 0x1F));
             advance_pc(4);
             break;
         case OpFunction::SRL:
@@ -111,7 +663,7 @@ void CPU::execute_r_type(R_Instruction inst) {
             advance_pc(4);
             break;
         case OpFunction::SRLV:
-            set_register(inst.dest, (unsigned int) get_register(inst.src2) >> (unsigned int) get_register(inst.src1));
+            set_register(inst.dest, (unsigned int) get_register(inst.src2) >> (get_register(inst.src1) & 0x1F));
             advance_pc(4);
             break;
         case OpFunction::SLT:
@@ -132,36 +684,44 @@ void CPU::execute_r_type(R_Instruction inst) {
                 advance_pc(4);
             }
             break;
-        case OpFunction::ADD:
-            if((get_register(inst.src1) + get_register(inst.src2) >= 0) && (get_register(inst.src1) < 0 && get_register(inst.src2) < 0)) {
-                throw ArithmeticError("Overflow");
-            }
-            if((get_register(inst.src1) > 0 && get_register(inst.src2) > 0) && ((get_register(inst.src1) + get_register(inst.src2) <= 0))) {
-                throw ArithmeticError("Overflow");
+        case OpFunction::ADD: {
+            // Overflow if both operands have the same sign and the sum the other. The sum is
+            // taken unsigned, since a signed overflow is undefined behaviour in C++
+            uint32_t a = get_register(inst.src1), b = get_register(inst.src2), sum = a + b;
+            if ((a ^ sum) & (b ^ sum) & 0x80000000) {
+                fault.raise(FaultReason::ARITHMETIC_OVERFLOW);
+                break;
             }
-            set_register(inst.dest, get_register(inst.src1) + get_register(inst.src2));
+            set_register(inst.dest, sum);
             advance_pc(4);
             break;
+        }
         case OpFunction::ADDU:
             set_register(inst.dest, get_register(inst.src2) + get_register(inst.src1));
             advance_pc(4);
             break;
-        case OpFunction::SUB:
-            if((get_register(inst.src1) - get_register(inst.src2) >= 0) && (get_register(inst.src1) < 0 && get_register(inst.src2) >= 0)) {
-                throw ArithmeticError("Overflow");
-            }
-            if((get_register(inst.src1) >= 0 && get_register(inst.src2) < 0) && ((get_register(inst.src1) - get_register(inst.src2) < 0))) {
-                throw ArithmeticError("Overflow");
+        case OpFunction::SUB: {
+            // Overflow if the operands have different signs and the difference has the sign of
+            // the second
+            uint32_t a = get_register(inst.src1), b = get_register(inst.src2), difference = a - b;
+            if ((a ^ b) & (a ^ difference) & 0x80000000) {
+                fault.raise(FaultReason::ARITHMETIC_OVERFLOW);
+                break;
             }
-            set_register(inst.dest, get_register(inst.src1) - get_register(inst.src2));
+            set_register(inst.dest, difference);
             advance_pc(4);
             break;
+        }
         case OpFunction::SUBU:
             set_register(inst.dest, get_register(inst.src1) - get_register(inst.src2));
             advance_pc(4);
             break;
         case OpFunction::DIV:
-            if(get_register(inst.src2) != 0) {
+            // The one quotient that doesn't fit (and would trap on the host) wraps around
+            if(get_register(inst.src1) == INT32_MIN && get_register(inst.src2) == -1) {
+                LO = INT32_MIN;
+                HI = 0;
+            } else if(get_register(inst.src2) != 0) {
                 LO = get_register(inst.src1) / get_register(inst.src2);
                 HI = get_register(inst.src1) % get_register(inst.src2);
             }
@@ -217,10 +777,44 @@ void CPU::execute_r_type(R_Instruction inst) {
             advance_pc(4);
             break;
         }
+        case OpFunction::SYNC:
+            memory.sync();
+            advance_pc(4);
+            break;
+        case OpFunction::SYSCALL:
+            execute_syscall();
+            break;
         default: break;
     }
 }
 
+void CPU::execute_syscall() {
+    Word service = get_register(RegisterId{2});
+    SyscallHandler handler = service < syscall_count ? syscall_table[service] : nullptr;
+    if (!handler) {
+        fault.raise(FaultReason::UNSUPPORTED_SYSCALL, service);
+        return;
+    }
+
+    SyscallContext context { memory,
+        static_cast<Word>(get_register(RegisterId{4})),
+        static_cast<Word>(get_register(RegisterId{5})),
+        static_cast<Word>(get_register(RegisterId{6})),
+        false };
+    Word result = handler(context);
+    if (fault.raised()) return;
+
+    set_register(RegisterId{2}, result);
+    if (context.exit) {
+        // The same as jumping to 0x0
+        PC = 0;
+        nPC = 4;
+        predicted = BranchTarget();
+    } else {
+        advance_pc(4);
+    }
+}
+
 void CPU::execute_j_type(J_Instruction inst) {
     switch (inst.opcode) {
         case JOpCode::J:
@@ -229,6 +823,7 @@ void CPU::execute_j_type(J_Instruction inst) {
             break;
         case JOpCode::JAL:
             set_register(rRA, PC + 8);
+            push_return(PC + 8);
             PC = nPC;
             nPC = (PC & 0xF0000000) | (inst.address << 2);
             break;
@@ -247,6 +842,7 @@ void CPU::execute_REGIMM_type(REGIMM_Instruction inst) {
         case REGIMMCode::BGEZAL:
             set_register(rRA, PC + 8);
             if(get_register(inst.src) >= 0) {
+                push_return(PC + 8);
                 advance_pc(inst.offset << 2);
             } else {
                 advance_pc(4);
@@ -262,6 +858,7 @@ void CPU::execute_REGIMM_type(REGIMM_Instruction inst) {
         case REGIMMCode::BLTZAL:
             set_register(rRA, PC + 8);
             if(get_register(inst.src) < 0) {
+                push_return(PC + 8);
                 advance_pc(inst.offset << 2);
             } else {
                 advance_pc(4);
@@ -289,7 +886,7 @@ void CPU::execute_i_type(I_Instruction inst) {
             advance_pc(4);
             break;
         case IOpCode::LUI:
-            set_register(inst.dest, (get_register(inst.dest) | (inst.immediate << 16)));
+            set_register(inst.dest, static_cast<uint16_t>(inst.immediate) << 16);
             advance_pc(4);
             break;
         case IOpCode::LW:
@@ -400,20 +997,29 @@ void CPU::execute_i_type(I_Instruction inst) {
             set_register(inst.dest, get_register(inst.src) ^ static_cast<uint16_t>(inst.immediate));
             advance_pc(4);
             break;
-        case IOpCode::ADDI:
-            if(((get_register(inst.src) + inst.immediate) >= 0) && ((get_register(inst.src) < 0) && (inst.immediate < 0))) {
-                throw ArithmeticError("Overflow");
-            }
-            if(((get_register(inst.src) > 0) && (inst.immediate > 0)) && (((get_register(inst.src) + inst.immediate) <= 0))) {
-                throw ArithmeticError("Overflow");
+        case IOpCode::ADDI: {
+            // As for ADD
+            uint32_t a = get_register(inst.src), b = static_cast<int32_t>(inst.immediate), sum = a + b;
+            if ((a ^ sum) & (b ^ sum) & 0x80000000) {
+                fault.raise(FaultReason::ARITHMETIC_OVERFLOW);
+                break;
             }
-            set_register(inst.dest, get_register(inst.src) + inst.immediate);
+            set_register(inst.dest, sum);
             advance_pc(4);
             break;
+        }
         case IOpCode::ADDIU:
             set_register(inst.dest, (unsigned int) get_register(inst.src) + inst.immediate);
             advance_pc(4);
             break;
+        case IOpCode::LL:
+            set_register(inst.dest, memory.load_linked(get_register(inst.src) + inst.immediate));
+            advance_pc(4);
+            break;
+        case IOpCode::SC:
+            set_register(inst.dest, memory.store_conditional(get_register(inst.src) + inst.immediate, get_register(inst.dest)));
+            advance_pc(4);
+            break;
     }
 }
 
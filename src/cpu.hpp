@@ -2,14 +2,78 @@
 
 #include <vector>
 #include <array>
+#include <ostream>
+#include <string>
+#include <memory>
 
 #include "typedefs.hpp"
 #include "decoder.hpp"
 #include "memory.hpp"
+#include "predecoder.hpp"
+#include "program_image.hpp"
+#include "intercepts.hpp"
+#include "copy_loops.hpp"
+#include "cache_model.hpp"
+
+/**
+ * Execution counters, printed with --stats
+ */
+struct ExecutionStats {
+    // Guest instructions executed, including no-ops
+    uint64_t instructions = 0;
+    // Trips around the run loop. A fused pair is a single dispatch
+    uint64_t dispatches = 0;
+    // Fusable pairs that were executed fused, by kind
+    std::array<uint64_t, fusion_kinds> fused {};
+    // Fusable pairs that had to be executed one at a time, because the first
+    // instruction was in a delay slot
+    std::array<uint64_t, fusion_kinds> unfused {};
+
+    // JR/JALR targets found in the per-site target cache
+    uint64_t indirect_hits = 0;
+    uint64_t indirect_misses = 0;
+    // JR $ra targets predicted by the return address stack
+    uint64_t return_hits = 0;
+    uint64_t return_misses = 0;
+
+    // Copy loops run in one go, their iterations, and times a copy loop's head had to run as
+    // usual instead
+    uint64_t bulk_loops = 0;
+    uint64_t bulk_iterations = 0;
+    uint64_t bulk_declined = 0;
+};
+
+/**
+ * A resolved jump target: its address and its index in the predecoded program
+ */
+struct BranchTarget {
+    Address target = 0;
+    Address index = 0;
+};
+
+const size_t return_stack_size = 16;
+
+/**
+ * Why CPU::step returned
+ */
+enum class RunStatus : uint8_t {
+    // The program exited or faulted
+    EXITED,
+    // The next instruction reads getc, and its input buffer is empty
+    WAITING_FOR_INPUT,
+    // The next instruction receives from an empty mailbox channel or sends to a full one
+    WAITING_FOR_MAILBOX,
+    // The instructions given to step() have been executed
+    PREEMPTED,
+};
 
 class CPU {
     private:
+        // Declared before memory, which raises its faults here
+        Fault fault;
         Memory memory;
+        // The predecoded instructions of the image memory holds
+        const std::vector<PredecodedInstruction>* program;
         // 31 because register 0 is always 0
         std::array<int, 31> registers;
 
@@ -18,17 +82,120 @@ class CPU {
         int LO = 0;
         int HI = 0;
 
+        bool fusion = true;
+        uint64_t max_instructions = UINT64_MAX;
+        ExecutionStats stats;
+
+        // Index of the instruction being executed in `program`
+        Address current_index = 0;
+
+        // Last target of each JR/JALR, indexed like `program`
+        std::vector<BranchTarget> target_cache;
+        // Circular stack of return addresses pushed by calls
+        std::array<BranchTarget, return_stack_size> return_stack;
+        size_t return_stack_depth = 0;
+        // A jump target that has already been checked, so fetching it needs no lookup
+        BranchTarget predicted;
+
+        // With intercepts or copy loops, `program` points to this copy of the image's program,
+        // where their first instructions are marked invalid: the run loop only has to look for
+        // them when an instruction isn't valid. `routines` is indexed like `program`
+        std::shared_ptr<const std::vector<PredecodedInstruction>> hooked_program;
+        std::vector<Routine> routines;
+        bool verify_intercepts = false;
+        InterceptStats intercept_stats;
+        // While the guest code of a verified call runs, the address it returns to: until then,
+        // reaching the routine's entry again (say, a loop branching back to it) isn't a new call
+        Address verifying_return = 0;
+        // Sorted by head
+        std::vector<CopyLoop> copy_loops;
+        bool loop_acceleration = false;
+        // Told about every instruction fetched, if set. Memory reports the loads and stores.
+        // Forks don't simulate caches
+        std::unique_ptr<CacheHierarchy> caches;
+
         int get_register(RegisterId reg) const;
         void set_register(RegisterId reg, int value);
         void advance_pc(Address offset);
+        RunStatus run_until(uint64_t limit, bool trace);
+        bool reads_input(const PredecodedInstruction& slot) const;
+        bool blocks_on_mailbox(const PredecodedInstruction& slot) const;
+        void execute_syscall();
+        void rebuild_hooks();
+        bool run_hook(Address index, uint64_t limit);
+        bool run_intercept(Address index);
+        void verify_intercept(Routine routine);
+        void clear_intercepts();
+        bool run_copy_loop(const CopyLoop& loop, uint64_t limit);
+        void execute_fused(const PredecodedInstruction& first, const PredecodedInstruction& second);
+
+        bool resolve_target(Address target, BranchTarget& resolved) const;
+        void push_return(Address return_address);
+        void jump_register(Address target, bool is_return);
+
+        CPU(const CPU& other);
+        CPU& operator=(const CPU&) = delete;
 
         friend void run_code(std::vector<Instruction>);
+        friend void save_snapshot(const CPU&, const std::string&);
+        friend void restore_snapshot(CPU&, const std::string&);
+        friend class LockstepGroup;
+        friend class FuzzHarness;
 
     public:
-        CPU(std::unique_ptr<std::vector<Word>> instructions); 
+        CPU(std::shared_ptr<const ProgramImage> image);
+        CPU(std::unique_ptr<std::vector<Word>> instructions);
+
+        // A copy of this CPU in its current state. Data memory is shared copy-on-write, so
+        // this only costs as much as the pages either CPU writes afterwards.
+        std::unique_ptr<CPU> fork() const;
+
+        // Put the CPU back in the state it was constructed in, ready for another run of the
+        // same program. Only the data pages written since the last reset are restored, and
+        // the program and jump target cache are kept. See Memory::reset for the input.
+        void reset();
 
-        uint8_t run();
-        uint8_t run(bool trace = false);
+        int run();
+        int run(bool trace = false);
+        // Run at most `instructions` more instructions. Returns early, before executing it,
+        // when an instruction would wait for input (see set_input_buffer) or for a mailbox,
+        // so the program can be resumed with another step() once it can go ahead.
+        RunStatus step(uint64_t instructions);
+        // The exit code, once the program has exited: the low byte of $v0, or the fault's error code
+        int get_exit_code() const;
+        const ProgramImage& get_image() const { return memory.get_image(); }
+        const Fault& get_fault() const { return fault; }
+        Address get_pc() const { return PC; }
+        // Allows a run stopped by the instruction budget to be resumed
+        void clear_fault() { fault.clear(); }
+        // Stop the program from outside, e.g. when it can never go ahead
+        void raise_fault(FaultReason reason, Word value) { fault.raise(reason, value); }
+        void set_io(std::istream* input, std::ostream* output) { memory.set_io(input, output); }
+        void set_input_buffer(InputBuffer* buffer) { memory.set_input_buffer(buffer); }
+        void set_mailboxes(Mailboxes* mailboxes) { memory.set_mailboxes(mailboxes); }
+        // Run as hart `id` of `count`, with `shared` as data memory
+        void set_hart(SharedMemory* shared, Word id, Word count) { memory.set_shared(shared, id, count); }
+        // Map a host file into the address space (see Memory::add_mapping)
+        bool map_file(std::shared_ptr<const MappedFile> mapping) { return memory.add_mapping(std::move(mapping)); }
+        // Run the intercepted routines natively when they are called. Returns false if an entry
+        // point is not a valid instruction. With `verify`, each call also runs natively on a copy
+        // of memory and as guest code on a fork, and the two are compared (see
+        // get_intercept_stats); the run then carries on with the guest code, as if there
+        // were no intercepts
+        bool set_intercepts(const std::vector<Intercept>& intercepts, bool verify);
+        const InterceptStats& get_intercept_stats() const { return intercept_stats; }
+        // Run loops that only copy or fill memory (see CopyLoop) in one go
+        void set_loop_acceleration(bool enabled);
+        // Simulate instruction and data caches for the rest of the run (see CacheHierarchy).
+        // Loads and stores made natively by intercepts, copy loops, DMA or syscalls aren't seen
+        void set_caches(const CacheHierarchyConfig& config);
+        void print_cache_stats(std::ostream& out) const;
+        // Let the OPEN syscall open host files
+        void allow_host_files(bool allowed) { memory.get_files().allow(allowed); }
+        void set_fusion(bool enabled) { fusion = enabled; }
+        void set_max_instructions(uint64_t max) { max_instructions = max; }
+        const ExecutionStats& get_stats() const { return stats; }
+        void print_stats(std::ostream& out) const;
         void execute_instruction(Instruction instruction);
         void execute_r_type(R_Instruction inst);
         void execute_j_type(J_Instruction);
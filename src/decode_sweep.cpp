@@ -0,0 +1,118 @@
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "decode_sweep.hpp"
+#include "decoder.hpp"
+#include "exceptions.hpp"
+#include "opcodes.hpp"
+#include "show.hpp"
+
+using namespace std;
+
+namespace {
+
+// Words are handed out to threads in chunks of this size
+const uint64_t chunk_size = 1 << 20;
+
+// Only the first few disagreements are printed
+const size_t max_reported_mismatches = 32;
+
+// What decode() says about an invalid word
+string invalid_message(Word word) {
+    try {
+        decode(word);
+        return "";
+    } catch (InvalidInstructionError& err) {
+        return err.error_message;
+    }
+}
+
+struct ThreadResult {
+    uint64_t valid = 0;
+    uint64_t invalid = 0;
+    uint64_t mismatches = 0;
+    double seconds = 0;
+};
+
+}
+
+int decode_sweep(unsigned int threads, uint64_t first, uint64_t last) {
+    if (threads == 0) threads = 1;
+
+    atomic<uint64_t> next_chunk(first);
+    vector<ThreadResult> results(threads);
+    vector<string> mismatches;
+    mutex mismatches_mutex;
+
+    auto worker = [&] (unsigned int id) {
+        ThreadResult& result = results[id];
+        auto start = chrono::steady_clock::now();
+
+        while (true) {
+            uint64_t chunk_start = next_chunk.fetch_add(chunk_size);
+            if (chunk_start > last) break;
+            uint64_t chunk_end = min(chunk_start + chunk_size - 1, last);
+
+            for (uint64_t w = chunk_start; w <= chunk_end; w++) {
+                Word word = static_cast<Word>(w);
+                Instruction legacy, table;
+
+                // Neither decoder throws or builds a message, which would dominate the
+                // time spent on invalid words
+                bool legacy_valid = switch_decode(word, legacy);
+                bool table_valid = try_decode(word, table);
+
+                if (legacy_valid) result.valid++;
+                else              result.invalid++;
+
+                bool agree = legacy_valid == table_valid && (!legacy_valid || legacy == table);
+                if (agree) continue;
+
+                result.mismatches++;
+                lock_guard<mutex> lock(mismatches_mutex);
+                if (mismatches.size() < max_reported_mismatches) {
+                    mismatches.push_back(show(as_hex(word)) + ": legacy "
+                        + (legacy_valid ? show(legacy) : "invalid: " + invalid_message(word))
+                        + ", table " + (table_valid ? show(table) : "invalid"));
+                }
+            }
+        }
+
+        result.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    };
+
+    auto start = chrono::steady_clock::now();
+    vector<thread> pool;
+    for (unsigned int i = 0; i < threads; i++) pool.emplace_back(worker, i);
+    for (auto& t : pool) t.join();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    ThreadResult total;
+    for (unsigned int i = 0; i < threads; i++) {
+        const ThreadResult& r = results[i];
+        total.valid += r.valid;
+        total.invalid += r.invalid;
+        total.mismatches += r.mismatches;
+
+        uint64_t words = r.valid + r.invalid;
+        cout << "thread " << i << ": " << words << " words in " << r.seconds << "s ("
+             << (r.seconds > 0 ? words / r.seconds / 1e6 : 0) << " Mwords/s)" << endl;
+    }
+
+    for (const string& m : mismatches) cout << "mismatch " << m << endl;
+
+    uint64_t words = total.valid + total.invalid;
+    cout << "words:      " << words << endl;
+    cout << "valid:      " << total.valid << endl;
+    cout << "invalid:    " << total.invalid << endl;
+    cout << "mismatches: " << total.mismatches << endl;
+    cout << "throughput: " << (seconds > 0 ? words / seconds / 1e6 : 0) << " Mwords/s on "
+         << threads << " threads (" << seconds << "s)" << endl;
+
+    return total.mismatches == 0 ? 0 : 1;
+}
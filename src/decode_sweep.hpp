@@ -0,0 +1,11 @@
+#pragma once
+
+#include <cstdint>
+
+/**
+ * Run both decoders over every word in [first, last] on `threads` threads.
+ *
+ * Prints a summary (valid/invalid counts, disagreements and per-thread throughput) to stdout
+ * and returns 0 if the decoders agree on every word, 1 otherwise.
+ */
+int decode_sweep(unsigned int threads, uint64_t first = 0, uint64_t last = 0xFFFFFFFF);
@@ -13,9 +13,10 @@ using namespace std;
 
 unsigned short int get_opcode(unsigned int word) { return word >> 26; }
 
-R_Instruction decode_R_type(unsigned int word) {
-    unsigned short int opcode_bin = get_opcode(word);
-    if (opcode_bin != 0) { exit(1); }
+// The switch decoders below return false if the word's fields don't match any instruction
+
+bool decode_R_type(unsigned int word, R_Instruction& out) {
+    if (get_opcode(word) != 0) return false;
 
     RegisterId src1 = RegisterId { static_cast<uint8_t>((word & 0x03E00000) >> 21) };
     RegisterId src2 = RegisterId { static_cast<uint8_t>((word & 0x001F0000) >> 16) };
@@ -51,16 +52,18 @@ R_Instruction decode_R_type(unsigned int word) {
         case 0b100110: func = OpFunction::XOR; break;
         case 0b100101: func = OpFunction::OR; break;
         case 0b100100: func = OpFunction::AND; break;
+        case 0b001111: func = OpFunction::SYNC; break;
+        case 0b001100: func = OpFunction::SYSCALL; break;
 
-        default: 
-            throw InvalidInstructionError("Could not match function code " + show(as_bin(opcode_bin)));
-            break;
+        default:
+            return false;
     }
 
-    return R_Instruction { func, dest, src1, src2, shft };
+    out = R_Instruction { func, dest, src1, src2, shft };
+    return true;
 }
 
-I_Instruction decode_I_type(unsigned int word) {
+bool decode_I_type(unsigned int word, I_Instruction& out) {
     unsigned short int opcode_bin = get_opcode(word);
     RegisterId src                = RegisterId { static_cast<uint8_t>((word & 0x03E00000) >> 21) };
     RegisterId dest               = RegisterId { static_cast<uint8_t>((word & 0x001F0000) >> 16) };
@@ -91,16 +94,18 @@ I_Instruction decode_I_type(unsigned int word) {
         case 0b001110: opcode = IOpCode::XORI; break;    //   Bitwise exclusive or immediate [..] 0b001110 or 14
         case 0b001000: opcode = IOpCode::ADDI; break;    //   Add immediate (with overflow) [..] 0b001000 or 8
         case 0b001001: opcode = IOpCode::ADDIU; break;   //   Add immediate unsigned (no overflow) [..] 0b001001 or 9
+        case 0b110000: opcode = IOpCode::LL; break;      //   Load linked [..] 0b110000 or 48
+        case 0b111000: opcode = IOpCode::SC; break;      //   Store conditional [..] 0b111000 or 56
 
-        default: 
-            throw InvalidInstructionError("Could not match i type opcode " + show(as_bin(opcode_bin)));
-            break;
+        default:
+            return false;
     }
-    
-    return I_Instruction { opcode, dest, src, immediate };
+
+    out = I_Instruction { opcode, dest, src, immediate };
+    return true;
 }
 
-J_Instruction decode_J_type(unsigned int word) {
+bool decode_J_type(unsigned int word, J_Instruction& out) {
     JOpCode opcode;
     Address address = word & 0x3FFFFFF;
     uint8_t opcode_bin = get_opcode(word);
@@ -108,15 +113,15 @@ J_Instruction decode_J_type(unsigned int word) {
     switch (opcode_bin) {
         case 2: opcode = JOpCode::J; break;
         case 3: opcode = JOpCode::JAL; break;   
-        default: 
-            throw InvalidInstructionError("Could not match j type opcode " + show(as_bin(opcode_bin)));
-            break;
+        default:
+            return false;
     }
-    
-    return J_Instruction { opcode, address };
+
+    out = J_Instruction { opcode, address };
+    return true;
 }
 
-REGIMM_Instruction decode_REGIMM(Word word) {
+bool decode_REGIMM(Word word, REGIMM_Instruction& out) {
     uint8_t regimm_code_bin = static_cast<uint8_t>((word & 0x001F0000) >> 16);
     RegisterId src          = RegisterId { static_cast<uint8_t>((word & 0x03E00000) >> 21) };
     Offset offset           =  word & 0xFFFF;
@@ -127,31 +132,203 @@ REGIMM_Instruction decode_REGIMM(Word word) {
         case 0b10001: code = REGIMMCode::BGEZAL; break;
         case 0b00000: code = REGIMMCode::BLTZ; break;
         case 0b10000: code = REGIMMCode::BLTZAL; break;
-        default: 
-            throw InvalidInstructionError("Could not match REGIMM code " + show(as_bin(regimm_code_bin)));
-            break;
+        default:
+            return false;
     }
-    return REGIMM_Instruction { code, src, offset };
+    out = REGIMM_Instruction { code, src, offset };
+    return true;
 }
 
 /**
- * Decode an instruction.
- * 
+ * Decode an instruction with the switches above, without throwing.
+ *
  * Special case: decodes BREAK to a REGDUMP if compiled with BREAK_IS_REGDUMP
  */
-Instruction decode(unsigned int word) {
-    unsigned short int opcode = get_opcode(word); 
+bool switch_decode(Word word, Instruction& out) {
+    unsigned short int opcode = get_opcode(word);
 
     #ifdef BREAK_IS_REGDUMP
     if (opcode == 0 && (word & 0x3F) == 13) {
-        return Special_Instruction{ SpecialOpcode::REGDUMP };
+        out = Special_Instruction{ SpecialOpcode::REGDUMP };
+        return true;
     }
     #endif
 
     switch (opcode) {
-        case 0:         return decode_R_type(word);
-        case 1:         return decode_REGIMM(word);
-        case 2: case 3: return decode_J_type(word);
-        default:        return decode_I_type(word);
+        case 0: {
+            R_Instruction inst;
+            if (!decode_R_type(word, inst)) return false;
+            out = inst;
+            return true;
+        }
+        case 1: {
+            REGIMM_Instruction inst;
+            if (!decode_REGIMM(word, inst)) return false;
+            out = inst;
+            return true;
+        }
+        case 2: case 3: {
+            J_Instruction inst;
+            if (!decode_J_type(word, inst)) return false;
+            out = inst;
+            return true;
+        }
+        default: {
+            I_Instruction inst;
+            if (!decode_I_type(word, inst)) return false;
+            out = inst;
+            return true;
+        }
+    }
+}
+
+/**
+ * Decode an instruction.
+ *
+ * Throws InvalidInstructionError, saying which field didn't match, if it isn't one.
+ */
+Instruction decode(unsigned int word) {
+    Instruction inst;
+    if (switch_decode(word, inst)) return inst;
+
+    unsigned short int opcode = get_opcode(word);
+    switch (opcode) {
+        case 0:  throw InvalidInstructionError("Could not match function code " + show(as_bin(word & 0x3F)));
+        case 1:  throw InvalidInstructionError("Could not match REGIMM code " + show(as_bin((word & 0x001F0000) >> 16)));
+        default: throw InvalidInstructionError("Could not match i type opcode " + show(as_bin(opcode)));
+    }
+}
+
+// --------------- Table-driven decoder ---------------
+
+namespace {
+
+template<typename T>
+struct DecodeEntry {
+    bool valid;
+    T value;
+};
+
+/**
+ * Lookup tables from the opcode/function/REGIMM code fields to their enum values.
+ *
+ * Built once from the same encodings as the switches above, so that try_decode
+ * can decode with a couple of indexed loads and no exceptions.
+ */
+struct DecodeTables {
+    DecodeEntry<OpFunction> functions[64];
+    DecodeEntry<IOpCode>    i_opcodes[64];
+    DecodeEntry<REGIMMCode> regimm_codes[32];
+
+    DecodeTables() : functions(), i_opcodes(), regimm_codes() {
+        functions[0b001001] = { true, OpFunction::JALR };
+        functions[0b001000] = { true, OpFunction::JR };
+        functions[0b000000] = { true, OpFunction::SLL };
+        functions[0b000100] = { true, OpFunction::SLLV };
+        functions[0b000011] = { true, OpFunction::SRA };
+        functions[0b000111] = { true, OpFunction::SRAV };
+        functions[0b000010] = { true, OpFunction::SRL };
+        functions[0b000110] = { true, OpFunction::SRLV };
+        functions[0b101010] = { true, OpFunction::SLT };
+        functions[0b101011] = { true, OpFunction::SLTU };
+        functions[0b100000] = { true, OpFunction::ADD };
+        functions[0b100001] = { true, OpFunction::ADDU };
+        functions[0b100010] = { true, OpFunction::SUB };
+        functions[0b100011] = { true, OpFunction::SUBU };
+        functions[0b011010] = { true, OpFunction::DIV };
+        functions[0b011011] = { true, OpFunction::DIVU };
+        functions[0b010000] = { true, OpFunction::MFHI };
+        functions[0b010010] = { true, OpFunction::MFLO };
+        functions[0b010001] = { true, OpFunction::MTHI };
+        functions[0b010011] = { true, OpFunction::MTLO };
+        functions[0b011000] = { true, OpFunction::MULT };
+        functions[0b011001] = { true, OpFunction::MULTU };
+        functions[0b100110] = { true, OpFunction::XOR };
+        functions[0b100101] = { true, OpFunction::OR };
+        functions[0b100100] = { true, OpFunction::AND };
+        functions[0b001111] = { true, OpFunction::SYNC };
+        functions[0b001100] = { true, OpFunction::SYSCALL };
+
+        i_opcodes[0b100000] = { true, IOpCode::LB };
+        i_opcodes[0b100100] = { true, IOpCode::LBU };
+        i_opcodes[0b100001] = { true, IOpCode::LH };
+        i_opcodes[0b100101] = { true, IOpCode::LHU };
+        i_opcodes[0b001111] = { true, IOpCode::LUI };
+        i_opcodes[0b100011] = { true, IOpCode::LW };
+        i_opcodes[0b100010] = { true, IOpCode::LWL };
+        i_opcodes[0b100110] = { true, IOpCode::LWR };
+        i_opcodes[0b101000] = { true, IOpCode::SB };
+        i_opcodes[0b101001] = { true, IOpCode::SH };
+        i_opcodes[0b101011] = { true, IOpCode::SW };
+        i_opcodes[0b000100] = { true, IOpCode::BEQ };
+        i_opcodes[0b000111] = { true, IOpCode::BGTZ };
+        i_opcodes[0b000110] = { true, IOpCode::BLEZ };
+        i_opcodes[0b000101] = { true, IOpCode::BNE };
+        i_opcodes[0b001101] = { true, IOpCode::ORI };
+        i_opcodes[0b001100] = { true, IOpCode::ANDI };
+        i_opcodes[0b001010] = { true, IOpCode::SLTI };
+        i_opcodes[0b001011] = { true, IOpCode::SLTIU };
+        i_opcodes[0b001110] = { true, IOpCode::XORI };
+        i_opcodes[0b001000] = { true, IOpCode::ADDI };
+        i_opcodes[0b001001] = { true, IOpCode::ADDIU };
+        i_opcodes[0b110000] = { true, IOpCode::LL };
+        i_opcodes[0b111000] = { true, IOpCode::SC };
+
+        regimm_codes[0b00001] = { true, REGIMMCode::BGEZ };
+        regimm_codes[0b10001] = { true, REGIMMCode::BGEZAL };
+        regimm_codes[0b00000] = { true, REGIMMCode::BLTZ };
+        regimm_codes[0b10000] = { true, REGIMMCode::BLTZAL };
+    }
+};
+
+const DecodeTables tables;
+
+}
+
+/**
+ * Decode an instruction without throwing.
+ *
+ * Returns false if the word is not a valid instruction, in which case `out` is left untouched.
+ * Must agree with switch_decode() on every word (see decode_sweep).
+ */
+bool try_decode(Word word, Instruction& out) {
+    uint8_t opcode  = word >> 26;
+    RegisterId rs   = RegisterId { static_cast<uint8_t>((word >> 21) & 0x1F) };
+    RegisterId rt   = RegisterId { static_cast<uint8_t>((word >> 16) & 0x1F) };
+    Offset immediate = static_cast<Offset>(word & 0xFFFF);
+
+    switch (opcode) {
+        case 0: {
+            #ifdef BREAK_IS_REGDUMP
+            if ((word & 0x3F) == 13) {
+                out = Special_Instruction{ SpecialOpcode::REGDUMP };
+                return true;
+            }
+            #endif
+            const DecodeEntry<OpFunction>& entry = tables.functions[word & 0x3F];
+            if (!entry.valid) return false;
+            RegisterId rd = RegisterId { static_cast<uint8_t>((word >> 11) & 0x1F) };
+            unsigned short int shift = (word >> 6) & 0x1F;
+            out = R_Instruction { entry.value, rd, rs, rt, shift };
+            return true;
+        }
+        case 1: {
+            const DecodeEntry<REGIMMCode>& entry = tables.regimm_codes[rt.value];
+            if (!entry.valid) return false;
+            out = REGIMM_Instruction { entry.value, rs, immediate };
+            return true;
+        }
+        case 2:
+            out = J_Instruction { JOpCode::J, word & 0x3FFFFFF };
+            return true;
+        case 3:
+            out = J_Instruction { JOpCode::JAL, word & 0x3FFFFFF };
+            return true;
+        default: {
+            const DecodeEntry<IOpCode>& entry = tables.i_opcodes[opcode];
+            if (!entry.valid) return false;
+            out = I_Instruction { entry.value, rt, rs, immediate };
+            return true;
+        }
     }
-}
\ No newline at end of file
+}
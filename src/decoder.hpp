@@ -2,5 +2,11 @@
 
 #include <vector>
 #include "opcodes.hpp"
+#include "typedefs.hpp"
 
+// Throws InvalidInstructionError if the word isn't an instruction
 Instruction decode(unsigned int word);
+// The decoder decode() uses, returning false instead of throwing
+bool switch_decode(Word word, Instruction& out);
+// The table-driven decoder the predecoder uses. Returns false if the word isn't an instruction
+bool try_decode(Word word, Instruction& out);
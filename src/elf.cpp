@@ -0,0 +1,119 @@
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "elf.hpp"
+
+using namespace std;
+
+namespace {
+
+const uint32_t section_symbol_table = 2;  // SHT_SYMTAB
+const uint32_t segment_load = 1;          // PT_LOAD
+
+const size_t header_size = 52;
+const size_t section_header_size = 40;
+const size_t program_header_size = 32;
+const size_t symbol_size = 16;
+
+}
+
+ElfFile::ElfFile(const string& i_path) : path(i_path) {
+    ifstream file(path, ios::binary);
+    if (!file.is_open()) throw ElfError("Can't open " + path);
+    contents.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+    check_header();
+}
+
+ElfFile::ElfFile(const string& name, string i_contents) : path(name), contents(move(i_contents)) {
+    check_header();
+}
+
+void ElfFile::check_header() {
+    if (contents.size() < header_size || contents.compare(0, 4, "\x7f" "ELF") != 0) {
+        throw ElfError(path + " is not an ELF file");
+    }
+    if (contents[4] != 1) throw ElfError(path + " is not a 32-bit ELF file");
+    if (contents[5] != 1 && contents[5] != 2) throw ElfError(path + " has an unknown byte order");
+    big_endian = contents[5] == 2;
+}
+
+uint32_t ElfFile::read32(size_t offset) const {
+    if (offset + 4 > contents.size()) throw ElfError(path + " is truncated");
+    uint32_t value = 0;
+    for (size_t i = 0; i < 4; i++) {
+        unsigned char byte = contents[offset + (big_endian ? i : 3 - i)];
+        value = (value << 8) | byte;
+    }
+    return value;
+}
+
+uint16_t ElfFile::read16(size_t offset) const {
+    if (offset + 2 > contents.size()) throw ElfError(path + " is truncated");
+    unsigned char first = contents[offset + (big_endian ? 0 : 1)];
+    unsigned char second = contents[offset + (big_endian ? 1 : 0)];
+    return (first << 8) | second;
+}
+
+vector<ElfSymbol> ElfFile::symbols() const {
+    vector<ElfSymbol> result;
+
+    uint32_t section_headers = read32(0x20);
+    uint16_t section_count = read16(0x30);
+    for (uint16_t section = 0; section < section_count; section++) {
+        size_t header = section_headers + static_cast<size_t>(section) * section_header_size;
+        if (read32(header + 4) != section_symbol_table) continue;
+
+        uint32_t offset = read32(header + 16);
+        uint32_t size = read32(header + 20);
+        uint32_t link = read32(header + 24);
+        if (link >= section_count) throw ElfError(path + " is corrupt");
+        uint32_t strings = read32(section_headers + link * section_header_size + 16);
+        uint32_t strings_size = read32(section_headers + link * section_header_size + 20);
+
+        for (uint32_t symbol = offset; symbol + symbol_size <= offset + size; symbol += symbol_size) {
+            uint32_t name = read32(symbol);
+            if (name >= strings_size || strings + name >= contents.size()) throw ElfError(path + " is corrupt");
+
+            ElfSymbol entry;
+            entry.name = contents.c_str() + strings + name;
+            entry.value = read32(symbol + 4);
+            entry.size = read32(symbol + 8);
+            if (symbol + 12 >= contents.size()) throw ElfError(path + " is truncated");
+            entry.type = contents[symbol + 12] & 0xF;
+            result.push_back(entry);
+        }
+    }
+    return result;
+}
+
+vector<ElfSegment> ElfFile::segments() const {
+    vector<ElfSegment> result;
+
+    uint32_t program_headers = read32(0x1C);
+    uint16_t entry_size = read16(0x2A);
+    uint16_t count = read16(0x2C);
+    if (count > 0 && entry_size < program_header_size) throw ElfError(path + " is corrupt");
+
+    for (uint16_t index = 0; index < count; index++) {
+        size_t header = program_headers + static_cast<size_t>(index) * entry_size;
+        if (read32(header) != segment_load) continue;
+
+        ElfSegment segment;
+        segment.offset = read32(header + 4);
+        segment.address = read32(header + 8);
+        segment.file_size = read32(header + 16);
+        segment.memory_size = read32(header + 20);
+        if (static_cast<uint64_t>(segment.offset) + segment.file_size > contents.size()) {
+            throw ElfError(path + " is truncated");
+        }
+        if (segment.file_size > segment.memory_size) throw ElfError(path + " is corrupt");
+        result.push_back(segment);
+    }
+    return result;
+}
+
+string ElfFile::contents_of(const ElfSegment& segment) const {
+    return contents.substr(segment.offset, segment.file_size);
+}
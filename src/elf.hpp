@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "typedefs.hpp"
+
+/**
+ * A file is not an ELF file this simulator understands
+ */
+class ElfError : public std::runtime_error {
+    public:
+        using std::runtime_error::runtime_error;
+};
+
+struct ElfSymbol {
+    std::string name;
+    Address value;
+    uint32_t size;
+    // STT_FUNC, STT_OBJECT, ...
+    uint8_t type;
+};
+
+const uint8_t elf_function_symbol = 2;  // STT_FUNC
+const uint16_t elf_machine_mips = 8;    // EM_MIPS
+
+/**
+ * A loadable segment (PT_LOAD): `file_size` bytes from `offset` in the file go to `address`,
+ * followed by zeros up to `memory_size` (e.g. .bss)
+ */
+struct ElfSegment {
+    Address address;
+    uint32_t offset;
+    uint32_t file_size;
+    uint32_t memory_size;
+};
+
+/**
+ * A 32-bit ELF file, such as the .mips.elf files the Makefile links, read into memory.
+ *
+ * Only what the simulator needs is parsed. Fields are converted from the file's byte order,
+ * which for MIPS binaries is big-endian.
+ */
+class ElfFile {
+    private:
+        std::string path;
+        std::string contents;
+        bool big_endian;
+
+        uint32_t read32(size_t offset) const;
+        uint16_t read16(size_t offset) const;
+        void check_header();
+
+    public:
+        // Throws ElfError if the file can't be read or is not a 32-bit ELF file
+        explicit ElfFile(const std::string& path);
+        // An ELF file that has already been read, called `name` in errors
+        ElfFile(const std::string& name, std::string contents);
+
+        const std::string& get_path() const { return path; }
+        bool is_big_endian() const { return big_endian; }
+        uint16_t machine() const { return read16(0x12); }
+        Address entry() const { return read32(0x18); }
+
+        // The symbols of every symbol table in the file
+        std::vector<ElfSymbol> symbols() const;
+        // The loadable segments. Throws ElfError if one isn't all in the file or is smaller in
+        // memory than in the file
+        std::vector<ElfSegment> segments() const;
+        // The bytes of a segment that are in the file
+        std::string contents_of(const ElfSegment& segment) const;
+};
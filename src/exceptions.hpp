@@ -28,4 +28,16 @@ class InvalidInstructionError : public MIPSError {
     public:
         using MIPSError::MIPSError;
         inline int get_error_code() override { return -12; };
+};
+
+class InstructionBudgetError : public MIPSError {
+    public:
+        using MIPSError::MIPSError;
+        inline int get_error_code() override { return -13; };
+};
+
+class InfiniteLoopError : public MIPSError {
+    public:
+        using MIPSError::MIPSError;
+        inline int get_error_code() override { return -14; };
 };
\ No newline at end of file
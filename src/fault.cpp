@@ -0,0 +1,57 @@
+#include <string>
+
+#include "fault.hpp"
+#include "decoder.hpp"
+#include "exceptions.hpp"
+#include "show.hpp"
+
+using namespace std;
+
+int Fault::get_error_code() const {
+    switch (reason) {
+        case FaultReason::NONE:
+            return 0;
+        case FaultReason::ARITHMETIC_OVERFLOW:
+            return ArithmeticError("").get_error_code();
+        case FaultReason::INVALID_INSTRUCTION:
+        case FaultReason::UNSUPPORTED_SYSCALL:
+            return InvalidInstructionError("").get_error_code();
+        case FaultReason::INSTRUCTION_BUDGET:
+            return InstructionBudgetError("").get_error_code();
+        case FaultReason::INFINITE_LOOP:
+        case FaultReason::DEADLOCK:
+            return InfiniteLoopError("").get_error_code();
+        default:
+            return MemoryError("").get_error_code();
+    }
+}
+
+template<>
+string show(const Fault& fault) {
+    switch (fault.reason) {
+        case FaultReason::NONE:                     return "No fault";
+        case FaultReason::ARITHMETIC_OVERFLOW:      return "Overflow";
+        case FaultReason::EXECUTE_OUT_OF_BOUNDS:    return "Tried to execute address " + show(as_hex(fault.value));
+        case FaultReason::UNALIGNED_WORD:           return "Word access must be word-aligned";
+        case FaultReason::UNALIGNED_HALFWORD_READ:  return "Address not naturally-aligned";
+        case FaultReason::UNALIGNED_HALFWORD_WRITE: return "Halfword access must be halfword-aligned";
+        case FaultReason::OUT_OF_BOUNDS:            return "Address " + show(as_hex(fault.value)) + " is out of bounds";
+        case FaultReason::READ_PUTC:                return "Can't read from putc address";
+        case FaultReason::WRITE_GETC:               return "Can't write to getc address";
+        case FaultReason::WRITE_INSTRUCTION:        return "Instruction memory is read-only";
+        case FaultReason::WRITE_READ_ONLY:          return "Address " + show(as_hex(fault.value)) + " is read-only";
+        case FaultReason::INVALID_INSTRUCTION:
+            // Let the decoder explain what is wrong with the word
+            try {
+                decode(fault.value);
+            } catch (MIPSError& err) {
+                return err.error_message;
+            }
+            return "Invalid instruction " + show(as_hex(fault.value));
+        case FaultReason::UNSUPPORTED_SYSCALL:      return "Unsupported syscall " + to_string(fault.value);
+        case FaultReason::INSTRUCTION_BUDGET:       return "Instruction budget exhausted";
+        case FaultReason::INFINITE_LOOP:            return "Infinite loop at " + show(as_hex(fault.value));
+        case FaultReason::DEADLOCK:                 return "Deadlock waiting for a mailbox at " + show(as_hex(fault.value));
+    }
+    return "";
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <string>
+
+#include "typedefs.hpp"
+#include "show.hpp"
+
+/**
+ * Why the guest faulted. Each reason belongs to one of the error classes in exceptions.hpp.
+ */
+enum class FaultReason : uint8_t {
+    NONE,
+
+    // Arithmetic errors
+    ARITHMETIC_OVERFLOW,
+
+    // Memory errors
+    EXECUTE_OUT_OF_BOUNDS,
+    UNALIGNED_WORD,
+    UNALIGNED_HALFWORD_READ,
+    UNALIGNED_HALFWORD_WRITE,
+    OUT_OF_BOUNDS,
+    READ_PUTC,
+    WRITE_GETC,
+    WRITE_INSTRUCTION,
+    WRITE_READ_ONLY,
+
+    // Invalid instruction errors
+    INVALID_INSTRUCTION,
+    // value is the service number
+    UNSUPPORTED_SYSCALL,
+
+    // The program ran for longer than the instruction budget
+    INSTRUCTION_BUDGET,
+    // The program is provably stuck: value is the address of the branch to itself
+    INFINITE_LOOP,
+    // Every program sharing the mailboxes is waiting for them: value is the waiting instruction's address
+    DEADLOCK,
+};
+
+/**
+ * Sticky fault register.
+ *
+ * Faults are recorded here instead of being thrown, so that the run loop only has to test one
+ * field after each instruction. Only the first fault is kept. The error message is built by
+ * show() when the fault is reported.
+ */
+struct Fault {
+    FaultReason reason = FaultReason::NONE;
+    // The faulting address, or the instruction word for INVALID_INSTRUCTION
+    Word value = 0;
+
+    inline bool raised() const { return reason != FaultReason::NONE; }
+
+    inline void raise(FaultReason new_reason, Word new_value = 0) {
+        if (raised()) return;
+        reason = new_reason;
+        value = new_value;
+    }
+
+    inline void clear() { reason = FaultReason::NONE; value = 0; }
+
+    // The program was stopped rather than ending by itself: it ran out of budget or could never
+    // go ahead. The exit codes of these can also be exit codes of the guest
+    inline bool stopped() const {
+        return reason == FaultReason::INSTRUCTION_BUDGET || reason == FaultReason::INFINITE_LOOP
+            || reason == FaultReason::DEADLOCK;
+    }
+
+    // Same exit codes as the matching MIPSError subclasses
+    int get_error_code() const;
+};
+
+template<> std::string show(const Fault&);
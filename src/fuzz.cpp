@@ -0,0 +1,701 @@
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "fuzz.hpp"
+#include "cpu.hpp"
+#include "memory.hpp"
+#include "predecoder.hpp"
+#include "show.hpp"
+
+using namespace std;
+
+namespace {
+
+// Cases are handed out to threads in chunks of this size
+const uint64_t chunk_size = 1 << 12;
+
+// Only the first few mismatches are printed
+const size_t max_reported_mismatches = 8;
+
+// Loads and stores stay within this much of data memory: their base is one of the pointer
+// registers, which point into the middle of it, and the instructions never write them
+const size_t window_bytes = 256;
+const uint8_t first_pointer = 16;
+const uint8_t pointer_count = 4;
+
+const Word interesting_words[] = {
+    0, 1, 2, 31, 32, 33, 0x7FFF, 0x8000, 0xFFFF, 0x10000,
+    0x7FFFFFFF, 0x80000000, 0x80000001, 0xFFFFFFFE, 0xFFFFFFFF,
+};
+const Word interesting_halves[] = { 0, 1, 0x7FFF, 0x8000, 0x8001, 0xFFFE, 0xFFFF };
+
+/**
+ * The state the instructions of a case can change
+ */
+struct MachineState {
+    array<Word, 32> registers;
+    Word hi;
+    Word lo;
+    Address pc;
+    Address npc;
+    array<uint8_t, window_bytes> memory;
+    Fault fault;
+};
+
+struct FuzzCase {
+    uint64_t number;
+    MachineState initial;
+    vector<Word> words;
+};
+
+// splitmix64, so that each case only depends on the seed and its number
+class Random {
+    private:
+        uint64_t state;
+
+    public:
+        Random(uint64_t seed) : state(seed) {}
+
+        uint64_t next() {
+            uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+            return z ^ (z >> 31);
+        }
+
+        uint32_t below(uint32_t n) { return static_cast<uint32_t>(next() % n); }
+};
+
+Word r_word(Word function, uint8_t rd, uint8_t rs, uint8_t rt, Word shift = 0) {
+    return (Word(rs) << 21) | (Word(rt) << 16) | (Word(rd) << 11) | (shift << 6) | function;
+}
+
+Word i_word(Word opcode, uint8_t rt, uint8_t rs, Word immediate) {
+    return (opcode << 26) | (Word(rs) << 21) | (Word(rt) << 16) | (immediate & 0xFFFF);
+}
+
+/**
+ * Random instructions, biased towards the edge cases: extreme values, division by zero,
+ * unaligned accesses and the pairs the predecoder fuses
+ */
+class Generator {
+    private:
+        uint64_t seed;
+        Random random;
+
+        Word value() {
+            switch (random.below(4)) {
+                case 0:  return interesting_words[random.below(sizeof(interesting_words) / sizeof(Word))];
+                case 1:  return static_cast<Word>(static_cast<int32_t>(random.below(65)) - 32);
+                default: return static_cast<Word>(random.next());
+            }
+        }
+
+        Word immediate() {
+            switch (random.below(4)) {
+                case 0:  return interesting_halves[random.below(sizeof(interesting_halves) / sizeof(Word))];
+                case 1:  return static_cast<Word>(static_cast<int32_t>(random.below(65)) - 32) & 0xFFFF;
+                default: return static_cast<Word>(random.next()) & 0xFFFF;
+            }
+        }
+
+        uint8_t any() { return static_cast<uint8_t>(random.below(32)); }
+        uint8_t pointer() { return first_pointer + random.below(pointer_count); }
+
+        // Anything but a pointer register, including $0 now and then
+        uint8_t dest() {
+            uint8_t reg = static_cast<uint8_t>(random.below(32 - pointer_count));
+            return reg < first_pointer ? reg : reg + pointer_count;
+        }
+
+        // An offset from a pointer register that stays in the window, aligned for `width` but
+        // for one in 16
+        Word offset(unsigned int width) {
+            Word offset = static_cast<Word>(static_cast<int32_t>(random.below(128)) - 64) & ~Word(width - 1);
+            if (width > 1 && random.below(16) == 0) offset |= 1 + random.below(width - 1);
+            return offset;
+        }
+
+        Word alu(uint8_t rd, uint8_t rs, uint8_t rt) {
+            static const Word functions[] = { 32, 33, 34, 35, 36, 37, 38, 42, 43 };
+            return r_word(functions[random.below(9)], rd, rs, rt);
+        }
+
+        Word load(uint8_t rt) {
+            static const Word opcodes[] = { 32, 33, 34, 35, 36, 37, 38 };
+            static const unsigned int widths[] = { 1, 2, 1, 4, 1, 2, 1 };
+            unsigned int which = random.below(7);
+            return i_word(opcodes[which], rt, pointer(), offset(widths[which]));
+        }
+
+        void add(vector<Word>& words) {
+            static const Word immediate_opcodes[] = { 8, 9, 10, 11, 12, 13, 14 };
+            static const Word stores[] = { 40, 41, 43 };
+            static const unsigned int store_widths[] = { 1, 2, 4 };
+            static const Word shifts[] = { 0, 2, 3 };
+            static const Word variable_shifts[] = { 4, 6, 7 };
+            static const Word products[] = { 24, 25, 26, 27 };
+            static const Word moves[] = { 16, 17, 18, 19 };
+            static const Word regimm_codes[] = { 0, 1, 16, 17 };
+
+            switch (random.below(20)) {
+                case 0: case 1: case 2:
+                    words.push_back(alu(dest(), any(), any()));
+                    break;
+                case 3: case 4:
+                    words.push_back(i_word(immediate_opcodes[random.below(7)], dest(), any(), immediate()));
+                    break;
+                case 5:
+                    words.push_back(r_word(shifts[random.below(3)], dest(), 0, any(), random.below(32)));
+                    break;
+                case 6:
+                    words.push_back(r_word(variable_shifts[random.below(3)], dest(), any(), any()));
+                    break;
+                case 7:
+                    words.push_back(r_word(products[random.below(4)], 0, any(), random.below(8) == 0 ? 0 : any()));
+                    break;
+                case 8: {
+                    Word function = moves[random.below(4)];
+                    bool to = function == 17 || function == 19;
+                    words.push_back(r_word(function, to ? 0 : dest(), to ? any() : 0, 0));
+                    break;
+                }
+                case 9:
+                    words.push_back(i_word(15, dest(), 0, immediate()));
+                    break;
+                case 10: case 11:
+                    words.push_back(load(dest()));
+                    break;
+                case 12: case 13: {
+                    unsigned int which = random.below(3);
+                    words.push_back(i_word(stores[which], any(), pointer(), offset(store_widths[which])));
+                    break;
+                }
+                case 14: {
+                    // Branches only change PC and nPC, since nothing is fetched
+                    unsigned int which = random.below(8);
+                    if (which < 2) {
+                        words.push_back(i_word(4 + which, any(), any(), immediate()));
+                    } else if (which < 4) {
+                        words.push_back(i_word(4 + which, 0, any(), immediate()));
+                    } else {
+                        // Linking branches on $ra are undefined
+                        Word code = regimm_codes[which - 4];
+                        uint8_t rs = code >= 16 ? static_cast<uint8_t>(random.below(31)) : any();
+                        words.push_back((1u << 26) | (Word(rs) << 21) | (code << 16) | immediate());
+                    }
+                    break;
+                }
+                case 15: {
+                    unsigned int which = random.below(5);
+                    if (which < 2) {
+                        words.push_back(((2 + which) << 26) | (static_cast<Word>(random.next()) & 0x3FFFFFF));
+                    } else if (which < 4) {
+                        words.push_back(r_word(8, 0, any(), 0));
+                    } else {
+                        // JALR with rd = rs is undefined
+                        uint8_t rs = any();
+                        uint8_t rd = dest();
+                        if (rd == rs) rd = 0;
+                        words.push_back(r_word(9, rd, rs, 0));
+                    }
+                    break;
+                }
+                case 16: {
+                    // li, fused as LUI_ORI
+                    uint8_t rt = dest();
+                    words.push_back(i_word(15, rt, 0, immediate()));
+                    words.push_back(i_word(13, random.below(8) == 0 ? dest() : rt, rt, immediate()));
+                    break;
+                }
+                case 17: {
+                    // A load and an ALU operation on it, fused as LOAD_ALU
+                    uint8_t rt = dest();
+                    words.push_back(load(rt));
+                    if (random.below(2)) words.push_back(alu(dest(), rt, any()));
+                    else                 words.push_back(i_word(immediate_opcodes[random.below(7)], dest(), rt, immediate()));
+                    break;
+                }
+                case 18: {
+                    // blt/bge and friends, fused as SLT_BRANCH
+                    uint8_t rd = dest();
+                    if (random.below(2)) words.push_back(r_word(42 + random.below(2), rd, any(), any()));
+                    else                 words.push_back(i_word(10 + random.below(2), rd, any(), immediate()));
+                    words.push_back(i_word(4 + random.below(2), 0, rd, immediate()));
+                    break;
+                }
+                default:
+                    words.push_back(r_word(15, 0, 0, 0));  // SYNC
+                    break;
+            }
+        }
+
+    public:
+        Generator(uint64_t i_seed) : seed(i_seed), random(i_seed) {}
+
+        FuzzCase generate(uint64_t number, unsigned int length) {
+            random = Random(seed ^ (number * 0xD1B54A32D192ED03ULL));
+            FuzzCase fuzz_case;
+            fuzz_case.number = number;
+            MachineState& state = fuzz_case.initial;
+
+            state.registers[0] = 0;
+            for (uint8_t reg = 1; reg < 32; reg++) state.registers[reg] = value();
+            for (uint8_t reg = first_pointer; reg < first_pointer + pointer_count; reg++) {
+                state.registers[reg] = data_start + window_bytes / 4 + 4 * random.below(window_bytes / 8);
+            }
+            state.hi = value();
+            state.lo = value();
+            state.pc = instruction_start;
+            state.npc = instruction_start + 4;
+            for (size_t i = 0; i < window_bytes; i += 8) {
+                uint64_t bytes = random.next();
+                for (size_t j = 0; j < 8; j++) state.memory[i + j] = static_cast<uint8_t>(bytes >> (8 * j));
+            }
+
+            while (fuzz_case.words.size() < length) add(fuzz_case.words);
+            fuzz_case.words.resize(length);
+            return fuzz_case;
+        }
+};
+
+/**
+ * The reference semantics: the MIPS I manual, written as plainly as possible and without
+ * reference to the CPU's code. A faulting instruction changes nothing and ends the case.
+ */
+class Model {
+    private:
+        MachineState& state;
+
+        void set(unsigned int reg, Word value) {
+            if (reg != 0) state.registers[reg] = value;
+        }
+
+        void next() {
+            state.pc = state.npc;
+            state.npc += 4;
+        }
+
+        void branch(bool taken, Word immediate) {
+            Word offset = static_cast<Word>(static_cast<int32_t>(static_cast<int16_t>(immediate))) << 2;
+            state.pc = state.npc;
+            state.npc += taken ? offset : 4;
+        }
+
+        size_t index(Address address) {
+            if (address < data_start || address - data_start >= window_bytes) {
+                throw logic_error("access outside of the window at " + show(as_hex(address)));
+            }
+            return address - data_start;
+        }
+
+        Word read(Address address, unsigned int width) {
+            size_t first = index(address);
+            Word value = 0;
+            for (size_t i = 0; i < width; i++) value = (value << 8) | state.memory[index(first + data_start + i)];
+            return value;
+        }
+
+        void write(Address address, unsigned int width, Word value) {
+            size_t first = index(address);
+            for (size_t i = 0; i < width; i++) {
+                state.memory[index(first + data_start + i)] = static_cast<uint8_t>(value >> (8 * (width - 1 - i)));
+            }
+        }
+
+        void execute_special(Word word) {
+            unsigned int rs = (word >> 21) & 31, rt = (word >> 16) & 31, rd = (word >> 11) & 31;
+            Word shift = (word >> 6) & 31;
+            Word s = state.registers[rs], t = state.registers[rt];
+            int32_t signed_s = static_cast<int32_t>(s), signed_t = static_cast<int32_t>(t);
+
+            switch (word & 63) {
+                case 0:  set(rd, t << shift); break;
+                case 2:  set(rd, t >> shift); break;
+                case 3:  set(rd, static_cast<Word>(signed_t >> shift)); break;
+                case 4:  set(rd, t << (s & 31)); break;
+                case 6:  set(rd, t >> (s & 31)); break;
+                case 7:  set(rd, static_cast<Word>(signed_t >> (s & 31))); break;
+                case 8: {
+                    state.pc = state.npc;
+                    state.npc = s;
+                    return;
+                }
+                case 9: {
+                    set(rd, state.pc + 8);
+                    state.pc = state.npc;
+                    state.npc = s;
+                    return;
+                }
+                case 15: break;
+                case 16: set(rd, state.hi); break;
+                case 17: state.hi = s; break;
+                case 18: set(rd, state.lo); break;
+                case 19: state.lo = s; break;
+                case 24: {
+                    int64_t product = int64_t(signed_s) * int64_t(signed_t);
+                    state.lo = static_cast<Word>(product);
+                    state.hi = static_cast<Word>(static_cast<uint64_t>(product) >> 32);
+                    break;
+                }
+                case 25: {
+                    uint64_t product = uint64_t(s) * uint64_t(t);
+                    state.lo = static_cast<Word>(product);
+                    state.hi = static_cast<Word>(product >> 32);
+                    break;
+                }
+                case 26:
+                    // Division by zero leaves HI and LO alone, and the one quotient that
+                    // doesn't fit wraps around like the hardware's
+                    if (t == 0) break;
+                    if (s == 0x80000000 && t == 0xFFFFFFFF) {
+                        state.lo = 0x80000000;
+                        state.hi = 0;
+                    } else {
+                        state.lo = static_cast<Word>(signed_s / signed_t);
+                        state.hi = static_cast<Word>(signed_s % signed_t);
+                    }
+                    break;
+                case 27:
+                    if (t == 0) break;
+                    state.lo = s / t;
+                    state.hi = s % t;
+                    break;
+                case 32: case 34: {
+                    Word result = (word & 63) == 32 ? s + t : s - t;
+                    Word operand = (word & 63) == 32 ? t : ~t;
+                    // Overflow: both operands (with t negated for a subtraction) have the same
+                    // sign, and the result the other
+                    if (((s ^ result) & (operand ^ result)) >> 31) {
+                        state.fault.raise(FaultReason::ARITHMETIC_OVERFLOW);
+                        return;
+                    }
+                    set(rd, result);
+                    break;
+                }
+                case 33: set(rd, s + t); break;
+                case 35: set(rd, s - t); break;
+                case 36: set(rd, s & t); break;
+                case 37: set(rd, s | t); break;
+                case 38: set(rd, s ^ t); break;
+                case 42: set(rd, signed_s < signed_t); break;
+                case 43: set(rd, s < t); break;
+                default: throw logic_error("no model of " + show(as_hex(word)));
+            }
+            next();
+        }
+
+        void execute_memory(Word opcode, unsigned int rt, Address address) {
+            Word t = state.registers[rt];
+            unsigned int widths[] = { 1, 2, 0, 4, 1, 2, 0, 0, 1, 2, 0, 4 };
+            unsigned int width = widths[opcode - 32];
+            if (width == 4 && address % 4 != 0) {
+                state.fault.raise(FaultReason::UNALIGNED_WORD, address);
+                return;
+            }
+            if (width == 2 && address % 2 != 0) {
+                state.fault.raise(opcode == 41 ? FaultReason::UNALIGNED_HALFWORD_WRITE : FaultReason::UNALIGNED_HALFWORD_READ, address);
+                return;
+            }
+
+            unsigned int misalignment = address % 4;
+            switch (opcode) {
+                case 32: set(rt, static_cast<Word>(static_cast<int8_t>(read(address, 1)))); break;
+                case 33: set(rt, static_cast<Word>(static_cast<int16_t>(read(address, 2)))); break;
+                case 35: set(rt, read(address, 4)); break;
+                case 36: set(rt, read(address, 1)); break;
+                case 37: set(rt, read(address, 2)); break;
+                case 34: {
+                    // The bytes from the address to the end of its word, into the top of rt
+                    Word word = read(address - misalignment, 4);
+                    Word kept = misalignment == 0 ? 0 : t & (0xFFFFFFFF >> (32 - 8 * misalignment));
+                    set(rt, (word << (8 * misalignment)) | kept);
+                    break;
+                }
+                case 38: {
+                    // The bytes from the start of the word to the address, into the bottom of rt
+                    Word word = read(address - misalignment, 4);
+                    unsigned int shift = 8 * (3 - misalignment);
+                    Word kept = shift == 0 ? 0 : t & ~(0xFFFFFFFF >> shift);
+                    set(rt, (word >> shift) | kept);
+                    break;
+                }
+                case 40: write(address, 1, t); break;
+                case 41: write(address, 2, t); break;
+                case 43: write(address, 4, t); break;
+                default: throw logic_error("no model of opcode " + show(opcode));
+            }
+            next();
+        }
+
+    public:
+        Model(MachineState& i_state) : state(i_state) {}
+
+        void execute(Word word) {
+            Word opcode = word >> 26;
+            unsigned int rs = (word >> 21) & 31, rt = (word >> 16) & 31;
+            Word immediate = word & 0xFFFF;
+            Word sign_extended = static_cast<Word>(static_cast<int32_t>(static_cast<int16_t>(immediate)));
+            Word s = state.registers[rs], t = state.registers[rt];
+            int32_t signed_s = static_cast<int32_t>(s);
+
+            switch (opcode) {
+                case 0: execute_special(word); return;
+                case 1: {
+                    bool link = (rt & 16) != 0;
+                    bool taken = (rt & 1) ? signed_s >= 0 : signed_s < 0;
+                    if (link) set(31, state.pc + 8);
+                    branch(taken, immediate);
+                    return;
+                }
+                case 2: case 3: {
+                    if (opcode == 3) set(31, state.pc + 8);
+                    Address target = (state.npc & 0xF0000000) | ((word & 0x3FFFFFF) << 2);
+                    state.pc = state.npc;
+                    state.npc = target;
+                    return;
+                }
+                case 4: branch(s == t, immediate); return;
+                case 5: branch(s != t, immediate); return;
+                case 6: branch(signed_s <= 0, immediate); return;
+                case 7: branch(signed_s > 0, immediate); return;
+                case 8: {
+                    Word result = s + sign_extended;
+                    if (((s ^ result) & (sign_extended ^ result)) >> 31) {
+                        state.fault.raise(FaultReason::ARITHMETIC_OVERFLOW);
+                        return;
+                    }
+                    set(rt, result);
+                    break;
+                }
+                case 9:  set(rt, s + sign_extended); break;
+                case 10: set(rt, signed_s < static_cast<int32_t>(sign_extended)); break;
+                case 11: set(rt, s < sign_extended); break;
+                case 12: set(rt, s & immediate); break;
+                case 13: set(rt, s | immediate); break;
+                case 14: set(rt, s ^ immediate); break;
+                case 15: set(rt, immediate << 16); break;
+                default:
+                    if (opcode < 32 || opcode > 43) throw logic_error("no model of " + show(as_hex(word)));
+                    execute_memory(opcode, rt, s + sign_extended);
+                    return;
+            }
+            next();
+        }
+};
+
+MachineState run_model(const FuzzCase& fuzz_case) {
+    MachineState state = fuzz_case.initial;
+    Model model(state);
+    for (Word word : fuzz_case.words) {
+        model.execute(word);
+        if (state.fault.raised()) break;
+    }
+    return state;
+}
+
+// The differences between two final states, or "" if they are the same
+string compare(const MachineState& expected, const MachineState& actual) {
+    string differences;
+    auto differ = [&] (const string& what, Word e, Word a) {
+        differences += "\n    " + what + ": expected " + show(as_hex(e)) + ", got " + show(as_hex(a));
+    };
+
+    if (expected.fault.reason != actual.fault.reason || expected.fault.value != actual.fault.value) {
+        differences += "\n    fault: expected " + (expected.fault.raised() ? show(expected.fault) : "none")
+            + ", got " + (actual.fault.raised() ? show(actual.fault) : "none");
+    }
+    for (size_t i = 0; i < window_bytes && expected.memory != actual.memory; i += 4) {
+        Word e = 0, a = 0;
+        for (size_t j = i; j < i + 4; j++) {
+            e = (e << 8) | expected.memory[j];
+            a = (a << 8) | actual.memory[j];
+        }
+        if (e != a) differ("memory at " + show(as_hex(static_cast<Word>(data_start + i))), e, a);
+    }
+
+    // After a fault the program is over, so only the fault and memory matter
+    if (expected.fault.raised()) return differences;
+
+    for (uint8_t reg = 1; reg < 32; reg++) {
+        if (expected.registers[reg] != actual.registers[reg]) {
+            differ(show(RegisterId{reg}), expected.registers[reg], actual.registers[reg]);
+        }
+    }
+    if (expected.hi != actual.hi)   differ("HI", expected.hi, actual.hi);
+    if (expected.lo != actual.lo)   differ("LO", expected.lo, actual.lo);
+    if (expected.pc != actual.pc)   differ("PC", expected.pc, actual.pc);
+    if (expected.npc != actual.npc) differ("nPC", expected.npc, actual.npc);
+    return differences;
+}
+
+}
+
+/**
+ * Runs cases on a CPU, which it has to reach into to set up and read back
+ */
+class FuzzHarness {
+    private:
+        CPU cpu;
+
+        void load(const MachineState& state) {
+            cpu.reset();
+            for (size_t reg = 1; reg < 32; reg++) cpu.registers[reg - 1] = static_cast<int>(state.registers[reg]);
+            cpu.HI = static_cast<int>(state.hi);
+            cpu.LO = static_cast<int>(state.lo);
+            for (size_t i = 0; i < window_bytes; i += 4) {
+                Word word = (Word(state.memory[i]) << 24) | (Word(state.memory[i + 1]) << 16)
+                    | (Word(state.memory[i + 2]) << 8) | state.memory[i + 3];
+                cpu.memory.write_word(data_start + i, word);
+            }
+        }
+
+        MachineState save() const {
+            MachineState state;
+            state.registers[0] = 0;
+            for (size_t reg = 1; reg < 32; reg++) state.registers[reg] = static_cast<Word>(cpu.registers[reg - 1]);
+            state.hi = static_cast<Word>(cpu.HI);
+            state.lo = static_cast<Word>(cpu.LO);
+            state.pc = cpu.PC;
+            state.npc = cpu.nPC;
+            state.fault = cpu.fault;
+            for (size_t i = 0; i < window_bytes; i += 4) {
+                Word word = cpu.memory.get_word(data_start + i);
+                for (size_t j = 0; j < 4; j++) state.memory[i + j] = static_cast<uint8_t>(word >> (24 - 8 * j));
+            }
+            return state;
+        }
+
+    public:
+        FuzzHarness() : cpu(make_shared<const ProgramImage>(vector<Word>{ 0 })) {}
+
+        // Run the instructions one at a time, or with fused pairs run by the fused path
+        MachineState run(const MachineState& initial, const vector<PredecodedInstruction>& program, bool fused) {
+            load(initial);
+            for (size_t i = 0; i < program.size() && !cpu.fault.raised(); i++) {
+                if (fused && program[i].fusion != Fusion::NONE && i + 1 < program.size()) {
+                    cpu.execute_fused(program[i], program[i + 1]);
+                    i++;
+                } else {
+                    cpu.execute_instruction(program[i].instruction);
+                }
+            }
+            return save();
+        }
+};
+
+namespace {
+
+struct ThreadResult {
+    uint64_t cases = 0;
+    uint64_t instructions = 0;
+    uint64_t faults = 0;
+    uint64_t fused = 0;
+    uint64_t mismatches = 0;
+};
+
+string describe(const FuzzCase& fuzz_case, const string& engine, const string& differences) {
+    string text = "case " + show(fuzz_case.number) + " (" + engine + "):";
+    for (Word word : fuzz_case.words) {
+        Instruction inst;
+        text += "\n    " + show(as_hex(word)) + "  " + (try_decode(word, inst) ? show(inst) : "invalid");
+    }
+    const MachineState& initial = fuzz_case.initial;
+    text += "\n  from";
+    for (uint8_t reg = 1; reg < 32; reg++) text += " " + show(RegisterId{reg}) + "=" + show(as_hex(initial.registers[reg]));
+    text += " HI=" + show(as_hex(initial.hi)) + " LO=" + show(as_hex(initial.lo));
+    return text + differences;
+}
+
+}
+
+int fuzz(const FuzzOptions& options, ostream& out) {
+    unsigned int threads = options.threads == 0 ? 1 : options.threads;
+
+    atomic<uint64_t> next_chunk(0);
+    vector<ThreadResult> results(threads);
+    vector<string> mismatches;
+    mutex mismatches_mutex;
+
+    // Describing a case is slow, so it is only done for the ones printed
+    auto report = [&] (const FuzzCase& fuzz_case, const string& engine, const string& differences) {
+        lock_guard<mutex> lock(mismatches_mutex);
+        if (mismatches.size() < max_reported_mismatches) mismatches.push_back(describe(fuzz_case, engine, differences));
+    };
+
+    auto worker = [&] (unsigned int id) {
+        ThreadResult& result = results[id];
+        Generator generator(options.seed);
+        FuzzHarness harness;
+
+        while (true) {
+            uint64_t first = next_chunk.fetch_add(chunk_size);
+            if (first >= options.cases) break;
+            uint64_t last = min(first + chunk_size, options.cases);
+
+            for (uint64_t number = first; number < last; number++) {
+                FuzzCase fuzz_case = generator.generate(number, options.length);
+                vector<PredecodedInstruction> program = predecode(fuzz_case.words, instruction_start);
+                result.cases++;
+
+                bool valid = true;
+                for (const PredecodedInstruction& slot : program) valid = valid && slot.valid;
+                if (!valid) {
+                    result.mismatches++;
+                    report(fuzz_case, "decoder", "\n    an instruction didn't decode");
+                    continue;
+                }
+
+                MachineState expected = run_model(fuzz_case);
+                if (expected.fault.raised()) result.faults++;
+                for (const PredecodedInstruction& slot : program) {
+                    if (slot.fusion != Fusion::NONE) result.fused++;
+                }
+
+                for (bool fused : { false, true }) {
+                    MachineState actual = harness.run(fuzz_case.initial, program, fused);
+                    result.instructions += program.size();
+                    string differences = compare(expected, actual);
+                    if (differences.empty()) continue;
+
+                    result.mismatches++;
+                    report(fuzz_case, fused ? "fused" : "one at a time", differences);
+                    break;
+                }
+            }
+        }
+    };
+
+    auto start = chrono::steady_clock::now();
+    vector<thread> pool;
+    for (unsigned int i = 0; i < threads; i++) pool.emplace_back(worker, i);
+    for (auto& t : pool) t.join();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    ThreadResult total;
+    for (const ThreadResult& r : results) {
+        total.cases += r.cases;
+        total.instructions += r.instructions;
+        total.faults += r.faults;
+        total.fused += r.fused;
+        total.mismatches += r.mismatches;
+    }
+
+    for (const string& m : mismatches) out << "mismatch in " << m << endl;
+
+    out << "cases:        " << total.cases << " of " << options.length << " instructions (seed " << options.seed << ")" << endl;
+    out << "faulted:      " << total.faults << endl;
+    out << "fused pairs:  " << total.fused << endl;
+    out << "instructions: " << total.instructions << " executed" << endl;
+    out << "mismatches:   " << total.mismatches << endl;
+    out << "throughput:   " << (seconds > 0 ? total.cases / seconds / 1e6 : 0) << " Mcases/s on "
+        << threads << " threads (" << seconds << "s)" << endl;
+
+    return total.mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+
+/**
+ * Options for fuzz()
+ */
+struct FuzzOptions {
+    unsigned int threads = 1;
+    uint64_t cases = 1000000;
+    // Case i is generated from the seed and i alone, so any case can be run again
+    uint64_t seed = 1;
+    // Instructions in each case
+    unsigned int length = 8;
+};
+
+/**
+ * Differential testing of the CPU against a reference model of the instruction set.
+ *
+ * Each case is a random sequence of instructions (no I/O or syscalls) with random registers,
+ * HI/LO and data memory. It is run on the reference model, then through
+ * CPU::execute_instruction one instruction at a time, and again with the pairs the predecoder
+ * fuses run by the fused path. The registers, PC, fault and memory have to come out the same.
+ *
+ * Prints the first mismatches and a summary to `out`, and returns 0 if every case agreed, 1
+ * otherwise.
+ */
+int fuzz(const FuzzOptions& options, std::ostream& out);
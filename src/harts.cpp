@@ -0,0 +1,82 @@
+#include <atomic>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "harts.hpp"
+#include "cpu.hpp"
+#include "shared_memory.hpp"
+#include "show.hpp"
+
+using namespace std;
+
+namespace {
+
+// How many instructions a hart runs between checks whether the machine has stopped
+const uint64_t hart_slice = 1 << 16;
+
+}
+
+int run_harts(shared_ptr<const ProgramImage> image, const HartOptions& options) {
+    SharedMemory memory(data_page_count);
+    // Starting with the program's initialized data
+    const PageTable& data = image->get_data_pages();
+    for (size_t page = 0; page < data_page_count; page++) {
+        const Page* words = data.read(page);
+        if (!words) continue;
+        for (size_t word = 0; word < page_words; word++) memory.write(page * page_words + word, (*words)[word]);
+    }
+
+    vector<unique_ptr<CPU>> cpus;
+    for (unsigned int id = 0; id < options.harts; id++) {
+        cpus.emplace_back(new CPU(image));
+        cpus.back()->set_hart(&memory, id, options.harts);
+        cpus.back()->set_fusion(options.fusion);
+        cpus.back()->set_max_instructions(options.max_instructions);
+        for (auto& mapping : options.mappings) {
+            if (!cpus.back()->map_file(mapping)) {
+                cerr << "Can't map a file at " << show(as_hex(mapping->get_start())) << endl;
+                return -21;
+            }
+        }
+    }
+
+    atomic<bool> stopped(false);
+    mutex stop_mutex;
+    int exit_code = 0;
+
+    auto run_hart = [&] (unsigned int id) {
+        CPU& cpu = *cpus[id];
+        while (!stopped.load(memory_order_relaxed)) {
+            if (cpu.step(hart_slice) != RunStatus::EXITED) continue;
+
+            // Other harts exiting doesn't stop the machine, but they're done
+            if (id != 0 && !cpu.get_fault().raised()) return;
+
+            lock_guard<mutex> lock(stop_mutex);
+            if (!stopped.load(memory_order_relaxed)) {
+                exit_code = cpu.get_exit_code();
+                if (cpu.get_fault().raised()) cerr << "hart " << id << ": " << show(cpu.get_fault()) << endl;
+                if (options.fault) *options.fault = cpu.get_fault();
+                stopped.store(true, memory_order_relaxed);
+            }
+            return;
+        }
+    };
+
+    vector<thread> threads;
+    for (unsigned int id = 0; id < options.harts; id++) threads.emplace_back(run_hart, id);
+    for (auto& t : threads) t.join();
+
+    if (options.stats) {
+        for (unsigned int id = 0; id < options.harts; id++) {
+            cerr << "hart " << id << ":" << endl;
+            cpus[id]->print_stats(cerr);
+        }
+    }
+
+    cout << flush;
+    return exit_code;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "program_image.hpp"
+#include "mapped_file.hpp"
+#include "fault.hpp"
+
+struct HartOptions {
+    unsigned int harts = 1;
+    bool fusion = true;
+    // Per hart
+    uint64_t max_instructions = UINT64_MAX;
+    bool stats = false;
+    // Mapped into every hart
+    std::vector<std::shared_ptr<const MappedFile>> mappings;
+    // If set, this is set to the fault of the hart that stopped the machine, if it faulted
+    Fault* fault = nullptr;
+};
+
+/**
+ * Run `image` on several harts, each a CPU on its own thread with its own registers, sharing
+ * one data memory. Every hart starts at the entry point; programs tell them apart by the hart
+ * ID at hart_id_address.
+ *
+ * The machine stops when hart 0 exits or any hart faults, and returns that hart's exit code.
+ * Harts still running then are stopped, but not as a fault.
+ */
+int run_harts(std::shared_ptr<const ProgramImage> image, const HartOptions& options);
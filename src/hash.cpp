@@ -0,0 +1,52 @@
+#include <cstring>
+#include <sstream>
+#include <iomanip>
+
+#include "hash.hpp"
+
+using namespace std;
+
+uint64_t hash_bytes(const void* data, size_t length, uint64_t seed) {
+    const uint64_t m = 0xc6a4a7935bd1e995ULL;
+    const int r = 47;
+
+    uint64_t h = seed ^ (length * m);
+
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    const unsigned char* end = bytes + (length / 8) * 8;
+
+    for (; bytes != end; bytes += 8) {
+        uint64_t k;
+        memcpy(&k, bytes, 8);
+
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+
+        h ^= k;
+        h *= m;
+    }
+
+    switch (length & 7) {
+        case 7: h ^= uint64_t(bytes[6]) << 48; // fallthrough
+        case 6: h ^= uint64_t(bytes[5]) << 40; // fallthrough
+        case 5: h ^= uint64_t(bytes[4]) << 32; // fallthrough
+        case 4: h ^= uint64_t(bytes[3]) << 24; // fallthrough
+        case 3: h ^= uint64_t(bytes[2]) << 16; // fallthrough
+        case 2: h ^= uint64_t(bytes[1]) << 8;  // fallthrough
+        case 1: h ^= uint64_t(bytes[0]);
+                h *= m;
+    }
+
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+
+    return h;
+}
+
+string show_hash(uint64_t hash) {
+    ostringstream ss;
+    ss << hex << setw(16) << setfill('0') << hash;
+    return ss.str();
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+ * Fast non-cryptographic 64-bit hash (MurmurHash64A) of a block of memory.
+ *
+ * Used to identify programs and inputs by content. The result depends on the host's byte
+ * order for anything but byte strings.
+ */
+uint64_t hash_bytes(const void* data, size_t length, uint64_t seed = 0);
+
+// 16 hex digits
+std::string show_hash(uint64_t hash);
@@ -0,0 +1,53 @@
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "host_files.hpp"
+
+using namespace std;
+
+int HostFiles::open(const string& path, Word flags) {
+    if (!allowed) return -1;
+
+    int host_flags;
+    switch (flags) {
+        case 0:  host_flags = O_RDONLY; break;
+        case 1:  host_flags = O_WRONLY | O_CREAT | O_TRUNC; break;
+        case 9:  host_flags = O_WRONLY | O_CREAT | O_APPEND; break;
+        default: return -1;
+    }
+
+    int host = ::open(path.c_str(), host_flags | O_CLOEXEC, 0644);
+    if (host < 0) return -1;
+    descriptors.push_back(host);
+    return 3 + descriptors.size() - 1;
+}
+
+int HostFiles::host_descriptor(Word descriptor) const {
+    if (descriptor < 3 || descriptor - 3 >= descriptors.size()) return -1;
+    return descriptors[descriptor - 3];
+}
+
+bool HostFiles::close(Word descriptor) {
+    int host = host_descriptor(descriptor);
+    if (host < 0) return false;
+    ::close(host);
+    descriptors[descriptor - 3] = -1;
+    return true;
+}
+
+bool HostFiles::any_open() const {
+    for (int host : descriptors) {
+        if (host >= 0) return true;
+    }
+    return false;
+}
+
+void HostFiles::close_all() {
+    for (int host : descriptors) {
+        if (host >= 0) ::close(host);
+    }
+    descriptors.clear();
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "typedefs.hpp"
+
+/**
+ * The host files a guest has opened, with the OPEN syscall.
+ *
+ * Guest descriptor 0 is getc's input, 1 is putc's output and 2 is stderr; files opened here
+ * are numbered from 3.
+ *
+ * Opening host files is off unless it is allowed, since the daemon and cached runs must not
+ * depend on (or write to) the host's files. Copies start with no files open.
+ */
+class HostFiles {
+    private:
+        bool allowed = false;
+        // Host descriptor of guest descriptor 3 + i, or -1 once it is closed
+        std::vector<int> descriptors;
+
+    public:
+        HostFiles() {}
+        HostFiles(const HostFiles& other) : allowed(other.allowed) {}
+        HostFiles& operator=(const HostFiles&) = delete;
+        ~HostFiles() { close_all(); }
+
+        void allow(bool enabled) { allowed = enabled; }
+
+        // Returns the guest descriptor, or -1
+        int open(const std::string& path, Word flags);
+        // The host descriptor for a guest descriptor above 2, or -1 if it isn't open
+        int host_descriptor(Word descriptor) const;
+        bool close(Word descriptor);
+        void close_all();
+        // True if any guest descriptor above 2 is open
+        bool any_open() const;
+};
@@ -0,0 +1,29 @@
+#include <cstdio>
+#include <string>
+
+#include "input_buffer.hpp"
+
+using namespace std;
+
+void InputBuffer::push(const string& data) {
+    lock_guard<std::mutex> lock(mutex);
+    buffer.insert(buffer.end(), data.begin(), data.end());
+}
+
+void InputBuffer::close() {
+    lock_guard<std::mutex> lock(mutex);
+    closed = true;
+}
+
+bool InputBuffer::ready() const {
+    lock_guard<std::mutex> lock(mutex);
+    return closed || !buffer.empty();
+}
+
+int InputBuffer::get() {
+    lock_guard<std::mutex> lock(mutex);
+    if (buffer.empty()) return EOF;
+    unsigned char c = buffer.front();
+    buffer.pop_front();
+    return c;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <string>
+
+/**
+ * Input for a guest's getc that arrives while the guest is running, e.g. from a network
+ * connection.
+ *
+ * Any thread can push input; the guest reads it on its own thread. Unlike a stream, an empty
+ * buffer is not the end of the input until it is closed, so a guest reading from an empty
+ * buffer has to wait (see CPU::step).
+ */
+class InputBuffer {
+    private:
+        mutable std::mutex mutex;
+        std::deque<char> buffer;
+        bool closed = false;
+
+    public:
+        void push(const std::string& data);
+        // No more input will be pushed: once the buffer is drained getc reads EOF
+        void close();
+
+        // True if get() would not have to wait, i.e. there is input or the buffer is closed
+        bool ready() const;
+        // The next character, or EOF if the buffer is closed and empty (or just empty)
+        int get();
+};
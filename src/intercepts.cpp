@@ -0,0 +1,117 @@
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "intercepts.hpp"
+#include "elf.hpp"
+#include "memory.hpp"
+
+using namespace std;
+
+namespace {
+
+// Strings are read this many bytes at a time
+const size_t chunk_size = 4096;
+
+/**
+ * The bytes of a string, a chunk at a time, without reading past the end of readable memory
+ */
+class StringReader {
+    private:
+        const Memory& memory;
+        Address address;
+        char buffer[chunk_size];
+        size_t position = 0;
+        size_t available = 0;
+
+    public:
+        StringReader(const Memory& i_memory, Address start) : memory(i_memory), address(start) {}
+
+        // False if the next byte can't be read
+        bool next(unsigned char& byte) {
+            if (position == available) {
+                // Up to the end of the page, which is either all readable or not
+                available = min(chunk_size, static_cast<size_t>(page_size - address % page_size));
+                if (!memory.readable_block(address, available)) return false;
+                memory.read_block(address, buffer, available);
+                address += available;
+                position = 0;
+            }
+            byte = buffer[position++];
+            return true;
+        }
+};
+
+bool strlen_routine(const Memory& memory, Address string, uint64_t budget, Word& length, uint64_t& bytes) {
+    StringReader reader(memory, string);
+    unsigned char byte;
+    for (bytes = 1; bytes <= budget; bytes++) {
+        if (!reader.next(byte)) return false;
+        if (byte == 0) {
+            length = bytes - 1;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool strcmp_routine(const Memory& memory, Address first, Address second, uint64_t budget, Word& result, uint64_t& bytes) {
+    StringReader first_reader(memory, first), second_reader(memory, second);
+    unsigned char a, b;
+    bytes = 0;
+    do {
+        if (++bytes > budget || !first_reader.next(a) || !second_reader.next(b)) return false;
+    } while (a == b && a != 0);
+    result = static_cast<int>(a) - static_cast<int>(b);
+    return true;
+}
+
+}
+
+template<>
+string show(const Routine& routine) {
+    switch (routine) {
+        case Routine::NONE:   return "none";
+        case Routine::MEMCPY: return "memcpy";
+        case Routine::MEMSET: return "memset";
+        case Routine::STRLEN: return "strlen";
+        case Routine::STRCMP: return "strcmp";
+    }
+    return "";
+}
+
+Routine routine_named(const string& name) {
+    for (size_t routine = 1; routine < routine_count; routine++) {
+        if (show(static_cast<Routine>(routine)) == name) return static_cast<Routine>(routine);
+    }
+    return Routine::NONE;
+}
+
+vector<Intercept> intercepts_from_elf(const string& path) {
+    vector<Intercept> intercepts;
+    for (const ElfSymbol& symbol : ElfFile(path).symbols()) {
+        Routine routine = routine_named(symbol.name);
+        if (routine != Routine::NONE && symbol.type == elf_function_symbol) {
+            intercepts.push_back(Intercept { routine, symbol.value });
+        }
+    }
+    return intercepts;
+}
+
+bool run_routine(Routine routine, Memory& memory, Word a0, Word a1, Word a2, uint64_t budget, Word& result, uint64_t& bytes) {
+    switch (routine) {
+        case Routine::MEMCPY:
+        case Routine::MEMSET:
+            result = a0;
+            bytes = a2;
+            if (bytes > budget) return false;
+            return routine == Routine::MEMCPY ? memory.copy_block(a0, a1, a2) : memory.fill_block(a0, a1, 1, a2);
+        case Routine::STRLEN:
+            return strlen_routine(memory, a0, budget, result, bytes);
+        case Routine::STRCMP:
+            return strcmp_routine(memory, a0, a1, budget, result, bytes);
+        case Routine::NONE:
+            break;
+    }
+    return false;
+}
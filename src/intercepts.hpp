@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "typedefs.hpp"
+#include "show.hpp"
+
+class Memory;
+
+/**
+ * Guest library routines that can be replaced by a native version. Each takes its arguments
+ * in $a0-$a2 and returns its result in $v0, like the C function of the same name.
+ */
+enum class Routine : uint8_t {
+    NONE,
+    MEMCPY,  // Copy $a2 bytes from $a1 to $a0. Returns $a0
+    MEMSET,  // Set $a2 bytes at $a0 to the low byte of $a1. Returns $a0
+    STRLEN,  // Returns the length of the string at $a0
+    STRCMP,  // Returns the difference of the first differing bytes (as unsigned chars) of the
+             // strings at $a0 and $a1, or 0 if they are equal
+};
+
+const size_t routine_count = 5;
+
+template<> std::string show(const Routine&);
+
+// The routine called `name`, or NONE
+Routine routine_named(const std::string& name);
+
+struct Intercept {
+    Routine routine;
+    // The routine's entry point in instruction memory
+    Address address;
+};
+
+// The intercepts for the routines defined (as functions) in an ELF file. Throws ElfError
+std::vector<Intercept> intercepts_from_elf(const std::string& path);
+
+struct InterceptStats {
+    // Calls run natively, by routine
+    uint64_t calls[routine_count] = {};
+    // Calls to an intercepted routine that ran the guest code instead: from a delay slot, or
+    // when the guest code would fault, do something the native version doesn't or run past
+    // the instruction budget
+    uint64_t declined = 0;
+
+    // With verification: calls checked, how many disagreed with the guest code, and how many
+    // instructions the guest code took for them
+    uint64_t verified = 0;
+    uint64_t mismatches = 0;
+    uint64_t guest_instructions = 0;
+};
+
+/**
+ * Run `routine` natively against `memory`, setting `bytes` to how many bytes it copied, set
+ * or scanned (its cost, in instructions).
+ *
+ * Returns false, having changed nothing, if any access the guest code would make could fault,
+ * the arguments are ones for which the guest code might behave differently (overlapping
+ * memcpy), or it would take more than `budget` bytes, so that the guest code must run instead.
+ */
+bool run_routine(Routine routine, Memory& memory, Word a0, Word a1, Word a2, uint64_t budget, Word& result, uint64_t& bytes);
@@ -2,10 +2,15 @@
 #include <string>
 #include <fstream>
 #include <memory>
+#include <iostream>
 
 #include "debug.hpp"
 #include "typedefs.hpp"
 #include "show.hpp"
+#include "loader.hpp"
+#include "elf.hpp"
+#include "assembler.hpp"
+#include "memory.hpp"
 
 using namespace std;
 
@@ -31,4 +36,80 @@ unique_ptr<vector<Word>> read_file(string filename) {
     }
 
     return result;
-}
\ No newline at end of file
+}
+
+bool is_elf(const string& bytes) {
+    return bytes.compare(0, 4, "\x7f" "ELF") == 0;
+}
+
+/**
+ * Place the loadable segments of a linked program (see testbench/linker.ld) in instruction
+ * and data memory.
+ */
+shared_ptr<const ProgramImage> elf_image(const ElfFile& elf) {
+    const string& filename = elf.get_path();
+    if (!elf.is_big_endian() || elf.machine() != elf_machine_mips) {
+        throw ElfError(filename + " is not a big-endian MIPS program");
+    }
+
+    vector<Word> words;
+    vector<DataSegment> data;
+    for (const ElfSegment& segment : elf.segments()) {
+        if (segment.memory_size == 0) continue;
+        uint64_t end = static_cast<uint64_t>(segment.address) + segment.memory_size;
+
+        if (is_instruction(segment.address) && end <= instruction_start + instruction_size) {
+            if (segment.address % 4 != 0) {
+                throw ElfError(filename + ": segment at " + show(as_hex(segment.address)) + " is not word-aligned");
+            }
+            size_t first = (segment.address - instruction_start) / 4;
+            words.resize(max<size_t>(words.size(), (end - instruction_start + 3) / 4), 0);
+            vector<Word> segment_words = words_from_bytes(elf.contents_of(segment));
+            copy(segment_words.begin(), segment_words.end(), words.begin() + first);
+        } else if (is_data(segment.address) && end <= data_start + data_size) {
+            // The rest of the segment (.bss) is zeros like all of data memory
+            data.push_back(DataSegment{segment.address, elf.contents_of(segment)});
+        } else {
+            throw ElfError(filename + ": segment at " + show(as_hex(segment.address))
+                           + " is outside of instruction and data memory");
+        }
+    }
+
+    Address entry = elf.entry();
+    if (!is_instruction(entry) || entry % 4 != 0 || (entry - instruction_start) / 4 >= words.size()) {
+        throw ElfError(filename + ": entry point " + show(as_hex(entry)) + " is not in the program");
+    }
+    return make_shared<const ProgramImage>(move(words), entry, data);
+}
+
+shared_ptr<const ProgramImage> load_image(string filename) {
+    // Source is assembled on the fly
+    if (filename.size() > 2 && filename.compare(filename.size() - 2, 2, ".s") == 0) {
+        try {
+            return assemble_file(filename).image();
+        } catch (AssemblyError& err) {
+            cerr << err.what() << endl;
+            std::exit(-21);
+        }
+    }
+
+    ifstream file(filename, ios::binary);
+    char magic[4] = {};
+    file.read(magic, sizeof(magic));
+    if (!is_elf(string(magic, sizeof(magic)))) return make_shared<const ProgramImage>(move(*read_file(filename)));
+
+    try {
+        return elf_image(ElfFile(filename));
+    } catch (ElfError& err) {
+        cerr << err.what() << endl;
+        std::exit(-21);
+    }
+}
+
+vector<Word> words_from_bytes(const string& bytes) {
+    vector<Word> words((bytes.size() + 3) / 4, 0);
+    for (size_t i = 0; i < bytes.size(); i++) {
+        words[i / 4] |= static_cast<Word>(static_cast<unsigned char>(bytes[i])) << (8 * (3 - i % 4));
+    }
+    return words;
+}
@@ -4,4 +4,22 @@
 #include <string>
 #include <memory>
 
-std::unique_ptr<std::vector<uint32_t>> read_file(std::string filename);
\ No newline at end of file
+#include "program_image.hpp"
+#include "elf.hpp"
+
+std::unique_ptr<std::vector<uint32_t>> read_file(std::string filename);
+
+// Read a program into an image that can be shared by any number of CPUs: a binary of
+// instruction memory, or a linked ELF file (such as the Makefile's .mips.elf files), whose
+// data segments are loaded too and which starts at its entry point, or assembly source (a .s
+// file, see assembler.hpp). Exits with -21 if it can't
+std::shared_ptr<const ProgramImage> load_image(std::string filename);
+
+// True if `bytes` start like an ELF file
+bool is_elf(const std::string& bytes);
+// The image of a linked program. Throws ElfError if it has segments outside of instruction
+// and data memory or its entry point isn't in the program
+std::shared_ptr<const ProgramImage> elf_image(const ElfFile& elf);
+
+// Big-endian words from the bytes of a binary. A partial last word is padded with zeros
+std::vector<uint32_t> words_from_bytes(const std::string& bytes);
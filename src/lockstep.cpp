@@ -0,0 +1,392 @@
+#include <array>
+#include <cassert>
+#include <vector>
+
+#include "lockstep.hpp"
+#include "cpu.hpp"
+#include "memory.hpp"
+
+using namespace std;
+
+LockstepGroup::LockstepGroup(const vector<CPU*>& i_cpus) :
+    cpus(i_cpus),
+    program(*i_cpus.at(0)->program),
+    max_instructions(i_cpus.at(0)->max_instructions) {
+        assert(cpus.size() <= lockstep_lanes);
+        for (auto& row : registers) row.fill(0);
+        hi.fill(0);
+        lo.fill(0);
+
+        PC = cpus[0]->PC;
+        nPC = cpus[0]->nPC;
+        instructions = cpus[0]->stats.instructions;
+        for (size_t lane = 0; lane < cpus.size(); lane++) {
+            assert(cpus[lane]->program == cpus[0]->program);
+            active |= 1u << lane;
+            load_lane(lane);
+            if (cpus[lane]->PC != PC || cpus[lane]->nPC != nPC) spill(lane, cpus[lane]->PC, cpus[lane]->nPC);
+        }
+    }
+
+/**
+ * Copy a lane's registers from its CPU
+ */
+void LockstepGroup::load_lane(size_t lane) {
+    const CPU& cpu = *cpus[lane];
+    for (size_t reg = 1; reg < 32; reg++) registers[reg][lane] = cpu.registers[reg - 1];
+    hi[lane] = cpu.HI;
+    lo[lane] = cpu.LO;
+}
+
+/**
+ * Copy a lane's state to its CPU, as if it had run on its own until now
+ */
+void LockstepGroup::store_lane(size_t lane, Address pc, Address npc) {
+    CPU& cpu = *cpus[lane];
+    for (size_t reg = 1; reg < 32; reg++) cpu.registers[reg - 1] = registers[reg][lane];
+    cpu.HI = hi[lane];
+    cpu.LO = lo[lane];
+    cpu.PC = pc;
+    cpu.nPC = npc;
+    cpu.stats.instructions = instructions;
+    cpu.stats.dispatches = instructions;
+}
+
+void LockstepGroup::spill(size_t lane, Address pc, Address npc) {
+    store_lane(lane, pc, npc);
+    active &= ~(1u << lane);
+    spilled |= 1u << lane;
+    stats.spills++;
+}
+
+void LockstepGroup::spill_all() {
+    for (size_t lane = 0; lane < cpus.size(); lane++) {
+        if (active & (1u << lane)) spill(lane, PC, nPC);
+    }
+}
+
+// The lane has exited or faulted
+void LockstepGroup::finish(size_t lane) {
+    store_lane(lane, PC, nPC);
+    active &= ~(1u << lane);
+}
+
+// Finish the lane if its last memory access faulted
+bool LockstepGroup::check_fault(size_t lane) {
+    if (!cpus[lane]->fault.raised()) return false;
+    finish(lane);
+    return true;
+}
+
+void LockstepGroup::advance_pc(Address offset) {
+    PC = nPC;
+    nPC += offset;
+}
+
+/**
+ * Carry on with the largest group of lanes that agree on where they are going, and spill the
+ * rest. `pcs` and `npcs` are where each lane is going.
+ */
+void LockstepGroup::converge(const LaneAddresses& pcs, const LaneAddresses& npcs) {
+    size_t best = lockstep_lanes;
+    size_t best_count = 0;
+    for (size_t lane = 0; lane < cpus.size(); lane++) {
+        if (!(active & (1u << lane))) continue;
+        size_t count = 0;
+        for (size_t other = 0; other < cpus.size(); other++) {
+            if ((active & (1u << other)) && pcs[other] == pcs[lane] && npcs[other] == npcs[lane]) count++;
+        }
+        if (count > best_count) {
+            best = lane;
+            best_count = count;
+        }
+    }
+    if (best == lockstep_lanes) return;
+
+    Address group_pc = pcs[best];
+    Address group_npc = npcs[best];
+    for (size_t lane = 0; lane < cpus.size(); lane++) {
+        if ((active & (1u << lane)) && (pcs[lane] != group_pc || npcs[lane] != group_npc)) {
+            spill(lane, pcs[lane], npcs[lane]);
+        }
+    }
+    PC = group_pc;
+    nPC = group_npc;
+}
+
+void LockstepGroup::branch(const array<bool, lockstep_lanes>& taken, Offset offset) {
+    bool any = false;
+    bool all = true;
+    for (size_t lane = 0; lane < cpus.size(); lane++) {
+        if (!(active & (1u << lane))) continue;
+        any |= taken[lane];
+        all &= taken[lane];
+    }
+
+    if (all || !any) {
+        advance_pc(all ? static_cast<Address>(offset << 2) : 4);
+        return;
+    }
+
+    LaneAddresses pcs, npcs;
+    for (size_t lane = 0; lane < lockstep_lanes; lane++) {
+        pcs[lane] = nPC;
+        npcs[lane] = nPC + (taken[lane] ? static_cast<Address>(offset << 2) : 4);
+    }
+    converge(pcs, npcs);
+}
+
+template<typename F>
+void LockstepGroup::alu(RegisterId dest, RegisterId a, RegisterId b, F f) {
+    if (dest.value != 0) {
+        const LaneWords& x = registers[a.value];
+        const LaneWords& y = registers[b.value];
+        LaneWords result;
+        for (size_t lane = 0; lane < lockstep_lanes; lane++) result[lane] = f(x[lane], y[lane]);
+        registers[dest.value] = result;
+    }
+    advance_pc(4);
+}
+
+template<typename F>
+void LockstepGroup::alu_immediate(RegisterId dest, RegisterId a, F f) {
+    alu(dest, a, a, [&f] (int32_t x, int32_t) { return f(x); });
+}
+
+/**
+ * Execute the R-type instructions that only need the lanes' registers. Returns false for the
+ * others, which are left to execute_fallback. Each must do exactly what CPU::execute_r_type does.
+ */
+bool LockstepGroup::execute_r_type(const R_Instruction& inst) {
+    unsigned int shift = inst.shift;
+    switch (inst.function) {
+        case OpFunction::ADDU:
+            alu(inst.dest, inst.src1, inst.src2, [] (int32_t x, int32_t y) {
+                return static_cast<int32_t>(static_cast<uint32_t>(x) + static_cast<uint32_t>(y)); });
+            return true;
+        case OpFunction::SUBU:
+            alu(inst.dest, inst.src1, inst.src2, [] (int32_t x, int32_t y) {
+                return static_cast<int32_t>(static_cast<uint32_t>(x) - static_cast<uint32_t>(y)); });
+            return true;
+        case OpFunction::AND:
+            alu(inst.dest, inst.src1, inst.src2, [] (int32_t x, int32_t y) { return x & y; });
+            return true;
+        case OpFunction::OR:
+            alu(inst.dest, inst.src1, inst.src2, [] (int32_t x, int32_t y) { return x | y; });
+            return true;
+        case OpFunction::XOR:
+            alu(inst.dest, inst.src1, inst.src2, [] (int32_t x, int32_t y) { return x ^ y; });
+            return true;
+        case OpFunction::SLT:
+            alu(inst.dest, inst.src1, inst.src2, [] (int32_t x, int32_t y) { return static_cast<int32_t>(x < y); });
+            return true;
+        case OpFunction::SLTU:
+            alu(inst.dest, inst.src1, inst.src2, [] (int32_t x, int32_t y) {
+                return static_cast<int32_t>(static_cast<uint32_t>(x) < static_cast<uint32_t>(y)); });
+            return true;
+        case OpFunction::SLL:
+            alu_immediate(inst.dest, inst.src2, [shift] (int32_t x) {
+                return static_cast<int32_t>(static_cast<uint32_t>(x) << shift); });
+            return true;
+        case OpFunction::SRL:
+            alu_immediate(inst.dest, inst.src2, [shift] (int32_t x) {
+                return static_cast<int32_t>(static_cast<uint32_t>(x) >> shift); });
+            return true;
+        case OpFunction::SRA:
+            alu_immediate(inst.dest, inst.src2, [shift] (int32_t x) { return x >> shift; });
+            return true;
+        case OpFunction::JALR:
+        case OpFunction::JR: {
+            // Like the CPU, JALR links before reading the target
+            if (inst.function == OpFunction::JALR && inst.dest.value != 0) registers[inst.dest.value].fill(PC + 8);
+            LaneAddresses pcs, npcs;
+            for (size_t lane = 0; lane < lockstep_lanes; lane++) {
+                pcs[lane] = nPC;
+                npcs[lane] = registers[inst.src1.value][lane];
+            }
+            converge(pcs, npcs);
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+/**
+ * Execute the I-type ALU instructions and branches. As with execute_r_type, each must do
+ * exactly what CPU::execute_i_type does.
+ */
+bool LockstepGroup::execute_i_type(const I_Instruction& inst) {
+    int32_t immediate = inst.immediate;
+    uint32_t zero_extended = static_cast<uint16_t>(inst.immediate);
+    array<bool, lockstep_lanes> taken;
+    const LaneWords& s = registers[inst.src.value];
+    const LaneWords& t = registers[inst.dest.value];
+
+    switch (inst.opcode) {
+        case IOpCode::ADDIU:
+            alu_immediate(inst.dest, inst.src, [immediate] (int32_t x) {
+                return static_cast<int32_t>(static_cast<uint32_t>(x) + static_cast<uint32_t>(immediate)); });
+            return true;
+        case IOpCode::ORI:
+            alu_immediate(inst.dest, inst.src, [zero_extended] (int32_t x) { return static_cast<int32_t>(x | zero_extended); });
+            return true;
+        case IOpCode::ANDI:
+            alu_immediate(inst.dest, inst.src, [zero_extended] (int32_t x) { return static_cast<int32_t>(x & zero_extended); });
+            return true;
+        case IOpCode::XORI:
+            alu_immediate(inst.dest, inst.src, [zero_extended] (int32_t x) { return static_cast<int32_t>(x ^ zero_extended); });
+            return true;
+        case IOpCode::SLTI:
+            alu_immediate(inst.dest, inst.src, [immediate] (int32_t x) { return static_cast<int32_t>(x < immediate); });
+            return true;
+        case IOpCode::SLTIU:
+            alu_immediate(inst.dest, inst.src, [immediate] (int32_t x) {
+                return static_cast<int32_t>(static_cast<uint32_t>(x) < static_cast<uint32_t>(immediate)); });
+            return true;
+        case IOpCode::LUI: {
+            int32_t upper = static_cast<int32_t>(static_cast<uint32_t>(immediate) << 16);
+            alu_immediate(inst.dest, inst.dest, [upper] (int32_t) { return upper; });
+            return true;
+        }
+        case IOpCode::BEQ:
+            for (size_t lane = 0; lane < lockstep_lanes; lane++) taken[lane] = s[lane] == t[lane];
+            branch(taken, inst.immediate);
+            return true;
+        case IOpCode::BNE:
+            for (size_t lane = 0; lane < lockstep_lanes; lane++) taken[lane] = s[lane] != t[lane];
+            branch(taken, inst.immediate);
+            return true;
+        case IOpCode::BGTZ:
+            for (size_t lane = 0; lane < lockstep_lanes; lane++) taken[lane] = s[lane] > 0;
+            branch(taken, inst.immediate);
+            return true;
+        case IOpCode::BLEZ:
+            for (size_t lane = 0; lane < lockstep_lanes; lane++) taken[lane] = s[lane] <= 0;
+            branch(taken, inst.immediate);
+            return true;
+        default:
+            return execute_memory(inst);
+    }
+}
+
+/**
+ * Loads and stores, one lane at a time through each lane's memory. A lane whose access faults
+ * stops there, like a CPU would.
+ */
+bool LockstepGroup::execute_memory(const I_Instruction& inst) {
+    uint8_t dest = inst.dest.value;
+    for (size_t lane = 0; lane < cpus.size(); lane++) {
+        if (!(active & (1u << lane))) continue;
+        Memory& memory = cpus[lane]->memory;
+        Address address = registers[inst.src.value][lane] + inst.immediate;
+        int32_t value = registers[dest][lane];
+
+        switch (inst.opcode) {
+            case IOpCode::LB:  value = static_cast<int8_t>(memory.get_byte(address)); break;
+            case IOpCode::LBU: value = memory.get_byte(address); break;
+            case IOpCode::LH:  value = static_cast<int16_t>(memory.get_halfword(address)); break;
+            case IOpCode::LHU: value = memory.get_halfword(address); break;
+            case IOpCode::LW:  value = memory.get_word(address); break;
+            case IOpCode::SB:  memory.write_byte(address, value & 0xFF); break;
+            case IOpCode::SH:  memory.write_halfword(address, value & 0xFFFF); break;
+            case IOpCode::SW:  memory.write_word(address, value); break;
+            default: return false;
+        }
+
+        if (check_fault(lane)) continue;
+        if (dest != 0) registers[dest][lane] = value;
+    }
+    advance_pc(4);
+    return true;
+}
+
+/**
+ * Execute an instruction on each lane's CPU, for everything that has no lane-parallel version
+ */
+void LockstepGroup::execute_fallback(const Instruction& inst, Address index) {
+    stats.fallback_instructions += __builtin_popcount(active);
+
+    LaneAddresses pcs, npcs;
+    pcs.fill(0);
+    npcs.fill(0);
+    for (size_t lane = 0; lane < cpus.size(); lane++) {
+        if (!(active & (1u << lane))) continue;
+        CPU& cpu = *cpus[lane];
+        store_lane(lane, PC, nPC);
+        cpu.current_index = index;
+        cpu.execute_instruction(inst);
+        if (check_fault(lane)) continue;
+        load_lane(lane);
+        pcs[lane] = cpu.PC;
+        npcs[lane] = cpu.nPC;
+    }
+    converge(pcs, npcs);
+}
+
+/**
+ * The same loop as CPU::run_until, for a group of lanes. Anything unusual (a fault on fetch,
+ * an invalid instruction, the instruction budget, a possible infinite loop) spills every lane
+ * so that their CPUs deal with it.
+ */
+void LockstepGroup::run() {
+    while (active) {
+        if (PC == 0) {
+            for (size_t lane = 0; lane < cpus.size(); lane++) {
+                if (active & (1u << lane)) finish(lane);
+            }
+            break;
+        }
+        if (instructions >= max_instructions || !is_instruction(PC) || PC % 4 != 0) {
+            spill_all();
+            break;
+        }
+
+        Address index = (PC - instruction_start) / 4;
+        if (index >= program.size() || program[index].word == 0) {
+            instructions++;
+            advance_pc(4);
+            continue;
+        }
+
+        const PredecodedInstruction& slot = program[index];
+        if (!slot.valid || slot.self_loop) {
+            spill_all();
+            break;
+        }
+
+        instructions++;
+        stats.lane_instructions += __builtin_popcount(active);
+
+        const Instruction& inst = slot.instruction;
+        bool done = false;
+        if (inst.is<R_Instruction>()) {
+            done = execute_r_type(inst.get_unchecked<R_Instruction>());
+        } else if (inst.is<I_Instruction>()) {
+            done = execute_i_type(inst.get_unchecked<I_Instruction>());
+        } else if (inst.is<J_Instruction>()) {
+            const J_Instruction& jump = inst.get_unchecked<J_Instruction>();
+            if (jump.opcode == JOpCode::JAL) registers[rRA.value].fill(PC + 8);
+            PC = nPC;
+            nPC = (PC & 0xF0000000) | (jump.address << 2);
+            done = true;
+        } else if (inst.is<REGIMM_Instruction>()) {
+            const REGIMM_Instruction& regimm = inst.get_unchecked<REGIMM_Instruction>();
+            bool link = regimm.code == REGIMMCode::BGEZAL || regimm.code == REGIMMCode::BLTZAL;
+            bool if_negative = regimm.code == REGIMMCode::BLTZ || regimm.code == REGIMMCode::BLTZAL;
+            // Like the CPU, link before reading the register
+            if (link) registers[rRA.value].fill(PC + 8);
+
+            const LaneWords& s = registers[regimm.src.value];
+            array<bool, lockstep_lanes> taken;
+            for (size_t lane = 0; lane < lockstep_lanes; lane++) taken[lane] = (s[lane] < 0) == if_negative;
+            branch(taken, regimm.offset);
+            done = true;
+        }
+        if (!done) execute_fallback(inst, index);
+    }
+
+    for (size_t lane = 0; lane < cpus.size(); lane++) {
+        if (spilled & (1u << lane)) cpus[lane]->run(false);
+    }
+}
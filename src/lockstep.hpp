@@ -0,0 +1,87 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "cpu.hpp"
+#include "opcodes.hpp"
+#include "typedefs.hpp"
+
+// Number of CPUs a lockstep group runs at once. Lane loops are written so that the compiler
+// can turn them into vector instructions
+const size_t lockstep_lanes = 8;
+
+using LaneWords = std::array<int32_t, lockstep_lanes>;
+using LaneAddresses = std::array<Address, lockstep_lanes>;
+
+struct LockstepStats {
+    // Instructions executed by each lane while in lockstep, summed over lanes
+    uint64_t lane_instructions = 0;
+    // Of those, instructions that had no lane-parallel implementation and ran through each
+    // lane's CPU instead
+    uint64_t fallback_instructions = 0;
+    // Lanes that diverged from the group (or hit something only a CPU can handle) and
+    // finished on their own
+    uint64_t spills = 0;
+};
+
+/**
+ * Runs up to lockstep_lanes CPUs with the same program, fresh from construction or reset(),
+ * in lockstep: one instruction fetch and decode for all of them, with the registers of the
+ * lanes stored side by side so that ALU instructions are a loop over the lanes.
+ *
+ * The lanes share a PC and nPC. When a branch or jump sends some of them elsewhere, the
+ * largest group of lanes going to the same place carries on and the others are spilled: their
+ * state is copied back into their CPUs, which finish the run on their own. Memory accesses go
+ * through each lane's own memory, so lanes can read different input.
+ *
+ * The results are exactly those of running each CPU with run(): once run() returns, every
+ * CPU has exited and its exit code, stats and output are as if it had run alone (except for
+ * jump prediction stats).
+ */
+class LockstepGroup {
+    private:
+        std::vector<CPU*> cpus;
+        const std::vector<PredecodedInstruction>& program;
+        uint64_t max_instructions;
+
+        // Bitmasks of the lanes still running in lockstep, and of those spilled to their CPU
+        uint32_t active = 0;
+        uint32_t spilled = 0;
+
+        alignas(32) std::array<LaneWords, 32> registers;
+        alignas(32) LaneWords hi;
+        alignas(32) LaneWords lo;
+        Address PC = instruction_start;
+        Address nPC = instruction_start + 4;
+        uint64_t instructions = 0;
+
+        LockstepStats stats;
+
+        template<typename F> void alu(RegisterId dest, RegisterId a, RegisterId b, F f);
+        template<typename F> void alu_immediate(RegisterId dest, RegisterId a, F f);
+
+        void advance_pc(Address offset);
+        void branch(const std::array<bool, lockstep_lanes>& taken, Offset offset);
+        void converge(const LaneAddresses& pcs, const LaneAddresses& npcs);
+
+        void store_lane(size_t lane, Address pc, Address npc);
+        void load_lane(size_t lane);
+        void spill(size_t lane, Address pc, Address npc);
+        void spill_all();
+        void finish(size_t lane);
+        bool check_fault(size_t lane);
+
+        bool execute_r_type(const R_Instruction& inst);
+        bool execute_i_type(const I_Instruction& inst);
+        bool execute_memory(const I_Instruction& inst);
+        void execute_fallback(const Instruction& inst, Address index);
+
+    public:
+        // All of the CPUs must be running the same image
+        LockstepGroup(const std::vector<CPU*>& cpus);
+
+        void run();
+        const LockstepStats& get_stats() const { return stats; }
+};
@@ -0,0 +1,70 @@
+#include <atomic>
+
+#include "mailbox.hpp"
+
+using namespace std;
+
+namespace {
+
+size_t round_up_to_power_of_two(size_t value) {
+    size_t result = 1;
+    while (result < value) result <<= 1;
+    return result;
+}
+
+}
+
+Mailbox::Mailbox(size_t capacity) :
+    words(new Word[round_up_to_power_of_two(capacity)]),
+    mask(round_up_to_power_of_two(capacity) - 1),
+    head(0),
+    tail(0) {}
+
+bool Mailbox::try_send(Word value) {
+    size_t position = tail.load(memory_order_relaxed);
+    if (position - cached_head > mask) {
+        cached_head = head.load(memory_order_acquire);
+        if (position - cached_head > mask) return false;
+    }
+    words[position & mask] = value;
+    tail.store(position + 1, memory_order_release);
+    return true;
+}
+
+bool Mailbox::try_receive(Word& value) {
+    size_t position = head.load(memory_order_relaxed);
+    if (position == cached_tail) {
+        cached_tail = tail.load(memory_order_acquire);
+        if (position == cached_tail) return false;
+    }
+    value = words[position & mask];
+    head.store(position + 1, memory_order_release);
+    return true;
+}
+
+size_t Mailbox::count() const {
+    // Read head first: tail only grows, so the difference can't be negative
+    size_t first = head.load(memory_order_acquire);
+    return tail.load(memory_order_acquire) - first;
+}
+
+size_t Mailbox::space() const {
+    size_t last = tail.load(memory_order_acquire);
+    size_t used = last - head.load(memory_order_acquire);
+    // head can have moved past the tail we read, in which case there's room for everything
+    return used > mask + 1 ? mask + 1 : mask + 1 - used;
+}
+
+size_t Mailbox::transfers() const {
+    return head.load(memory_order_relaxed) + tail.load(memory_order_relaxed);
+}
+
+Mailboxes::Mailboxes(size_t count, size_t capacity) {
+    for (size_t channel = 0; channel < count; channel++) channels.emplace_back(new Mailbox(capacity));
+}
+
+size_t Mailboxes::transfers() const {
+    size_t total = 0;
+    for (auto& channel : channels) total += channel->transfers();
+    return total;
+}
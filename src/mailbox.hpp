@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include "typedefs.hpp"
+
+// Each channel has three registers, 16 bytes apart:
+//   +0 data:  a load receives a word, a store sends one. Both wait until they can go ahead
+//   +4 count: the number of words waiting to be received (read-only)
+//   +8 space: the number of words that can be sent without waiting (read-only)
+const unsigned int mailbox_start         = 0x30001000;
+const unsigned int mailbox_stride        = 16;
+const unsigned int mailbox_max_channels  = 64;
+const unsigned int mailbox_data_offset   = 0;
+const unsigned int mailbox_count_offset  = 4;
+const unsigned int mailbox_space_offset  = 8;
+
+/**
+ * A bounded lock-free queue of words from one sending guest to one receiving guest, which may
+ * run on different threads.
+ *
+ * A ring buffer with the position of each end written only by its own side, so sending and
+ * receiving are a load and a store each (the other end's position is cached, so most of them
+ * don't even touch the other side's cache line).
+ */
+class Mailbox {
+    private:
+        std::unique_ptr<Word[]> words;
+        size_t mask;
+
+        // Counters that only grow; the index into words is counter & mask.
+        // The receiver's and the sender's halves are kept on separate cache lines
+        std::atomic<size_t> head;  // Next word to receive
+        size_t cached_tail = 0;
+        char padding[64];
+        std::atomic<size_t> tail;  // Next word to send
+        size_t cached_head = 0;
+
+    public:
+        // `capacity` is rounded up to a power of two
+        explicit Mailbox(size_t capacity);
+        Mailbox(const Mailbox&) = delete;
+        Mailbox& operator=(const Mailbox&) = delete;
+
+        // Only called by the sender. Returns false if the mailbox is full
+        bool try_send(Word value);
+        // Only called by the receiver. Returns false if the mailbox is empty
+        bool try_receive(Word& value);
+
+        // Either side can ask, but the answer may be out of date by the time it arrives.
+        // It is only ever too pessimistic for the side asking, i.e. count() for the receiver
+        // and space() for the sender
+        size_t count() const;
+        size_t space() const;
+
+        // Every word that has been sent or received so far; grows whenever a guest makes progress
+        size_t transfers() const;
+};
+
+/**
+ * The channels of the mailbox device, shared by the guests talking through it.
+ */
+class Mailboxes {
+    private:
+        std::vector<std::unique_ptr<Mailbox>> channels;
+
+    public:
+        Mailboxes(size_t count, size_t capacity);
+
+        size_t size() const { return channels.size(); }
+        Mailbox& operator[](size_t channel) { return *channels[channel]; }
+        const Mailbox& operator[](size_t channel) const { return *channels[channel]; }
+
+        size_t transfers() const;
+};
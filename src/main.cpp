@@ -1,6 +1,13 @@
 #include <iostream>
 #include <string>
 #include <algorithm>
+#include <thread>
+#include <iterator>
+#include <cstdlib>
+#include <sstream>
+#include <fstream>
+#include <cctype>
+#include <unistd.h>
 
 #include "memory.hpp"
 #include "loader.hpp"
@@ -9,6 +16,20 @@
 #include "test_programs.hpp"
 #include "debug.hpp"
 #include "exceptions.hpp"
+#include "decode_sweep.hpp"
+#include "snapshot.hpp"
+#include "sweep.hpp"
+#include "server.hpp"
+#include "result_cache.hpp"
+#include "harts.hpp"
+#include "intercepts.hpp"
+#include "elf.hpp"
+#include "assembler.hpp"
+#include "fuzz.hpp"
+#include "pipeline.hpp"
+#include "hash.hpp"
+#include "cache_model.hpp"
+#include "show.hpp"
 
 using namespace std;
 
@@ -17,8 +38,8 @@ void memtest() {
     cout << "This will test memory:\n";
     cout << "----------------------\n\n";
 
-    vector<Word> init_mem = {};
-    Memory memory((unique_ptr<vector<Word>>(&init_mem)));
+    Fault fault;
+    Memory memory(make_shared<const ProgramImage>(vector<Word>()), fault);
     
     Address address;
     Word data;
@@ -42,6 +63,11 @@ void memtest() {
             cin >> address;
 
             cout << memory.get_word(address) << "\n";
+        }
+
+        if (fault.raised()) {
+            cout << show(fault) << "\n";
+            fault.clear();
         } else if (option=="end" || option=="q") {
             done = true;
         }
@@ -65,19 +91,468 @@ void decode_and_dump(string filename) {
     }
 }
 
-int main(int argc, char** argv) {
+/**
+ * A command line argument that should be a number isn't
+ */
+class ArgumentError : public std::runtime_error {
+    public:
+        using std::runtime_error::runtime_error;
+};
+
+/**
+ * Read all of `text` as an unsigned number, in decimal or with a 0x prefix in hex. Throws
+ * ArgumentError if it isn't one or is above `max` (or doesn't fit in 64 bits)
+ */
+uint64_t parse_number(const string& text, uint64_t max = UINT64_MAX) {
+    // stoull would skip spaces and wrap negative numbers around
+    if (text.empty() || !isdigit(static_cast<unsigned char>(text[0]))) throw ArgumentError("Not a number: " + text);
+
+    size_t end = 0;
+    uint64_t value = 0;
+    try {
+        value = stoull(text, &end, 0);
+    } catch (logic_error&) {
+        throw ArgumentError("Not a number: " + text);
+    }
+    if (end != text.size()) throw ArgumentError("Not a number: " + text);
+    if (value > max) throw ArgumentError("Out of range: " + text);
+    return value;
+}
+
+/**
+ * Write how the run ended to the file given with --status-file: "stopped" if it was stopped
+ * (see Fault::stopped), "exited" otherwise, even if it faulted. Unlike the exit code this is
+ * something the guest can't produce itself. Returns false if the file can't be written
+ */
+bool write_status(const string& path, bool stopped) {
+    if (path.empty()) return true;
+    ofstream file(path, ios::trunc);
+    file << (stopped ? "stopped" : "exited") << endl;
+    if (!file.good()) {
+        cerr << "Can't write " << path << endl;
+        return false;
+    }
+    return true;
+}
+
+// Size limit of the result cache, unless MIPS_SIM_CACHE_MAX_MB is set
+const uint64_t default_cache_max_mb = 256;
+
+/**
+ * Run a binary through the result cache in `cache_directory`: if it has already been run with
+ * the same input and budget (by this build of the simulator), print the stored result instead.
+ *
+ * The whole input is read up front, since it is part of the key.
+ */
+int run_cached(const string& filename, const string& cache_directory, bool fusion, uint64_t max_instructions, const string& status_file) {
+    string input((istreambuf_iterator<char>(cin)), istreambuf_iterator<char>());
+    auto image = load_image(filename);
+
+    const char* max_mb = getenv("MIPS_SIM_CACHE_MAX_MB");
+    ResultCache cache(cache_directory, (max_mb ? parse_number(max_mb) : default_cache_max_mb) << 20);
+    CacheKey key {
+        simulator_hash(),
+        image->get_hash(), image->size(),
+        hash_bytes(input.data(), input.size()), input.size(),
+        max_instructions
+    };
+
+    CachedResult result;
+    if (!cache.lookup(key, result)) {
+        istringstream guest_input(input);
+        ostringstream guest_output;
+
+        CPU cpu(image);
+        cpu.set_io(&guest_input, &guest_output);
+        cpu.set_fusion(fusion);
+        cpu.set_max_instructions(max_instructions);
+
+        result.exit_code = cpu.run(false);
+        result.instructions = cpu.get_stats().instructions;
+        result.output = guest_output.str();
+        if (cpu.get_fault().raised()) result.error = show(cpu.get_fault());
+        result.stopped = cpu.get_fault().stopped();
+        cache.store(key, result);
+    }
+
+    cout << result.output << flush;
+    if (!result.error.empty()) cerr << result.error << endl;
+    if (!write_status(status_file, result.stopped)) return -21;
+    return result.exit_code;
+}
+
+/**
+ * Run the binary given as the last argument, with the options before it:
+ *
+ *   trace                  print each instruction as it is executed
+ *   --stats                print execution counters to stderr at the end
+ *   --no-fusion            execute fused instruction pairs one at a time
+ *   --max-insns N          stop with exit code -13 after N instructions
+ *   --status-file FILE     write "stopped" to FILE if the budget ran out or the program can
+ *                          never go ahead (exit codes -13/-14), otherwise "exited"
+ *   --restore FILE         start from a snapshot instead of the initial state
+ *   --snapshot FILE        write a snapshot when the program stops...
+ *   --snapshot-after N     ...or once N instructions have been executed, then exit with 0
+ *   --cache DIR            reuse the results of identical runs (also MIPS_SIM_CACHE=DIR)
+ *   --harts N              run N harts sharing data memory, each on its own thread
+ *   --host-files           let the program open host files with the OPEN syscall
+ *   --map FILE@ADDR        map FILE read-only into the address space at ADDR (repeatable)
+ *   --intercept NAME@ADDR  run the routine NAME (memcpy, memset, strlen, strcmp) natively when
+ *                          the function at ADDR is called (repeatable)
+ *   --intercepts-from FILE intercept the routines defined in the symbol table of an ELF file
+ *   --verify-intercepts    check each intercepted call against the guest code instead
+ *   --loop-accel           run loops that only copy or fill memory in one go
+ *   --caches               simulate L1 instruction and data caches, and print their counters
+ *                          and the instructions that miss most to stderr at the end
+ *   --l1i/--l1d/--l2 CACHE the same, with an L1 or an L2 cache of SIZE:WAYS:LINE[:lru|random]
+ */
+int run_program(int argc, char** argv) {
+    bool trace = false;
+    bool stats = false;
+    bool fusion = true;
+    uint64_t max_instructions = UINT64_MAX;
+    string restore_file;
+    string snapshot_file;
+    string status_file;
+    uint64_t snapshot_after = UINT64_MAX;
+    const char* cache_env = getenv("MIPS_SIM_CACHE");
+    string cache_directory = cache_env ? cache_env : "";
+    unsigned int harts = 1;
+    bool host_files = false;
+    vector<shared_ptr<const MappedFile>> mappings;
+    vector<Intercept> intercepts;
+    bool verify_intercepts = false;
+    bool loop_acceleration = false;
+    bool simulate_caches = false;
+    CacheHierarchyConfig caches;
+
+    for (int i = 1; i < argc - 1; i++) {
+        string arg = argv[i];
+        bool has_value = i + 1 < argc - 1;
+        if      (arg == "trace")       trace = true;
+        else if (arg == "--stats")     stats = true;
+        else if (arg == "--no-fusion") fusion = false;
+        else if (arg == "--host-files") host_files = true;
+        else if (arg == "--verify-intercepts") verify_intercepts = true;
+        else if (arg == "--loop-accel") loop_acceleration = true;
+        else if (arg == "--caches")     simulate_caches = true;
+        else if (arg == "--max-insns"      && has_value) max_instructions = parse_number(argv[++i]);
+        else if (arg == "--restore"        && has_value) restore_file = argv[++i];
+        else if (arg == "--snapshot"       && has_value) snapshot_file = argv[++i];
+        else if (arg == "--status-file"    && has_value) status_file = argv[++i];
+        else if (arg == "--snapshot-after" && has_value) snapshot_after = parse_number(argv[++i]);
+        else if (arg == "--cache"          && has_value) cache_directory = argv[++i];
+        else if (arg == "--harts"          && has_value) harts = parse_number(argv[++i], UINT32_MAX);
+        else if (arg == "--l1i"            && has_value) {
+            if (!parse_cache_config(argv[++i], caches.instruction)) return -21;
+            simulate_caches = true;
+        }
+        else if (arg == "--l1d"            && has_value) {
+            if (!parse_cache_config(argv[++i], caches.data)) return -21;
+            simulate_caches = true;
+        }
+        else if (arg == "--l2"             && has_value) {
+            if (!parse_cache_config(argv[++i], caches.l2)) return -21;
+            caches.has_l2 = true;
+            simulate_caches = true;
+        }
+        else if (arg == "--map"            && has_value) {
+            string mapping = argv[++i];
+            size_t at = mapping.rfind('@');
+            if (at == string::npos) return -21;
+            try {
+                Address start = parse_number(mapping.substr(at + 1), UINT32_MAX);
+                mappings.push_back(make_shared<const MappedFile>(mapping.substr(0, at), start));
+            } catch (MapError& err) {
+                cerr << err.what() << endl;
+                return -21;
+            }
+        }
+        else if (arg == "--intercept"      && has_value) {
+            string intercept = argv[++i];
+            size_t at = intercept.rfind('@');
+            if (at == string::npos) return -21;
+            Routine routine = routine_named(intercept.substr(0, at));
+            if (routine == Routine::NONE) return -21;
+            intercepts.push_back(Intercept{routine, static_cast<Address>(parse_number(intercept.substr(at + 1), UINT32_MAX))});
+        }
+        else if (arg == "--intercepts-from" && has_value) {
+            try {
+                vector<Intercept> found = intercepts_from_elf(argv[++i]);
+                intercepts.insert(intercepts.end(), found.begin(), found.end());
+            } catch (ElfError& err) {
+                cerr << err.what() << endl;
+                return -21;
+            }
+        }
+        else return -21;
+    }
+
+    // The caches only see the loads and stores the guest code makes itself
+    if (simulate_caches && (harts != 1 || !intercepts.empty() || loop_acceleration)) return -21;
+
+    if (harts != 1) {
+        // Snapshots don't cover shared memory, and the interleaving isn't deterministic
+        if (harts == 0 || trace || !intercepts.empty() || loop_acceleration || !restore_file.empty() || !snapshot_file.empty()) return -21;
+
+        HartOptions options;
+        options.harts = harts;
+        options.fusion = fusion;
+        options.max_instructions = max_instructions;
+        options.stats = stats;
+        options.mappings = mappings;
+        Fault fault;
+        options.fault = &fault;
+        int exit_code = run_harts(load_image(argv[argc-1]), options);
+        if (!write_status(status_file, fault.stopped())) return -21;
+        return exit_code;
+    }
+
+    // Only plain runs are cached: the other options depend on or produce more than the result
+    if (!cache_directory.empty() && !trace && !stats && !simulate_caches && !host_files && mappings.empty() && intercepts.empty() && restore_file.empty() && snapshot_file.empty()) {
+        return run_cached(argv[argc-1], cache_directory, fusion, max_instructions, status_file);
+    }
+
+    CPU cpu(load_image(argv[argc-1]));
+    cpu.set_fusion(fusion);
+    cpu.allow_host_files(host_files);
+    for (auto& mapping : mappings) {
+        if (!cpu.map_file(mapping)) {
+            cerr << "Can't map a file at " << show(as_hex(mapping->get_start())) << endl;
+            return -21;
+        }
+    }
+    if (!intercepts.empty() && !cpu.set_intercepts(intercepts, verify_intercepts)) {
+        cerr << "Can't intercept a routine that doesn't start with a valid instruction" << endl;
+        return -21;
+    }
+    cpu.set_loop_acceleration(loop_acceleration);
+
+    try {
+        if (!restore_file.empty()) restore_snapshot(cpu, restore_file);
+    } catch (SnapshotError& err) {
+        cerr << err.what() << endl;
+        return -21;
+    }
+
+    if (simulate_caches) cpu.set_caches(caches);
+
+    bool stop_for_snapshot = !snapshot_file.empty() && snapshot_after < max_instructions;
+    cpu.set_max_instructions(stop_for_snapshot ? snapshot_after : max_instructions);
+
+    int exit_code = cpu.run(trace);
+
+    if (stop_for_snapshot && cpu.get_fault().reason == FaultReason::INSTRUCTION_BUDGET) {
+        cpu.clear_fault();
+        exit_code = 0;
+    }
+
+    if (cpu.get_fault().raised()) cerr << show(cpu.get_fault()) << endl;
+    if (!write_status(status_file, cpu.get_fault().stopped())) return -21;
+    if (stats) cpu.print_stats(cerr);
+    if (simulate_caches) cpu.print_cache_stats(cerr);
+
+    if (!snapshot_file.empty() && !cpu.get_fault().raised()) {
+        try {
+            save_snapshot(cpu, snapshot_file);
+        } catch (SnapshotError& err) {
+            cerr << err.what() << endl;
+            return -21;
+        }
+    }
+
+    return exit_code;
+}
+
+/**
+ * sweep [--threads N] [--length-prefixed] [--no-fusion] [--lockstep] [--max-insns N] program.bin inputs
+ *
+ * Run the binary over every record in the inputs file, printing a JSON line per run
+ */
+int run_sweep(int argc, char** argv) {
+    SweepOptions options;
+    options.threads = thread::hardware_concurrency();
+
+    for (int i = 2; i < argc - 2; i++) {
+        string arg = argv[i];
+        bool has_value = i + 1 < argc - 2;
+        if      (arg == "--length-prefixed") options.length_prefixed = true;
+        else if (arg == "--no-fusion")       options.fusion = false;
+        else if (arg == "--lockstep")        options.lockstep = true;
+        else if (arg == "--threads"   && has_value) options.threads = parse_number(argv[++i], UINT32_MAX);
+        else if (arg == "--max-insns" && has_value) options.max_instructions = parse_number(argv[++i]);
+        else return -21;
+    }
+
+    return sweep(argv[argc-2], argv[argc-1], options, cout);
+}
+
+/**
+ * pipeline [--capacity N] [--stats] [--no-fusion] [--max-insns N] [--status-file FILE] first.bin ... last.bin
+ *
+ * Run the binaries as the stages of a pipeline connected by mailboxes, one thread each
+ */
+int run_pipeline_stages(int argc, char** argv) {
+    PipelineOptions options;
+    string status_file;
+
+    int i = 2;
+    for (; i < argc && string(argv[i]).compare(0, 2, "--") == 0; i++) {
+        string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if      (arg == "--stats")     options.stats = true;
+        else if (arg == "--no-fusion") options.fusion = false;
+        else if (arg == "--capacity"  && has_value) options.capacity = parse_number(argv[++i]);
+        else if (arg == "--max-insns" && has_value) options.max_instructions = parse_number(argv[++i]);
+        else if (arg == "--status-file" && has_value) status_file = argv[++i];
+        else return -21;
+    }
+    if (i == argc || options.capacity == 0 || argc - i > static_cast<int>(mailbox_max_channels)) return -21;
+
+    vector<shared_ptr<const ProgramImage>> stages;
+    for (; i < argc; i++) stages.push_back(load_image(argv[i]));
+    Fault fault;
+    options.fault = &fault;
+    int exit_code = run_pipeline(stages, options);
+    if (!write_status(status_file, fault.stopped())) return -21;
+    return exit_code;
+}
+
+/**
+ * client SOCKET [--stats] [--no-fusion] [--interactive] [--max-insns N] [--status-file FILE] program.bin
+ *
+ * Run the binary in the daemon started with `serve SOCKET`, with this process' stdin, stdout
+ * and exit code, so it can stand in for running the binary directly. With --interactive the
+ * input is forwarded and the output printed while the program runs, rather than all at once
+ */
+int run_client(int argc, char** argv) {
+    Job job;
+    bool stats = false;
+    bool interactive = false;
+    string status_file;
+
+    for (int i = 3; i < argc - 1; i++) {
+        string arg = argv[i];
+        bool has_value = i + 1 < argc - 1;
+        if      (arg == "--stats")     stats = true;
+        else if (arg == "--no-fusion") job.fusion = false;
+        else if (arg == "--interactive") interactive = true;
+        else if (arg == "--max-insns"   && has_value) job.max_instructions = parse_number(argv[++i]);
+        else if (arg == "--status-file" && has_value) status_file = argv[++i];
+        else return -21;
+    }
+
+    // The daemon may be running in another directory
+    char* path = realpath(argv[argc-1], nullptr);
+    if (path == nullptr) return -21;
+    job.image = path;
+    free(path);
+
+    JobResult result;
+    if (interactive) {
+        if (!run_session(argv[2], job, STDIN_FILENO, cout, result)) {
+            cerr << result.error << endl;
+            return -21;
+        }
+    } else {
+        job.input.assign(istreambuf_iterator<char>(cin), istreambuf_iterator<char>());
+        if (!submit_job(argv[2], job, result)) {
+            cerr << result.error << endl;
+            return -21;
+        }
+    }
+
+    cout << result.output << flush;
+    if (!result.error.empty()) cerr << result.error << endl;
+    if (!write_status(status_file, result.stopped)) return -21;
+    if (stats) {
+        cerr << "instructions: " << result.instructions << endl;
+        cerr << "dispatches:   " << result.dispatches << endl;
+    }
+    return result.exit_code;
+}
+
+/**
+ * fuzz [--threads N] [--cases N] [--seed N] [--length N]
+ *
+ * Differential testing of the CPU against a reference model on random instruction sequences
+ */
+int run_fuzz(int argc, char** argv) {
+    FuzzOptions options;
+    options.threads = thread::hardware_concurrency();
+
+    for (int i = 2; i < argc; i++) {
+        string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if      (arg == "--threads" && has_value) options.threads = parse_number(argv[++i], UINT32_MAX);
+        else if (arg == "--cases"   && has_value) options.cases = parse_number(argv[++i]);
+        else if (arg == "--seed"    && has_value) options.seed = parse_number(argv[++i]);
+        else if (arg == "--length"  && has_value) options.length = parse_number(argv[++i], UINT32_MAX);
+        else return -21;
+    }
+    if (options.length == 0) return -21;
+
+    return fuzz(options, cout);
+}
+
+/**
+ * assemble program.s output
+ *
+ * Assemble the source into a binary of instruction memory, or into a linked ELF file with
+ * its data if the output ends in .elf
+ */
+int run_assembler(const string& source, const string& output) {
+    AssembledProgram program;
+    try {
+        program = assemble_file(source);
+    } catch (AssemblyError& err) {
+        cerr << err.what() << endl;
+        return -21;
+    }
+
+    bool elf = output.size() > 4 && output.compare(output.size() - 4, 4, ".elf") == 0;
+    ofstream file(output, ios::binary);
+    file << (elf ? program.elf() : program.binary());
+    if (!file.good()) {
+        cerr << "Can't write " << output << endl;
+        return -21;
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) try {
     if (argc >= 2 && string(argv[1]) == string("memtest")) {
         memtest();
     } else if (argc >= 3 && string(argv[1]) == string("decode")) {
         decode_and_dump(argv[2]);
+    } else if (argc >= 2 && string(argv[1]) == string("decode-sweep")) {
+        // decode-sweep [threads] [first last]
+        unsigned int threads = (argc >= 3) ? parse_number(argv[2], UINT32_MAX) : thread::hardware_concurrency();
+        uint64_t first = (argc >= 5) ? parse_number(argv[3]) : 0;
+        uint64_t last  = (argc >= 5) ? parse_number(argv[4]) : 0xFFFFFFFF;
+        exit(decode_sweep(threads, first, last));
+    } else if (argc >= 3 && string(argv[1]) == string("serve")) {
+        // serve [threads] socket
+        unsigned int threads = (argc >= 4) ? parse_number(argv[2], UINT32_MAX) : thread::hardware_concurrency();
+        exit(serve(argv[argc-1], threads));
+    } else if (argc >= 4 && string(argv[1]) == string("client")) {
+        exit(run_client(argc, argv));
+    } else if (argc >= 4 && string(argv[1]) == string("sweep")) {
+        exit(run_sweep(argc, argv));
+    } else if (argc >= 2 && string(argv[1]) == string("fuzz")) {
+        exit(run_fuzz(argc, argv));
+    } else if (argc == 4 && string(argv[1]) == string("assemble")) {
+        exit(run_assembler(argv[2], argv[3]));
+    } else if (argc >= 3 && string(argv[1]) == string("pipeline")) {
+        exit(run_pipeline_stages(argc, argv));
     } else if (argc >= 2) {
-        bool trace = (argc >= 3 && argv[1] == string("trace"));
-        CPU cpu(read_file(argv[argc-1]));
-        uint8_t exit_code = cpu.run(trace);
-        exit(exit_code);
+        exit(run_program(argc, argv));
     } else {
         std::exit(-21);
     }
 
     return 0;
+} catch (ArgumentError& err) {
+    cerr << err.what() << endl;
+    std::exit(-21);
 }
@@ -0,0 +1,44 @@
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mapped_file.hpp"
+
+using namespace std;
+
+MappedFile::MappedFile(const string& path, Address i_start) : start(i_start) {
+    if (start % 4 != 0) throw MapError("Mapping of " + path + " must be word-aligned");
+
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) throw MapError("Can't open " + path);
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        throw MapError("Can't open " + path);
+    }
+    size = st.st_size;
+
+    if (get_end() > UINT64_C(0x100000000)) {
+        close(fd);
+        throw MapError(path + " doesn't fit in the address space at its address");
+    }
+
+    // An empty file can't be mapped, but it doesn't need to be either
+    if (size > 0) {
+        void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping == MAP_FAILED) {
+            close(fd);
+            throw MapError("Can't map " + path);
+        }
+        data = static_cast<const unsigned char*>(mapping);
+    }
+    close(fd);
+}
+
+MappedFile::~MappedFile() {
+    if (data) munmap(const_cast<unsigned char*>(data), size);
+}
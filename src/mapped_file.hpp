@@ -0,0 +1,69 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include "typedefs.hpp"
+
+/**
+ * A host file could not be mapped
+ */
+class MapError : public std::runtime_error {
+    public:
+        using std::runtime_error::runtime_error;
+};
+
+/**
+ * A host file mapped read-only into the guest's address space at `start`.
+ *
+ * The guest reads it straight from the host's page cache: the bytes of the file are in guest
+ * memory order, so a word is the next four bytes big-endian. Bytes past the end of the file
+ * (up to the end of its last word) read as 0.
+ */
+class MappedFile {
+    private:
+        const unsigned char* data = nullptr;
+        size_t size;
+        Address start;
+
+    public:
+        // Throws MapError if the file can't be mapped or doesn't fit in the address space
+        MappedFile(const std::string& path, Address start);
+        ~MappedFile();
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        Address get_start() const { return start; }
+        size_t get_size() const { return size; }
+        // One past the last guest address, rounded up to a whole word
+        uint64_t get_end() const { return start + ((static_cast<uint64_t>(size) + 3) & ~static_cast<uint64_t>(3)); }
+
+        bool contains(Address addr) const { return addr >= start && addr < get_end(); }
+
+        // Copy `length` bytes from `addr` on, which must all be contained in the file
+        void copy(Address addr, char* buffer, size_t length) const {
+            size_t offset = addr - start;
+            size_t available = offset < size ? std::min(length, size - offset) : 0;
+            if (available > 0) memcpy(buffer, data + offset, available);
+            memset(buffer + available, 0, length - available);
+        }
+
+        // The word at `word_address`, which must be word-aligned and contained in the file
+        inline Word read(Address word_address) const {
+            size_t offset = word_address - start;
+            if (offset + 4 <= size) {
+                uint32_t word;
+                memcpy(&word, data + offset, 4);
+                return __builtin_bswap32(word);
+            }
+            Word word = 0;
+            for (size_t i = 0; i < 4; i++) {
+                word = (word << 8) | (offset + i < size ? data[offset + i] : 0);
+            }
+            return word;
+        }
+};
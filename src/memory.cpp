@@ -4,24 +4,66 @@
 #include <algorithm>
 #include <sstream>
 
+#include <unistd.h>
+
 #include "opcodes.hpp"
 #include "typedefs.hpp"
 #include "memory.hpp"
-#include "exceptions.hpp"
+#include "cache_model.hpp"
 #include "show.hpp"
+#include "debug.hpp"
 
 using namespace std;
 
-// We pass in the vector by unique_ptr so that the memory object "owns" the vector.
-// That means that there can't be any other pointers to this vector and thus no one else
-// can modify it.
-Memory::Memory(
-        unique_ptr<vector<Word>> i_instruction_memory) :
-    instruction_memory(move(i_instruction_memory)),
-    data_memory(new vector<Word>()) {
-        assert (instruction_start+(instruction_memory->size()*4) <= data_start);
+namespace {
+
+// Blocks are copied to and from the host this many bytes at a time
+const size_t transfer_size = 64 * 1024;
+
+const Word failed = static_cast<Word>(-1);
+
+inline bool is_device(Address addr) {
+    return addr >= devices_start && addr < devices_end;
+}
+
+}
+
+// The image is immutable, so it can be shared with other Memory objects and threads.
+Memory::Memory(shared_ptr<const ProgramImage> i_image, Fault& fault_register) :
+    image(move(i_image)),
+    data_pages(image->get_data_pages()),
+    baseline(image->get_data_pages()),
+    dirty(data_page_count, false),
+    fault(fault_register) {
+        assert (instruction_start+(image->size()*4) <= data_start);
     }
 
+Memory::Memory(const Memory& other, Fault& fault_register) :
+    image(other.image),
+    data_pages(other.data_pages),
+    reserved(other.reserved),
+    reserved_address(other.reserved_address),
+    reserved_version(other.reserved_version),
+    baseline(other.baseline),
+    dirty(other.dirty),
+    dirty_pages(other.dirty_pages),
+    fault(fault_register),
+    input(other.input),
+    output(other.output),
+    input_buffer(other.input_buffer),
+    mailboxes(other.mailboxes),
+    input_position(other.input_position),
+    output_position(other.output_position),
+    input_start(other.input_start),
+    input_closed(other.input_closed),
+    program_break(other.program_break),
+    files(other.files),
+    mappings(other.mappings),
+    dma_address(other.dma_address),
+    dma_length(other.dma_length),
+    dma_descriptor(other.dma_descriptor),
+    dma_status(other.dma_status) {}
+
 /**
  * Check if and address is within instruction memory
  */
@@ -50,14 +92,135 @@ bool is_putc(Address addr) {
     return addr >= 0x30000004 && addr < 0x30000008;
 }
 
+bool is_mailbox(Address addr) {
+    return addr >= mailbox_start && addr < mailbox_start + mailbox_max_channels * mailbox_stride;
+}
+
+bool is_dma(Address addr) {
+    return addr >= dma_address_address && addr < dma_status_address + 4;
+}
+
+void Memory::set_page(size_t index, const Page& page) {
+    if (reserved && (reserved_address - data_start) / page_size == index) reserved = false;
+    write_page(index) = page;
+}
+
+/**
+ * Only the pages in the dirty list can differ from the baseline, so a reset costs as much as
+ * the pages the last run wrote to. They are overwritten in place, which keeps them allocated
+ * for the next run.
+ */
+void Memory::reset() {
+    for (uint32_t index : dirty_pages) {
+        const Page* original = baseline.read(index);
+        if (original) data_pages.write(index) = *original;
+        else          data_pages.write(index).fill(0);
+        dirty[index] = false;
+    }
+    dirty_pages.clear();
+
+    if (input_position > 0) {
+        if (input && input_start != std::streampos(-1)) {
+            input->clear();
+            input->seekg(input_start);
+            input_closed = input->fail();
+        } else {
+            input_closed = true;
+        }
+    }
+    input_position = 0;
+    output_position = 0;
+    reserved = false;
+    program_break = heap_start;
+    files.close_all();
+    dma_address = dma_length = dma_descriptor = dma_status = 0;
+}
+
+void Memory::set_baseline() {
+    baseline = data_pages;
+    for (uint32_t index : dirty_pages) dirty[index] = false;
+    dirty_pages.clear();
+}
+
+void Memory::set_io(std::istream* i_input, std::ostream* i_output) {
+    input = i_input;
+    output = i_output;
+    input_start = input ? input->tellg() : std::streampos(-1);
+    input_closed = false;
+}
+
+void Memory::skip_input(uint64_t count) {
+    for (; count > 0; count--) {
+        if (read_char() == EOF) break;
+        input_position++;
+    }
+}
+
+void Memory::set_shared(SharedMemory* memory, Word id, Word count) {
+    shared = memory;
+    hart_id = id;
+    hart_count = count;
+}
+
 void Memory::memwrite(Address addr, std::function<Word(Word current)> cb) {
     Address word_address = addr & (~0b11);
 
+    // Other harts may be writing to the rest of the word at the same time
+    if (shared && is_data(word_address)) {
+        shared->update((word_address - data_start) / 4, cb);
+        return;
+    }
+
     auto current = memread_word(word_address);
+    if (fault.raised()) return;
     write_word(word_address, cb(current));
 }
 
 
+Mailbox* Memory::mailbox_at(Address word_address) const {
+    if (!mailboxes || !is_mailbox(word_address)) return nullptr;
+    size_t channel = (word_address - mailbox_start) / mailbox_stride;
+    return channel < mailboxes->size() ? &(*mailboxes)[channel] : nullptr;
+}
+
+Mailbox* Memory::mailbox_end(Address word_address, bool send) const {
+    Mailbox* mailbox = mailbox_at(word_address);
+    if (!mailbox || (word_address - mailbox_start) % mailbox_stride != mailbox_data_offset) return nullptr;
+    size_t channel = (word_address - mailbox_start) / mailbox_stride;
+    return hart_id == (send ? channel : channel + 1) ? mailbox : nullptr;
+}
+
+bool Memory::mailbox_blocks(Address addr, bool store) const {
+    Mailbox* mailbox = mailbox_end(addr & (~0b11), store);
+    if (!mailbox) return false;
+    return store ? mailbox->space() == 0 : mailbox->count() == 0;
+}
+
+const MappedFile* Memory::mapping_at(Address addr) const {
+    for (auto& mapping : mappings) {
+        if (mapping->contains(addr)) return mapping.get();
+    }
+    return nullptr;
+}
+
+bool Memory::add_mapping(shared_ptr<const MappedFile> mapping) {
+    uint64_t start = mapping->get_start();
+    uint64_t end = mapping->get_end();
+    auto overlaps = [&] (uint64_t first, uint64_t last) { return start < last && first < end; };
+
+    if (mappings.size() >= max_mappings
+            || overlaps(instruction_start, instruction_start + instruction_size)
+            || overlaps(data_start, static_cast<uint64_t>(data_start) + data_size)
+            || overlaps(devices_start, devices_end)) {
+        return false;
+    }
+    for (auto& other : mappings) {
+        if (overlaps(other->get_start(), other->get_end())) return false;
+    }
+    mappings.push_back(std::move(mapping));
+    return true;
+}
+
 /**
  * Read the word in which an address is contained
  **/
@@ -66,58 +229,102 @@ Word Memory::memread_word(Address addr) const {
 
     if (is_instruction(word_address)) {
         unsigned int inst_index = (word_address - instruction_start) / 4;
-        if (inst_index >= instruction_memory->size()) {
+        if (inst_index >= image->size()) {
             return 0;
         } else {
-            return instruction_memory->at(inst_index);
+            return image->get_words()[inst_index];
         }
     } else if (is_data(word_address)) {
         unsigned int data_index = (word_address - data_start) / 4;
-        if (data_index >= data_memory->size()) {
-            return 0;
-        } else {
-            return data_memory->at(data_index);
-        }
+        if (shared) return shared->read(data_index);
+        const Page* page = data_pages.read(data_index / page_words);
+        return page ? (*page)[data_index % page_words] : 0;
 
+    } else if (word_address == hart_id_address) {
+        return hart_id;
+    } else if (word_address == hart_count_address) {
+        return hart_count;
     } else if (is_putc(word_address)) {
         return 0;
     } else if (is_getc(word_address)) {
         return 0;
+    } else if (is_dma(word_address)) {
+        switch (word_address) {
+            case dma_address_address:    return dma_address;
+            case dma_length_address:     return dma_length;
+            case dma_descriptor_address: return dma_descriptor;
+            case dma_status_address:     return dma_status;
+            default:                     return 0;
+        }
+    } else if (word_address >= mapping_size_start && word_address < mapping_size_start + 4 * mappings.size()) {
+        return mappings[(word_address - mapping_size_start) / 4]->get_size();
+    } else if (Mailbox* mailbox = mailbox_at(word_address)) {
+        switch ((word_address - mailbox_start) % mailbox_stride) {
+            // Like putc, so that partial stores to it send a word
+            case mailbox_data_offset:  return 0;
+            case mailbox_count_offset: return mailbox->count();
+            case mailbox_space_offset: return mailbox->space();
+        }
+        fault.raise(FaultReason::OUT_OF_BOUNDS, word_address);
+        return 0;
+    } else if (const MappedFile* mapping = mapping_at(word_address)) {
+        return mapping->read(word_address);
     } else {
-        throw MemoryError("Address " + show(as_hex(word_address)) + " is out of bounds");
+        fault.raise(FaultReason::OUT_OF_BOUNDS, word_address);
+        return 0;
     }
-    
+
 }
 
 /**
  * Get a word (4 bytes) from memory.
  *
- * Throws invalid_argument if the address is not word-aligned (i.e. it refers to a byte)
+ * Faults if the address is not word-aligned (i.e. it refers to a byte)
  * or if it is out of bounds of the instruction and data memories.
  */
 Word Memory::get_word(Address addr) const {
     DEBUG_PRINT("Reading word " << show(as_hex(addr)));
-    if (addr % 4 != 0) 
-        throw MemoryError("Word access must be word-aligned");
-
-    if (is_putc(addr)) 
-        throw MemoryError("Can't read from putc address");
-    
-    if (is_getc(addr))
-        return getchar();
-    
+    if (addr % 4 != 0) {
+        fault.raise(FaultReason::UNALIGNED_WORD, addr);
+        return 0;
+    }
+
+    // Halfwords and bytes are read through here too
+    if (caches && !is_device(addr)) caches->data(addr, false);
+
+    if (is_putc(addr)) {
+        fault.raise(FaultReason::READ_PUTC, addr);
+        return 0;
+    }
+
+    if (is_getc(addr)) {
+        int c = read_char();
+        if (c != EOF) input_position++;
+        return c;
+    }
+
+    // The CPU waits until there is a word before it loads from the data register
+    Mailbox* mailbox = mailbox_at(addr);
+    if (mailbox && (addr - mailbox_start) % mailbox_stride == mailbox_data_offset) {
+        Word value = 0;
+        if (!mailbox_end(addr, false)) fault.raise(FaultReason::OUT_OF_BOUNDS, addr);
+        else                           mailbox->try_receive(value);
+        return value;
+    }
+
     return memread_word(addr);
 }
 
 /**
  * Get a halfword from memory.
  *
- * Throws invalid_argument if the address is out of bounds of the instruction and data memories.
+ * Faults if the address is out of bounds of the instruction and data memories.
  */
 Halfword Memory::get_halfword(Address addr) const {
     DEBUG_PRINT("Reading halfword " + show(as_hex(addr)));
     if((addr % 2) != 0) {
-        throw MemoryError("Address not naturally-aligned");
+        fault.raise(FaultReason::UNALIGNED_HALFWORD_READ, addr);
+        return 0;
     }
     // Gets the word to which the halfword belongs
     // by bitmasking the low 2 bits
@@ -139,7 +346,7 @@ Halfword Memory::get_halfword(Address addr) const {
 /**
  * Get a byte from memory.
  *
- * Throws invalid_argument if the address is out of bounds of the instruction and data memories.
+ * Faults if the address is out of bounds of the instruction and data memories.
  */
 Byte Memory::get_byte(Address addr) const {
     DEBUG_PRINT("Reading byte " + show(as_hex(addr)));
@@ -160,38 +367,73 @@ Byte Memory::get_byte(Address addr) const {
 /**
  * Write a word to memory
  *
- * Throws invalid_argument if the address is out of bounds of the instruction and data memories.
+ * Faults if the address is out of bounds of the instruction and data memories.
  */
 void Memory::write_word(Address addr, Word value) {
     DEBUG_PRINT("mem(" << show(as_hex(addr)) << ") = " << show(value))
-    if (addr % 4 != 0) throw MemoryError("Word access must be word-aligned");
+    if (addr % 4 != 0) {
+        fault.raise(FaultReason::UNALIGNED_WORD, addr);
+        return;
+    }
+
+    // Halfwords and bytes are written through here too, after reading the word with memread_word
+    if (caches && !is_device(addr)) caches->data(addr, true);
 
     if (is_instruction(addr)) {
-        throw MemoryError("Instruction memory is read-only");
+        fault.raise(FaultReason::WRITE_INSTRUCTION, addr);
     } else if (is_data(addr)) {
         unsigned int data_index = (addr - data_start) / 4;
 
-        if (data_index >= data_memory->size()) {
-            data_memory->resize(data_memory->size() + data_index + 100, 0);
+        if (shared) {
+            shared->write(data_index, value);
+        } else {
+            if (addr == reserved_address) reserved = false;
+            write_page(data_index / page_words)[data_index % page_words] = value;
         }
-        data_memory->at(data_index) = value;
 
     } else if (is_putc(addr)) {
-        cout << static_cast<char>(value & 0xFF);
+        (output ? *output : cout) << static_cast<char>(value & 0xFF);
+        output_position++;
     } else if (is_getc(addr)) {
-        throw MemoryError("Can't write to getc address");
+        fault.raise(FaultReason::WRITE_GETC, addr);
+    } else if (addr == hart_id_address || addr == hart_count_address) {
+        fault.raise(FaultReason::WRITE_READ_ONLY, addr);
+    } else if (is_dma(addr)) {
+        switch (addr) {
+            case dma_address_address:    dma_address = value; break;
+            case dma_length_address:     dma_length = value; break;
+            case dma_descriptor_address: dma_descriptor = value; break;
+            case dma_command_address:    dma_command(value); break;
+            default:                     fault.raise(FaultReason::WRITE_READ_ONLY, addr); break;
+        }
+    } else if ((addr >= mapping_size_start && addr < mapping_size_start + 4 * mappings.size()) || mapping_at(addr)) {
+        fault.raise(FaultReason::WRITE_READ_ONLY, addr);
+    } else if (Mailbox* mailbox = mailbox_at(addr)) {
+        // Likewise, it waits until there is room before it stores to the data register
+        switch ((addr - mailbox_start) % mailbox_stride) {
+            case mailbox_data_offset:
+                if (mailbox_end(addr, true)) mailbox->try_send(value);
+                else                         fault.raise(FaultReason::OUT_OF_BOUNDS, addr);
+                break;
+            case mailbox_count_offset:
+            case mailbox_space_offset: fault.raise(FaultReason::WRITE_READ_ONLY, addr); break;
+            default:                   fault.raise(FaultReason::OUT_OF_BOUNDS, addr); break;
+        }
     } else {
-        throw MemoryError("Address " + show(as_hex(addr)) + " is out of bounds");
+        fault.raise(FaultReason::OUT_OF_BOUNDS, addr);
     }
 }
 
 /**
  * Write a word to memory
  *
- * Throws invalid_argument if the address is out of bounds of the instruction and data memories.
+ * Faults if the address is out of bounds of the instruction and data memories.
  */
 void Memory::write_halfword(Address addr, Halfword value) {
-    if (addr % 2 != 0) throw MemoryError("Halfword access must be halfword-aligned"); 
+    if (addr % 2 != 0) {
+        fault.raise(FaultReason::UNALIGNED_HALFWORD_WRITE, addr);
+        return;
+    }
 
     memwrite(addr, [&addr, &value] (Word current) {
          return (addr % 4 == 0)
@@ -204,7 +446,7 @@ void Memory::write_halfword(Address addr, Halfword value) {
 /**
  * Write a word to memory
  *
- * Throws invalid_argument if the address is out of bounds of the instruction and data memories.
+ * Faults if the address is out of bounds of the instruction and data memories.
  */
 void Memory::write_byte(Address addr, Byte value) {
     memwrite(addr, [&addr, &value] (Word current) {
@@ -217,4 +459,280 @@ void Memory::write_byte(Address addr, Byte value) {
         }
         return result;
     });
-}
\ No newline at end of file
+}
+
+/**
+ * Only data memory can be reserved: LL anywhere else is a plain load, and the SC after it
+ * fails.
+ */
+Word Memory::load_linked(Address addr) {
+    Word value = get_word(addr);
+    reserved = !fault.raised() && is_data(addr);
+    reserved_address = addr;
+    // Read again together with the word's version, which is what SC checks
+    if (reserved && shared) value = shared->load_linked((addr - data_start) / 4, reserved_version);
+    return value;
+}
+
+/**
+ * Like hardware, any store to the word in between makes SC fail, even one of the value LL
+ * read. Shared memory checks the word's version with a compare-and-swap; private memory
+ * has dropped the reservation on the store.
+ */
+bool Memory::store_conditional(Address addr, Word value) {
+    if (addr % 4 != 0) {
+        fault.raise(FaultReason::UNALIGNED_WORD, addr);
+        return false;
+    }
+
+    bool matches = reserved && addr == reserved_address;
+    reserved = false;
+    if (!matches) return false;
+
+    if (shared) return shared->store_conditional((addr - data_start) / 4, reserved_version, value);
+
+    write_word(addr, value);
+    return true;
+}
+
+void Memory::sync() {
+    if (shared) atomic_thread_fence(memory_order_seq_cst);
+}
+
+bool Memory::readable_block(Address addr, size_t length) const {
+    if (length == 0) return true;
+    uint64_t end = static_cast<uint64_t>(addr) + length;
+    if (is_data(addr)) return end <= data_start + data_size;
+    if (is_instruction(addr)) return end <= instruction_start + instruction_size;
+    const MappedFile* mapping = mapping_at(addr);
+    return mapping && end <= mapping->get_end();
+}
+
+bool Memory::writable_block(Address addr, size_t length) const {
+    return length == 0 || (is_data(addr) && static_cast<uint64_t>(addr) + length <= data_start + data_size);
+}
+
+bool Memory::check_block(Address addr, size_t length, bool write) const {
+    if (length == 0) return true;
+    if (write && is_instruction(addr)) {
+        fault.raise(FaultReason::WRITE_INSTRUCTION, addr);
+        return false;
+    }
+    if (write && mapping_at(addr)) {
+        fault.raise(FaultReason::WRITE_READ_ONLY, addr);
+        return false;
+    }
+    bool valid = write ? writable_block(addr, length) : readable_block(addr, length);
+    if (!valid) {
+        fault.raise(FaultReason::OUT_OF_BOUNDS, addr);
+        return false;
+    }
+    return true;
+}
+
+bool Memory::read_block(Address addr, char* buffer, size_t length) const {
+    if (!check_block(addr, length, false)) return false;
+    bool in_data = is_data(addr);
+
+    // A file's bytes are already in guest order
+    if (const MappedFile* mapping = in_data ? nullptr : mapping_at(addr)) {
+        mapping->copy(addr, buffer, length);
+        return true;
+    }
+
+    for (size_t i = 0; i < length;) {
+        Address address = addr + i;
+        if (in_data && !shared) {
+            // Straight from the page, which is only looked up once
+            size_t page_index = (address - data_start) / page_size;
+            size_t offset = (address - data_start) % page_size;
+            size_t count = min(length - i, page_size - offset);
+            const Page* page = data_pages.read(page_index);
+            for (size_t byte = offset; byte < offset + count; byte++, i++) {
+                buffer[i] = page ? (*page)[byte / 4] >> (8 * (3 - byte % 4)) : 0;
+            }
+        } else {
+            Word word = memread_word(address);
+            for (unsigned int byte = address % 4; byte < 4 && i < length; byte++, i++) {
+                buffer[i] = word >> (8 * (3 - byte));
+            }
+        }
+    }
+    return true;
+}
+
+bool Memory::write_block(Address addr, const char* buffer, size_t length) {
+    if (!check_block(addr, length, true)) return false;
+
+    if (reserved && reserved_address + 4 > addr && reserved_address < addr + static_cast<uint64_t>(length)) {
+        reserved = false;
+    }
+
+    for (size_t i = 0; i < length;) {
+        Address address = addr + i;
+        if (!shared) {
+            size_t page_index = (address - data_start) / page_size;
+            size_t offset = (address - data_start) % page_size;
+            size_t count = min(length - i, page_size - offset);
+            Page& page = write_page(page_index);
+            for (size_t byte = offset; byte < offset + count; byte++, i++) {
+                int shift = 8 * (3 - byte % 4);
+                Word& word = page[byte / 4];
+                word = (word & ~(0xFFu << shift)) | (static_cast<Word>(static_cast<Byte>(buffer[i])) << shift);
+            }
+        } else {
+            // A word at a time, since other harts may be writing to the rest of it
+            Word bytes = 0;
+            Word mask = 0;
+            for (unsigned int byte = address % 4; byte < 4 && i < length; byte++, i++) {
+                int shift = 8 * (3 - byte);
+                bytes |= static_cast<Word>(static_cast<Byte>(buffer[i])) << shift;
+                mask |= 0xFFu << shift;
+            }
+            shared->update((address - data_start) / 4, [=] (Word current) { return (current & ~mask) | bytes; });
+        }
+    }
+    return true;
+}
+
+bool Memory::copy_block(Address destination, Address source, size_t length) {
+    if (!readable_block(source, length) || !writable_block(destination, length)) return false;
+    if (destination < source + static_cast<uint64_t>(length) && source < destination + static_cast<uint64_t>(length)) {
+        return false;
+    }
+
+    vector<char> buffer(min(length, transfer_size));
+    for (size_t done = 0; done < length; done += buffer.size()) {
+        size_t count = min(length - done, buffer.size());
+        read_block(source + done, buffer.data(), count);
+        write_block(destination + done, buffer.data(), count);
+    }
+    return true;
+}
+
+bool Memory::fill_block(Address destination, Word value, unsigned int width, size_t length) {
+    if (!writable_block(destination, length)) return false;
+
+    // A whole number of copies of the value, most significant byte first
+    vector<char> buffer(min(length, transfer_size));
+    for (size_t i = 0; i < buffer.size(); i++) {
+        buffer[i] = value >> (8 * (width - 1 - i % width));
+    }
+    for (size_t done = 0; done < length; done += buffer.size()) {
+        write_block(destination + done, buffer.data(), min(length - done, buffer.size()));
+    }
+    return true;
+}
+
+size_t Memory::read_input(char* buffer, size_t length) {
+    size_t count = 0;
+    if (input_closed) {
+        return 0;
+    } else if (input_buffer) {
+        // Whatever has arrived, but at least a character (the CPU waits for that)
+        while (count < length && (count == 0 || input_buffer->ready())) {
+            int c = input_buffer->get();
+            if (c == EOF) break;
+            buffer[count++] = c;
+        }
+    } else if (input) {
+        input->read(buffer, length);
+        count = input->gcount();
+    } else {
+        // Like read() from a terminal, so interactive programs get each line as it is typed
+        while (count < length) {
+            int c = getchar();
+            if (c == EOF) break;
+            buffer[count++] = c;
+            if (c == '\n') break;
+        }
+    }
+    input_position += count;
+    return count;
+}
+
+void Memory::write_output(const char* buffer, size_t length) {
+    (output ? *output : cout).write(buffer, length);
+    output_position += length;
+}
+
+Word Memory::sbrk(int32_t increment) {
+    int64_t new_break = static_cast<int64_t>(program_break) + increment;
+    if (new_break < heap_start || new_break > data_start + data_size) return static_cast<Word>(-1);
+    Address old_break = program_break;
+    program_break = new_break;
+    return old_break;
+}
+
+/**
+ * Reads go through the same input as getc, and read what there is: a line from stdin,
+ * whatever has arrived in an input buffer.
+ */
+Word Memory::read_from(Word descriptor, Address addr, size_t length) {
+    int host = -1;
+    if (descriptor != 0) {
+        host = files.host_descriptor(descriptor);
+        if (host < 0) return failed;
+    }
+    if (!writable_block(addr, length)) return failed;
+
+    vector<char> buffer(min(length, transfer_size));
+    size_t total = 0;
+    while (total < length) {
+        size_t wanted = min(length - total, transfer_size);
+        size_t count;
+        if (host < 0) {
+            count = read_input(buffer.data(), wanted);
+        } else {
+            ssize_t result = ::read(host, buffer.data(), wanted);
+            if (result < 0) return total > 0 ? total : failed;
+            count = result;
+        }
+        write_block(addr + total, buffer.data(), count);
+        total += count;
+        if (count < wanted) break;
+    }
+    return total;
+}
+
+Word Memory::write_to(Word descriptor, Address addr, size_t length) {
+    int host = -1;
+    if (descriptor == 0) return failed;
+    if (descriptor > 2) {
+        host = files.host_descriptor(descriptor);
+        if (host < 0) return failed;
+    }
+    if (!readable_block(addr, length)) return failed;
+
+    vector<char> buffer(min(length, transfer_size));
+    for (size_t total = 0; total < length;) {
+        size_t count = min(length - total, transfer_size);
+        read_block(addr + total, buffer.data(), count);
+        if (descriptor == 1) {
+            write_output(buffer.data(), count);
+        } else if (descriptor == 2) {
+            cerr.write(buffer.data(), count);
+        } else {
+            for (size_t written = 0; written < count;) {
+                ssize_t result = ::write(host, buffer.data() + written, count - written);
+                if (result < 0) return total + written > 0 ? total + written : failed;
+                written += result;
+            }
+        }
+        total += count;
+    }
+    return length;
+}
+
+void Memory::dma_command(Word command) {
+    switch (static_cast<DMACommand>(command)) {
+        case DMACommand::WRITE: dma_status = write_to(dma_descriptor, dma_address, dma_length); break;
+        case DMACommand::READ:  dma_status = read_from(dma_descriptor, dma_address, dma_length); break;
+        default:                dma_status = failed; break;
+    }
+}
+
+bool Memory::dma_reads_input(Address addr, Word value) const {
+    return (addr & ~0b11) == dma_command_address && value == static_cast<Word>(DMACommand::READ)
+        && dma_descriptor == 0;
+}
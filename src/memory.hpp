@@ -1,6 +1,7 @@
 #pragma once
 
 #include <iostream>
+#include <cstdio>
 #include <array>
 #include <vector>
 #include <exception>
@@ -9,6 +10,16 @@
 
 #include "opcodes.hpp"
 #include "typedefs.hpp"
+#include "fault.hpp"
+#include "page_table.hpp"
+#include "program_image.hpp"
+#include "input_buffer.hpp"
+#include "shared_memory.hpp"
+#include "mailbox.hpp"
+#include "host_files.hpp"
+#include "mapped_file.hpp"
+
+class CacheHierarchy;
 
 // Where each memory segment is located and how big it is.
 // Basically exactly as on the spec
@@ -17,31 +28,191 @@ const unsigned int instruction_size  =  0x1000000;
 const unsigned int data_start        = 0x20000000;
 const unsigned int data_size         =  0x4000000;
 
+// Data memory is allocated in pages, on the first write to each page
+const unsigned int data_page_count   = data_size / page_size;
+
+// Read-only words identifying the hart, for programs running on several harts
+const unsigned int hart_id_address    = 0x30000008;
+const unsigned int hart_count_address = 0x3000000C;
+
+// DMA device: a command copies `length` bytes between data memory at `address` and a descriptor
+// (see HostFiles), then sets status to the number of bytes copied, or -1 if it failed
+const unsigned int dma_address_address    = 0x30000010;
+const unsigned int dma_length_address     = 0x30000014;
+const unsigned int dma_descriptor_address = 0x30000018;
+const unsigned int dma_command_address    = 0x3000001C;  // Write-only
+const unsigned int dma_status_address     = 0x30000020;  // Read-only
+
+enum class DMACommand : Word {
+    WRITE = 1,  // Memory to descriptor
+    READ  = 2,  // Descriptor to memory
+};
+
+// The size of the i-th mapped file is at mapping_size_start + 4 * i (read-only)
+const unsigned int mapping_size_start = 0x30000100;
+const unsigned int max_mappings       = 16;
+// Addresses from here up are for devices, and files can't be mapped there
+const unsigned int devices_start = 0x30000000;
+const unsigned int devices_end   = 0x40000000;
+
+// Where the heap grown by the sbrk syscall starts
+const unsigned int heap_start = 0x22000000;
+
 bool is_instruction(Address addr);
 bool is_data(Address addr);
 bool is_putc(Address addr);
 bool is_getc(Address addr);
-
-// The actual memory storage.
-// The const marker in the beginning only refers to the unique_ptr. I.e. the address of the vector is const.
-// However, for the instruction memory the vector is marked const too. Therefore instruction memory can't be
+bool is_mailbox(Address addr);
+bool is_dma(Address addr);
 
 /**
  * Byte-addressable memory for the MIPS CPU. Contains separate instruction and data memory segments
  * 
- * Instruction memory is write-once (through the constructor) while data memory is read-write.
+ * Instruction memory is the words of an immutable ProgramImage, while data memory is read-write.
+ * Copies of a Memory share the image, and share data memory copy-on-write.
+ *
+ * Invalid accesses raise a fault in the fault register given to the constructor; reads that
+ * fault return 0 and writes that fault have no effect.
  */
 class Memory {
     private:
-        // written to.
-        const std::unique_ptr<const std::vector<Word>> instruction_memory;
-        const std::unique_ptr<std::vector<Word>> data_memory;
+        const std::shared_ptr<const ProgramImage> image;
+        // Pages that were never written read as 0
+        PageTable data_pages;
+        // If set, data memory is this instead of data_pages
+        SharedMemory* shared = nullptr;
+        Word hart_id = 0;
+        Word hart_count = 1;
+
+        // LL/SC reservation: the address LL read, and the version of the word LL read there if
+        // memory is shared (see SharedMemory). Private memory drops the reservation on any
+        // store to the word instead
+        bool reserved = false;
+        Address reserved_address = 0;
+        uint32_t reserved_version = 0;
+
+        // What reset() restores data memory to
+        PageTable baseline;
+        // Pages written since the last reset, as a bitmap and a list
+        std::vector<bool> dirty;
+        std::vector<uint32_t> dirty_pages;
+        Fault& fault;
+
+        // Where getc reads from and putc writes to. Null means stdin/stdout
+        std::istream* input = nullptr;
+        std::ostream* output = nullptr;
+        // If set, getc reads from this instead of `input`
+        InputBuffer* input_buffer = nullptr;
+        // The channels behind the mailbox registers. Null means there are none
+        Mailboxes* mailboxes = nullptr;
+        // Told about every load and store of the guest that isn't to a device, if set
+        CacheHierarchy* caches = nullptr;
+
+        // Number of characters read from getc and written to putc
+        mutable uint64_t input_position = 0;
+        uint64_t output_position = 0;
+        // Where `input` was when it was set, so that reset() can rewind it (-1 if it can't be)
+        std::streampos input_start = -1;
+        // Set by reset() when the input read so far can't be read again: getc then reads EOF
+        // until new input is set
+        bool input_closed = false;
+
+        // The end of the heap
+        Address program_break = heap_start;
+
+        HostFiles files;
+
+        // Host files mapped into the address space, in the order they were added
+        std::vector<std::shared_ptr<const MappedFile>> mappings;
+        const MappedFile* mapping_at(Address addr) const;
+
+        // DMA registers
+        Word dma_address = 0;
+        Word dma_length = 0;
+        Word dma_descriptor = 0;
+        Word dma_status = 0;
+        void dma_command(Word command);
+
+        int read_char() const {
+            if (input_closed) return EOF;
+            if (input_buffer) return input_buffer->get();
+            return input ? input->get() : getchar();
+        }
 
         void memwrite(Address, std::function<Word(Word current)>);
+        inline Page& write_page(size_t index) {
+            if (!dirty[index]) {
+                dirty[index] = true;
+                dirty_pages.push_back(index);
+            }
+            return data_pages.write(index);
+        }
         Word memread_word(Address) const;
+        // The channel whose registers `word_address` is in, or null if there is no such channel
+        Mailbox* mailbox_at(Address word_address) const;
+        // The channel whose data register `word_address` is, if this hart may send on it (hart c
+        // on channel c) or receive from it (hart c + 1), else null. Each end of a Mailbox must
+        // only ever be used by one thread
+        Mailbox* mailbox_end(Address word_address, bool send) const;
 
     public:
-        Memory(std::unique_ptr<std::vector<Word>> i_instruction_memory);
+        Memory(std::shared_ptr<const ProgramImage> image, Fault& fault_register);
+        // A copy of `other`, which raises its faults in `fault_register`. It keeps the data
+        // memory (copy-on-write), the I/O streams and positions, the DMA registers, the LL
+        // reservation, the open files and the mappings and mailboxes. It doesn't keep shared
+        // memory or the hart ID (a copy is a single hart), or the simulated caches
+        Memory(const Memory& other, Fault& fault_register);
+
+        const ProgramImage& get_image() const { return *image; }
+        const std::vector<Word>& get_instructions() const { return image->get_words(); }
+
+        // Data page `index` (counting from data_start), or null if it was never written
+        const Page* get_page(size_t index) const { return data_pages.read(index); }
+        const PageTable& get_pages() const { return data_pages; }
+        void set_page(size_t index, const Page& page);
+
+        // Restore the data pages written since the last reset (or set_baseline), the devices
+        // and the I/O positions. Instruction memory is never written so it is kept as it is.
+        // Input that has been read is read again if it came from a stream that can seek back to
+        // where it was set; otherwise (stdin, an input buffer) getc reads EOF until new input
+        // is set, rather than carrying on where the last run stopped
+        void reset();
+        // Make the current data memory what reset() restores
+        void set_baseline();
+        size_t get_dirty_page_count() const { return dirty_pages.size(); }
+
+        // Use `memory` as data memory, shared with other harts. Snapshots, reset() and copies
+        // only cover the private data pages, so they can't be used with shared memory.
+        void set_shared(SharedMemory* memory, Word id, Word count);
+
+        // LL: read a word and reserve its address
+        Word load_linked(Address);
+        // SC: write a word if the address is reserved and wasn't stored to since LL read it.
+        // Returns whether it was written
+        bool store_conditional(Address, Word);
+        // SYNC
+        void sync();
+
+        // Redirect getc and putc, e.g. to run several programs with their own I/O at once
+        void set_io(std::istream* i_input, std::ostream* i_output);
+        void set_input_buffer(InputBuffer* buffer) { input_buffer = buffer; input_closed = false; }
+        // True if reading getc now would have to wait for more input
+        bool input_pending() const { return input_buffer && !input_closed && !input_buffer->ready(); }
+
+        void set_mailboxes(Mailboxes* channels) { mailboxes = channels; }
+        // Simulate the caches of the loads and stores through get_*/write_* (not the block
+        // copies). Copies of this Memory don't
+        void set_caches(CacheHierarchy* hierarchy) { caches = hierarchy; }
+        bool has_mailboxes() const { return mailboxes; }
+        // True if a load from (or store to) `addr` would have to wait for its mailbox channel.
+        // False for a channel this hart may not use that way, so that the access faults
+        bool mailbox_blocks(Address addr, bool store) const;
+
+        uint64_t get_input_position() const { return input_position; }
+        uint64_t get_output_position() const { return output_position; }
+        void set_output_position(uint64_t position) { output_position = position; }
+        // Consume `count` characters of input, as if the guest had read them
+        void skip_input(uint64_t count);
 
         Word get_word(Address) const;
         void write_word(Address, Word);
@@ -52,4 +223,56 @@ class Memory {
         Halfword get_halfword(Address) const;
         void write_halfword(Address, Halfword);
 
+        // Copy `length` bytes between guest memory at `addr` and a host buffer, a page at a
+        // time. Reads can cover instruction and data memory, writes only data memory. If any
+        // of the range is outside of them nothing is copied, a fault is raised and false returned
+        bool check_block(Address addr, size_t length, bool write) const;
+        // The same checks without faulting: all of a range is within one of the memories or
+        // one mapping, or within data memory for writes
+        bool readable_block(Address addr, size_t length) const;
+        bool writable_block(Address addr, size_t length) const;
+        bool read_block(Address addr, char* buffer, size_t length) const;
+        bool write_block(Address addr, const char* buffer, size_t length);
+        // Copy `length` bytes within guest memory, or fill them with the low `width` bytes of
+        // `value` over and over. Returns false, having changed nothing, if any of either range is
+        // invalid (see readable_block/writable_block) or the ranges overlap
+        bool copy_block(Address destination, Address source, size_t length);
+        bool fill_block(Address destination, Word value, unsigned int width, size_t length);
+
+        // Read up to `length` characters of getc's input. Stops early at the end of the input,
+        // when an input buffer has run dry, or at the end of a line read from stdin.
+        // Returns the number of characters read
+        size_t read_input(char* buffer, size_t length);
+        // Write characters to putc's output
+        void write_output(const char* buffer, size_t length);
+
+        HostFiles& get_files() { return files; }
+        const HostFiles& get_files() const { return files; }
+
+        // Map a file into the address space. Returns false if there are too many mappings, or it
+        // would overlap instruction or data memory, the devices or another mapping
+        bool add_mapping(std::shared_ptr<const MappedFile> mapping);
+        // Copy `length` bytes from `descriptor` to data memory at `addr`, or from memory at `addr`
+        // to `descriptor`. Returns the number of bytes copied, or -1 if the descriptor or range is
+        // invalid (without faulting). Reads stop early like read() does
+        Word read_from(Word descriptor, Address addr, size_t length);
+        Word write_to(Word descriptor, Address addr, size_t length);
+        // True if storing `value` to `addr` starts a DMA read of getc's input
+        bool dma_reads_input(Address addr, Word value) const;
+
+        // The DMA registers: address, length, descriptor and status
+        std::array<Word, 4> get_dma_registers() const { return {{dma_address, dma_length, dma_descriptor, dma_status}}; }
+        void set_dma_registers(const std::array<Word, 4>& registers) {
+            dma_address = registers[0];
+            dma_length = registers[1];
+            dma_descriptor = registers[2];
+            dma_status = registers[3];
+        }
+
+        Address get_program_break() const { return program_break; }
+        void set_program_break(Address address) { program_break = address; }
+        // Grow (or shrink) the heap by `increment` bytes. Returns the old break, or -1 if the
+        // heap would end outside of data memory or before heap_start
+        Word sbrk(int32_t increment);
+
 };
@@ -37,6 +37,8 @@ string show(const IOpCode& code) {
         case IOpCode::XORI:  return "XORI";
         case IOpCode::ADDI:  return "ADDI";
         case IOpCode::ADDIU: return "ADDIU";
+        case IOpCode::LL:    return "LL";
+        case IOpCode::SC:    return "SC";
     }
 }
 
@@ -68,6 +70,8 @@ string show(const OpFunction& code) {
         case OpFunction::XOR: return "XOR";
         case OpFunction::OR: return "OR";
         case OpFunction::AND: return "AND";
+        case OpFunction::SYNC: return "SYNC";
+        case OpFunction::SYSCALL: return "SYSCALL";
     }
 }
 
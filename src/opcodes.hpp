@@ -45,6 +45,10 @@ enum class IOpCode {
     // Arithmetic
     ADDI,    //   Add immediate (with overflow) [..] 0b001000 or 8
     ADDIU,   //   Add immediate unsigned (no overflow) [..] 0b001001 or 9
+
+    // Atomics
+    LL,      //   Load linked [..] 0b110000 or 48
+    SC,      //   Store conditional [..] 0b111000 or 56
 };
 
 enum class REGIMMCode {
@@ -90,6 +94,12 @@ enum class OpFunction {
     XOR,     //   Bitwise exclusive or [..] Func 0b100110 or 38
     OR,      //   Bitwise or [..] Func 0b100101 or 37
     AND,     //   Bitwise and [..] Func 0b100100 or 36
+
+    // Memory ordering
+    SYNC,    //   Complete all loads and stores before any that follow [..] Func 0b001111 or 15
+
+    // Host services
+    SYSCALL, //   Call the service numbered $v0 (see syscalls.hpp) [..] Func 0b001100 or 12
 };
 
 enum class SpecialOpcode {
@@ -133,6 +143,23 @@ struct Special_Instruction {
     SpecialOpcode opcode;
 };
 
+// Structural equality, used to compare the output of different decoders
+inline bool operator==(const R_Instruction& a, const R_Instruction& b) {
+    return a.function == b.function && a.dest == b.dest && a.src1 == b.src1 && a.src2 == b.src2 && a.shift == b.shift;
+}
+inline bool operator==(const I_Instruction& a, const I_Instruction& b) {
+    return a.opcode == b.opcode && a.dest == b.dest && a.src == b.src && a.immediate == b.immediate;
+}
+inline bool operator==(const REGIMM_Instruction& a, const REGIMM_Instruction& b) {
+    return a.code == b.code && a.src == b.src && a.offset == b.offset;
+}
+inline bool operator==(const J_Instruction& a, const J_Instruction& b) {
+    return a.opcode == b.opcode && a.address == b.address;
+}
+inline bool operator==(const Special_Instruction& a, const Special_Instruction& b) {
+    return a.opcode == b.opcode;
+}
+
 typedef mapbox::util::variant<R_Instruction, I_Instruction, J_Instruction, REGIMM_Instruction, Special_Instruction> Instruction;
 
 template<> std::string show(const JOpCode&            );
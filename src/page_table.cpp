@@ -0,0 +1,114 @@
+#include <vector>
+
+#include "page_table.hpp"
+
+using namespace std;
+
+const size_t PageTable::node_pages;
+
+PageTable::PageTable(size_t i_page_count) :
+    page_count(i_page_count),
+    nodes((i_page_count + node_pages - 1) / node_pages, nullptr) {}
+
+PageTable::PageTable(const PageTable& other) :
+    page_count(other.page_count),
+    nodes(other.nodes) {
+        for (Node* node : nodes) {
+            if (node) node->references.fetch_add(1, memory_order_relaxed);
+        }
+    }
+
+PageTable& PageTable::operator=(const PageTable& other) {
+    if (this == &other) return *this;
+
+    for (Node* node : other.nodes) {
+        if (node) node->references.fetch_add(1, memory_order_relaxed);
+    }
+    for (Node* node : nodes) release(node);
+    page_count = other.page_count;
+    nodes = other.nodes;
+
+    return *this;
+}
+
+PageTable::~PageTable() {
+    for (Node* node : nodes) release(node);
+}
+
+void PageTable::release(SharedPage* page) {
+    if (page && page->references.fetch_sub(1, memory_order_acq_rel) == 1) {
+        delete page;
+    }
+}
+
+void PageTable::release(Node* node) {
+    if (node && node->references.fetch_sub(1, memory_order_acq_rel) == 1) {
+        for (SharedPage* page : node->pages) release(page);
+        delete node;
+    }
+}
+
+bool PageTable::unique(const SharedPage* page) {
+    return page->references.load(memory_order_acquire) == 1;
+}
+
+bool PageTable::unique(const Node* node) {
+    return node->references.load(memory_order_acquire) == 1;
+}
+
+/**
+ * Give page `index` (and the node it is in) to this table alone: allocate it if it was never
+ * written, or copy it if it is shared with another table.
+ */
+Page& PageTable::make_writable(size_t index) {
+    Node*& node = nodes[index / node_pages];
+
+    if (node == nullptr || !unique(node)) {
+        Node* new_node = new Node();
+        new_node->references.store(1, memory_order_relaxed);
+        if (node) {
+            new_node->pages = node->pages;
+            for (SharedPage* page : new_node->pages) {
+                if (page) page->references.fetch_add(1, memory_order_relaxed);
+            }
+        } else {
+            new_node->pages.fill(nullptr);
+        }
+        release(node);
+        node = new_node;
+    }
+
+    SharedPage*& page = node->pages[index % node_pages];
+    if (page == nullptr || !unique(page)) {
+        SharedPage* new_page = new SharedPage();
+        new_page->references.store(1, memory_order_relaxed);
+        if (page) new_page->words = page->words;
+        else      new_page->words.fill(0);
+        release(page);
+        page = new_page;
+    }
+
+    return page->words;
+}
+
+size_t PageTable::allocated_pages() const {
+    size_t count = 0;
+    for (const Node* node : nodes) {
+        if (node == nullptr) continue;
+        for (const SharedPage* page : node->pages) {
+            if (page) count++;
+        }
+    }
+    return count;
+}
+
+size_t PageTable::shared_pages() const {
+    size_t count = 0;
+    for (const Node* node : nodes) {
+        if (node == nullptr) continue;
+        for (const SharedPage* page : node->pages) {
+            if (page && (!unique(node) || !unique(page))) count++;
+        }
+    }
+    return count;
+}
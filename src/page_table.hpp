@@ -0,0 +1,77 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+#include "typedefs.hpp"
+
+const unsigned int page_size  = 0x1000;
+const unsigned int page_words = page_size / 4;
+
+using Page = std::array<Word, page_words>;
+
+/**
+ * A fixed number of pages, allocated on the first write to each page.
+ *
+ * Copying a page table is cheap: the copy shares everything with the original, and only what
+ * one of them writes to afterwards is copied (copy-on-write). The table has two levels, pages
+ * and nodes of node_pages pages, which are both shared and reference counted, so a copy costs
+ * one pointer per node rather than one per page, and copies can be used and destroyed on
+ * different threads.
+ */
+class PageTable {
+    public:
+        static const size_t node_pages = 128;
+
+    private:
+        struct SharedPage {
+            std::atomic<unsigned int> references;
+            Page words;
+        };
+
+        struct Node {
+            std::atomic<unsigned int> references;
+            std::array<SharedPage*, node_pages> pages;
+        };
+
+        size_t page_count;
+        std::vector<Node*> nodes;
+
+        static void release(SharedPage* page);
+        static void release(Node* node);
+        static bool unique(const SharedPage* page);
+        static bool unique(const Node* node);
+        Page& make_writable(size_t index);
+
+    public:
+        explicit PageTable(size_t page_count);
+        PageTable(const PageTable& other);
+        PageTable& operator=(const PageTable& other);
+        ~PageTable();
+
+        size_t size() const { return page_count; }
+
+        // Page `index`, or null if it was never written
+        inline const Page* read(size_t index) const {
+            const Node* node = nodes[index / node_pages];
+            if (node == nullptr) return nullptr;
+            const SharedPage* page = node->pages[index % node_pages];
+            return page ? &page->words : nullptr;
+        }
+
+        // Page `index`, allocated or unshared first if needed
+        inline Page& write(size_t index) {
+            Node* node = nodes[index / node_pages];
+            if (node != nullptr && unique(node)) {
+                SharedPage* page = node->pages[index % node_pages];
+                if (page != nullptr && unique(page)) return page->words;
+            }
+            return make_writable(index);
+        }
+
+        // Number of allocated pages, and how many of them are shared with another table
+        size_t allocated_pages() const;
+        size_t shared_pages() const;
+};
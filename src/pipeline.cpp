@@ -0,0 +1,109 @@
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "pipeline.hpp"
+#include "cpu.hpp"
+#include "mailbox.hpp"
+#include "show.hpp"
+
+using namespace std;
+
+namespace {
+
+// How many instructions a stage runs between checks whether the pipeline has stopped
+const uint64_t stage_slice = 1 << 16;
+
+// A waiting stage yields this many times before it starts sleeping between polls
+const unsigned int wait_spins = 64;
+const chrono::microseconds wait_sleep(50);
+
+// Stages waiting for this long with no words moving at all are deadlocked: the ones that
+// could go ahead would have done so many polls ago
+const chrono::milliseconds deadlock_timeout(200);
+
+}
+
+int run_pipeline(const vector<shared_ptr<const ProgramImage>>& stages, const PipelineOptions& options) {
+    Mailboxes mailboxes(stages.size(), options.capacity);
+
+    vector<unique_ptr<CPU>> cpus;
+    for (size_t id = 0; id < stages.size(); id++) {
+        cpus.emplace_back(new CPU(stages[id]));
+        cpus.back()->set_hart(nullptr, id, stages.size());
+        cpus.back()->set_mailboxes(&mailboxes);
+        cpus.back()->set_fusion(options.fusion);
+        cpus.back()->set_max_instructions(options.max_instructions);
+    }
+
+    atomic<bool> stopped(false);
+    // Stages that haven't exited, and how many of them are waiting for a mailbox
+    atomic<size_t> running(stages.size());
+    atomic<size_t> waiting(0);
+    mutex stop_mutex;
+    int exit_code = 0;
+
+    auto stop = [&] (size_t id) {
+        lock_guard<mutex> lock(stop_mutex);
+        if (stopped.load()) return;
+        const CPU& cpu = *cpus[id];
+        exit_code = cpu.get_exit_code();
+        if (cpu.get_fault().raised()) cerr << "stage " << id << ": " << show(cpu.get_fault()) << endl;
+        if (options.fault) *options.fault = cpu.get_fault();
+        stopped.store(true);
+    };
+
+    auto run_stage = [&] (size_t id) {
+        CPU& cpu = *cpus[id];
+        while (!stopped.load(memory_order_relaxed)) {
+            RunStatus status = cpu.step(stage_slice);
+
+            if (status == RunStatus::WAITING_FOR_MAILBOX) {
+                waiting++;
+                size_t transfers = mailboxes.transfers();
+                auto last_transfer = chrono::steady_clock::now();
+
+                for (unsigned int spins = 0; status == RunStatus::WAITING_FOR_MAILBOX && !stopped.load(memory_order_relaxed); spins++) {
+                    if (spins < wait_spins) this_thread::yield();
+                    else                    this_thread::sleep_for(wait_sleep);
+
+                    if (mailboxes.transfers() != transfers) {
+                        transfers = mailboxes.transfers();
+                        last_transfer = chrono::steady_clock::now();
+                    } else if (waiting.load() == running.load()
+                            && chrono::steady_clock::now() - last_transfer > deadlock_timeout) {
+                        cpu.raise_fault(FaultReason::DEADLOCK, cpu.get_pc());
+                        break;
+                    }
+                    status = cpu.step(stage_slice);
+                }
+                waiting--;
+                if (cpu.get_fault().raised()) status = RunStatus::EXITED;
+            }
+
+            if (status != RunStatus::EXITED) continue;
+
+            running--;
+            if (id + 1 == stages.size() || cpu.get_fault().raised()) stop(id);
+            return;
+        }
+    };
+
+    vector<thread> threads;
+    for (size_t id = 0; id < stages.size(); id++) threads.emplace_back(run_stage, id);
+    for (auto& t : threads) t.join();
+
+    if (options.stats) {
+        for (size_t id = 0; id < stages.size(); id++) {
+            cerr << "stage " << id << ":" << endl;
+            cpus[id]->print_stats(cerr);
+        }
+    }
+
+    cout << flush;
+    return exit_code;
+}
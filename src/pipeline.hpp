@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "fault.hpp"
+#include "program_image.hpp"
+
+struct PipelineOptions {
+    // Words each mailbox channel holds before a sender has to wait
+    size_t capacity = 1024;
+    bool fusion = true;
+    // Per stage
+    uint64_t max_instructions = UINT64_MAX;
+    bool stats = false;
+    // If set, this is set to the fault of the stage that stopped the pipeline, if it faulted
+    Fault* fault = nullptr;
+};
+
+/**
+ * Run a pipeline of programs talking through the mailbox device, each stage a CPU on its own
+ * thread with its own memory.
+ *
+ * There is one channel per stage; by convention stage i sends on channel i and receives on
+ * channel i-1. A stage reads its index from hart_id_address and the number of stages from
+ * hart_count_address. All stages share stdin and stdout.
+ *
+ * The pipeline stops when the last stage exits or any stage faults, and returns that stage's
+ * exit code. If every stage that is still running waits for a mailbox that can never be
+ * ready, the waiting stage that notices faults with a deadlock.
+ */
+int run_pipeline(const std::vector<std::shared_ptr<const ProgramImage>>& stages, const PipelineOptions& options);
@@ -0,0 +1,200 @@
+#include <vector>
+
+#include "predecoder.hpp"
+#include "decoder.hpp"
+#include "opcodes.hpp"
+
+using namespace std;
+
+namespace {
+
+bool is_load(IOpCode opcode) {
+    switch (opcode) {
+        case IOpCode::LB: case IOpCode::LBU:
+        case IOpCode::LH: case IOpCode::LHU:
+        case IOpCode::LW:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool is_slt(const Instruction& inst) {
+    if (inst.is<R_Instruction>()) {
+        OpFunction f = inst.get_unchecked<R_Instruction>().function;
+        return f == OpFunction::SLT || f == OpFunction::SLTU;
+    }
+    if (inst.is<I_Instruction>()) {
+        IOpCode op = inst.get_unchecked<I_Instruction>().opcode;
+        return op == IOpCode::SLTI || op == IOpCode::SLTIU;
+    }
+    return false;
+}
+
+RegisterId slt_dest(const Instruction& inst) {
+    return inst.is<R_Instruction>()
+        ? inst.get_unchecked<R_Instruction>().dest
+        : inst.get_unchecked<I_Instruction>().dest;
+}
+
+/**
+ * Check if an instruction only computes a register from other registers, i.e. it can't
+ * branch, touch memory or HI/LO.
+ */
+bool is_alu(const Instruction& inst, RegisterId& src1, RegisterId& src2) {
+    if (inst.is<R_Instruction>()) {
+        const R_Instruction& r = inst.get_unchecked<R_Instruction>();
+        switch (r.function) {
+            case OpFunction::SLL:  case OpFunction::SLLV:
+            case OpFunction::SRA:  case OpFunction::SRAV:
+            case OpFunction::SRL:  case OpFunction::SRLV:
+            case OpFunction::SLT:  case OpFunction::SLTU:
+            case OpFunction::ADD:  case OpFunction::ADDU:
+            case OpFunction::SUB:  case OpFunction::SUBU:
+            case OpFunction::XOR:  case OpFunction::OR:
+            case OpFunction::AND:
+                src1 = r.src1;
+                src2 = r.src2;
+                return true;
+            default:
+                return false;
+        }
+    }
+    if (inst.is<I_Instruction>()) {
+        const I_Instruction& i = inst.get_unchecked<I_Instruction>();
+        switch (i.opcode) {
+            case IOpCode::ORI:  case IOpCode::ANDI:
+            case IOpCode::XORI: case IOpCode::SLTI:
+            case IOpCode::SLTIU:
+            case IOpCode::ADDI: case IOpCode::ADDIU:
+                src1 = i.src;
+                src2 = i.src;
+                return true;
+            default:
+                return false;
+        }
+    }
+    return false;
+}
+
+bool reads_memory(const Instruction& inst) {
+    if (!inst.is<I_Instruction>()) return false;
+    IOpCode opcode = inst.get_unchecked<I_Instruction>().opcode;
+    return is_load(opcode) || opcode == IOpCode::LWL || opcode == IOpCode::LWR || opcode == IOpCode::LL;
+}
+
+bool is_syscall(const Instruction& inst) {
+    return inst.is<R_Instruction>() && inst.get_unchecked<R_Instruction>().function == OpFunction::SYSCALL;
+}
+
+bool writes_memory(const Instruction& inst) {
+    if (!inst.is<I_Instruction>()) return false;
+    IOpCode opcode = inst.get_unchecked<I_Instruction>().opcode;
+    return opcode == IOpCode::SB || opcode == IOpCode::SH || opcode == IOpCode::SW || opcode == IOpCode::SC;
+}
+
+/**
+ * Check if an instruction at `address` is a branch or jump (without link) to `address`
+ */
+bool jumps_to_itself(const Instruction& inst, Address address) {
+    if (inst.is<I_Instruction>()) {
+        const I_Instruction& i = inst.get_unchecked<I_Instruction>();
+        switch (i.opcode) {
+            case IOpCode::BEQ: case IOpCode::BNE:
+            case IOpCode::BGTZ: case IOpCode::BLEZ:
+                return i.immediate == -1;
+            default:
+                return false;
+        }
+    }
+    if (inst.is<REGIMM_Instruction>()) {
+        const REGIMM_Instruction& r = inst.get_unchecked<REGIMM_Instruction>();
+        return (r.code == REGIMMCode::BGEZ || r.code == REGIMMCode::BLTZ) && r.offset == -1;
+    }
+    if (inst.is<J_Instruction>()) {
+        const J_Instruction& j = inst.get_unchecked<J_Instruction>();
+        Address target = ((address + 4) & 0xF0000000) | (j.address << 2);
+        return j.opcode == JOpCode::J && target == address;
+    }
+    return false;
+}
+
+Fusion find_fusion(const PredecodedInstruction& first, const PredecodedInstruction& second) {
+    if (!first.valid || !second.valid) return Fusion::NONE;
+    const Instruction& a = first.instruction;
+    const Instruction& b = second.instruction;
+
+    if (a.is<I_Instruction>() && b.is<I_Instruction>()) {
+        const I_Instruction& lui = a.get_unchecked<I_Instruction>();
+        const I_Instruction& ori = b.get_unchecked<I_Instruction>();
+        if (lui.opcode == IOpCode::LUI && ori.opcode == IOpCode::ORI && ori.src == lui.dest) {
+            return Fusion::LUI_ORI;
+        }
+    }
+
+    if (is_slt(a) && b.is<I_Instruction>()) {
+        const I_Instruction& branch = b.get_unchecked<I_Instruction>();
+        RegisterId dest = slt_dest(a);
+        if ((branch.opcode == IOpCode::BEQ || branch.opcode == IOpCode::BNE)
+                && dest.value != 0
+                && (branch.src == dest || branch.dest == dest)) {
+            return Fusion::SLT_BRANCH;
+        }
+    }
+
+    if (a.is<I_Instruction>() && is_load(a.get_unchecked<I_Instruction>().opcode)) {
+        RegisterId loaded = a.get_unchecked<I_Instruction>().dest;
+        RegisterId src1, src2;
+        if (loaded.value != 0 && is_alu(b, src1, src2) && (src1 == loaded || src2 == loaded)) {
+            return Fusion::LOAD_ALU;
+        }
+    }
+
+    return Fusion::NONE;
+}
+
+}
+
+/**
+ * Decode every word of instruction memory (loaded at `start`), mark the pairs that can be
+ * fused and the branches to themselves.
+ *
+ * Only the static shape of a pair is checked here; whether the second instruction actually
+ * follows the first (i.e. the first is not in a branch delay slot) is checked on execution.
+ */
+vector<PredecodedInstruction> predecode(const vector<Word>& words, Address start) {
+    vector<PredecodedInstruction> program;
+    program.reserve(words.size());
+
+    for (Word word : words) {
+        PredecodedInstruction slot { word, false, Fusion::NONE, false, false, false, Instruction() };
+        slot.valid = try_decode(word, slot.instruction);
+        slot.load = slot.valid && (reads_memory(slot.instruction) || is_syscall(slot.instruction));
+        slot.store = slot.valid && writes_memory(slot.instruction);
+        program.push_back(slot);
+    }
+
+    for (size_t i = 0; i < program.size(); i++) {
+        // Past the end of the program is all no-ops
+        bool nop_follows = (i + 1 == program.size()) || program[i+1].word == 0;
+        program[i].self_loop = program[i].valid && nop_follows
+            && jumps_to_itself(program[i].instruction, start + i * 4);
+
+        if (i + 1 < program.size()) {
+            program[i].fusion = find_fusion(program[i], program[i+1]);
+        }
+    }
+
+    return program;
+}
+
+template<>
+string show(const Fusion& fusion) {
+    switch (fusion) {
+        case Fusion::NONE:       return "NONE";
+        case Fusion::LUI_ORI:    return "LUI_ORI";
+        case Fusion::SLT_BRANCH: return "SLT_BRANCH";
+        case Fusion::LOAD_ALU:   return "LOAD_ALU";
+    }
+    return "";
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <vector>
+
+#include "opcodes.hpp"
+#include "typedefs.hpp"
+
+/**
+ * Pairs of adjacent instructions that are executed as a single operation.
+ *
+ * The fusion is recorded on the first instruction of the pair.
+ */
+enum class Fusion : uint8_t {
+    NONE,
+    LUI_ORI,    // li: LUI rt, hi; ORI rt, rt, lo
+    SLT_BRANCH, // blt/bgt: SLT(I)(U) $at, ...; BEQ/BNE $at, $0, target
+    LOAD_ALU,   // A load followed by an ALU operation that uses the loaded register
+};
+
+const unsigned int fusion_kinds = 4;
+
+/**
+ * An instruction memory word, decoded once at load time.
+ *
+ * Words that do not decode are kept with valid = false. They are only an error if they are
+ * executed, in which case they are decoded again with decode() so that the error is the same.
+ */
+struct PredecodedInstruction {
+    Word word;
+    bool valid;
+    Fusion fusion;
+    // A branch or jump to its own address with a no-op in its delay slot. If it is taken
+    // it will be taken forever, since nothing in the loop can change the registers.
+    bool self_loop;
+    // Reads data memory, so it may read getc or receive from a mailbox, or is a SYSCALL, which
+    // may read input
+    bool load;
+    // Writes data memory, so it may send to a mailbox
+    bool store;
+    Instruction instruction;
+};
+
+std::vector<PredecodedInstruction> predecode(const std::vector<Word>& words, Address start);
+
+template<> std::string show(const Fusion&);
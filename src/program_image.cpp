@@ -0,0 +1,33 @@
+#include <vector>
+#include <cassert>
+
+#include "program_image.hpp"
+#include "hash.hpp"
+#include "memory.hpp"
+
+using namespace std;
+
+ProgramImage::ProgramImage(vector<Word> i_words) :
+    words(move(i_words)),
+    program(predecode(words, instruction_start)),
+    entry(instruction_start),
+    data_pages(data_page_count),
+    hash(hash_bytes(words.data(), words.size() * sizeof(Word))) {}
+
+ProgramImage::ProgramImage(vector<Word> i_words, Address i_entry, const vector<DataSegment>& data) :
+    ProgramImage(move(i_words)) {
+        entry = i_entry;
+        hash = hash_bytes(&entry, sizeof(entry), hash);
+
+        for (const DataSegment& segment : data) {
+            assert(is_data(segment.start) && segment.start + segment.bytes.size() <= data_start + data_size);
+            for (size_t i = 0; i < segment.bytes.size(); i++) {
+                Address offset = segment.start + i - data_start;
+                Word& word = data_pages.write(offset / page_size)[offset % page_size / 4];
+                int shift = 8 * (3 - offset % 4);
+                word = (word & ~(0xFFu << shift)) | (static_cast<Word>(static_cast<Byte>(segment.bytes[i])) << shift);
+            }
+            hash = hash_bytes(&segment.start, sizeof(segment.start), hash);
+            hash = hash_bytes(segment.bytes.data(), segment.bytes.size(), hash);
+        }
+    }
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <string>
+
+#include "typedefs.hpp"
+#include "predecoder.hpp"
+#include "page_table.hpp"
+
+/**
+ * Bytes in data memory when the program starts, e.g. an ELF file's .data
+ */
+struct DataSegment {
+    Address start;
+    std::string bytes;
+};
+
+/**
+ * A loaded program: the instruction memory words, their predecoded form, where it starts,
+ * what data memory holds when it starts and a hash of all of these identifying the program.
+ *
+ * Images are immutable once constructed, so a single image can be shared by any number of
+ * CPUs (through shared_ptr<const ProgramImage>) on any number of threads. Each CPU only owns
+ * its registers and data memory.
+ */
+class ProgramImage {
+    private:
+        const std::vector<Word> words;
+        const std::vector<PredecodedInstruction> program;
+        Address entry;
+        PageTable data_pages;
+        uint64_t hash;
+
+    public:
+        // A program starting at instruction_start, with data memory all zeros
+        ProgramImage(std::vector<Word> words);
+        // The segments must be in data memory
+        ProgramImage(std::vector<Word> words, Address entry, const std::vector<DataSegment>& data);
+
+        // Instruction memory, starting at instruction_start
+        const std::vector<Word>& get_words() const { return words; }
+        // One entry per word of instruction memory
+        const std::vector<PredecodedInstruction>& get_program() const { return program; }
+        Address get_entry() const { return entry; }
+        // Data memory when the program starts. Pages that are never written aren't allocated
+        const PageTable& get_data_pages() const { return data_pages; }
+        uint64_t get_hash() const { return hash; }
+        size_t size() const { return words.size(); }
+};
@@ -0,0 +1,166 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "result_cache.hpp"
+#include "hash.hpp"
+
+using namespace std;
+
+namespace {
+
+const char result_magic[8] = { 'M', 'I', 'P', 'S', 'R', 'E', 'S', '2' };
+
+// Results are only evicted on one in this many stores, since it needs a directory scan
+const uint64_t eviction_interval = 16;
+// Eviction deletes results until the directory is below this fraction of the limit
+const double eviction_target = 0.9;
+
+struct ResultHeader {
+    char magic[8];
+    CacheKey key;
+    int32_t exit_code;
+    uint32_t output_size;
+    uint64_t instructions;
+    uint32_t error_size;
+    uint32_t stopped;
+};
+
+uint64_t key_hash(const CacheKey& key) {
+    return hash_bytes(&key, sizeof(key));
+}
+
+bool same_key(const CacheKey& a, const CacheKey& b) {
+    return memcmp(&a, &b, sizeof(CacheKey)) == 0;
+}
+
+}
+
+ResultCache::ResultCache(const string& i_directory, uint64_t i_max_bytes) :
+    directory(i_directory),
+    max_bytes(i_max_bytes) {
+        mkdir(directory.c_str(), 0777);
+    }
+
+string ResultCache::path(const CacheKey& key) const {
+    return directory + "/" + show_hash(key_hash(key));
+}
+
+bool ResultCache::lookup(const CacheKey& key, CachedResult& result) const {
+    string filename = path(key);
+    ifstream file(filename, ios::binary);
+    if (!file.is_open()) return false;
+
+    ResultHeader header;
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header))
+            || memcmp(header.magic, result_magic, sizeof(result_magic)) != 0
+            || !same_key(header.key, key)) {
+        return false;
+    }
+
+    result.exit_code = header.exit_code;
+    result.instructions = header.instructions;
+    result.stopped = header.stopped;
+    result.output.resize(header.output_size);
+    result.error.resize(header.error_size);
+    if (!file.read(&result.output[0], header.output_size)
+            || !file.read(&result.error[0], header.error_size)) {
+        return false;
+    }
+
+    // Mark as recently used
+    utimensat(AT_FDCWD, filename.c_str(), nullptr, 0);
+    return true;
+}
+
+void ResultCache::store(const CacheKey& key, const CachedResult& result) {
+    ResultHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, result_magic, sizeof(result_magic));
+    header.key = key;
+    header.exit_code = result.exit_code;
+    header.output_size = result.output.size();
+    header.instructions = result.instructions;
+    header.error_size = result.error.size();
+    header.stopped = result.stopped;
+
+    ostringstream temporary_name;
+    temporary_name << directory << "/.tmp." << getpid() << "." << this_thread::get_id();
+    string temporary = temporary_name.str();
+
+    {
+        ofstream file(temporary, ios::binary | ios::trunc);
+        if (!file.is_open()) return;
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file << result.output << result.error;
+        if (!file.good()) {
+            file.close();
+            unlink(temporary.c_str());
+            return;
+        }
+    }
+
+    if (rename(temporary.c_str(), path(key).c_str()) != 0) {
+        unlink(temporary.c_str());
+        return;
+    }
+
+    if (key_hash(key) % eviction_interval == 0) evict();
+}
+
+/**
+ * Delete the least recently used results until the directory is below the target size.
+ * Other processes may be evicting at the same time, so files can disappear under us.
+ */
+void ResultCache::evict() {
+    struct Entry {
+        string path;
+        time_t used;
+        uint64_t size;
+    };
+
+    DIR* dir = opendir(directory.c_str());
+    if (dir == nullptr) return;
+
+    vector<Entry> entries;
+    uint64_t total = 0;
+    while (dirent* entry = readdir(dir)) {
+        if (entry->d_name[0] == '.') continue;
+        string entry_path = directory + "/" + entry->d_name;
+        struct stat st;
+        if (stat(entry_path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) continue;
+        entries.push_back(Entry { entry_path, st.st_mtime, static_cast<uint64_t>(st.st_size) });
+        total += st.st_size;
+    }
+    closedir(dir);
+
+    if (total <= max_bytes) return;
+
+    sort(entries.begin(), entries.end(), [] (const Entry& a, const Entry& b) { return a.used < b.used; });
+    uint64_t target = max_bytes * eviction_target;
+    for (const Entry& entry : entries) {
+        if (total <= target) break;
+        unlink(entry.path.c_str());
+        total -= entry.size;
+    }
+}
+
+uint64_t simulator_hash() {
+    static const uint64_t hash = [] {
+        ifstream file("/proc/self/exe", ios::binary);
+        string contents((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+        return hash_bytes(contents.data(), contents.size());
+    }();
+    return hash;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+/**
+ * What a run is cached by: the simulator build, the program, the input and the options that
+ * can change the result.
+ */
+struct CacheKey {
+    uint64_t simulator_hash;
+    uint64_t image_hash;
+    uint64_t image_words;
+    uint64_t input_hash;
+    uint64_t input_size;
+    uint64_t max_instructions;
+};
+
+struct CachedResult {
+    int exit_code = 0;
+    uint64_t instructions = 0;
+    std::string output;
+    // The fault message, if the run faulted
+    std::string error;
+    // See Fault::stopped
+    bool stopped = false;
+};
+
+/**
+ * On-disk cache of the results of runs, in a directory shared by any number of simulator
+ * processes.
+ *
+ * Each result is a file named after the hash of its key. Files are written under a temporary
+ * name and renamed into place, so readers only ever see complete files, and concurrent
+ * writers of the same result just replace each other's identical file. Reading a result
+ * touches its modification time; once the directory grows past `max_bytes` the least
+ * recently used results are deleted.
+ */
+class ResultCache {
+    private:
+        std::string directory;
+        uint64_t max_bytes;
+
+        std::string path(const CacheKey& key) const;
+        void evict();
+
+    public:
+        ResultCache(const std::string& directory, uint64_t max_bytes);
+
+        bool lookup(const CacheKey& key, CachedResult& result) const;
+        // Failing to store a result (e.g. the directory is not writable) is not an error
+        void store(const CacheKey& key, const CachedResult& result);
+};
+
+// Hash of the running simulator's executable, so that results from other builds are not reused
+uint64_t simulator_hash();
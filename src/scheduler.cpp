@@ -0,0 +1,96 @@
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "scheduler.hpp"
+
+using namespace std;
+
+size_t Scheduler::add(shared_ptr<const ProgramImage> image, uint64_t max_instructions, bool fusion) {
+    unique_ptr<Guest> guest(new Guest());
+    guest->cpu.reset(new CPU(move(image)));
+    guest->cpu->set_max_instructions(max_instructions);
+    guest->cpu->set_fusion(fusion);
+    guest->cpu->set_input_buffer(&guest->input);
+    guest->cpu->set_io(nullptr, &guest->output);
+
+    lock_guard<std::mutex> lock(mutex);
+    guest->id = next_id++;
+    Guest& added = *guest;
+    guests[added.id] = move(guest);
+    make_runnable(added);
+    return added.id;
+}
+
+// Must be called with the mutex held
+void Scheduler::make_runnable(Guest& guest) {
+    guest.waiting = false;
+    runnable.push_back(&guest);
+    wakeup.notify_one();
+}
+
+void Scheduler::feed(size_t id, const string& data) {
+    lock_guard<std::mutex> lock(mutex);
+    auto found = guests.find(id);
+    if (found == guests.end()) return;
+
+    Guest& guest = *found->second;
+    guest.input.push(data);
+    if (guest.waiting) make_runnable(guest);
+}
+
+void Scheduler::close_input(size_t id) {
+    lock_guard<std::mutex> lock(mutex);
+    auto found = guests.find(id);
+    if (found == guests.end()) return;
+
+    Guest& guest = *found->second;
+    guest.input.close();
+    if (guest.waiting) make_runnable(guest);
+}
+
+size_t Scheduler::guest_count() {
+    lock_guard<std::mutex> lock(mutex);
+    return guests.size();
+}
+
+/**
+ * Only the scheduler's thread runs guests, so a guest's CPU and output are only touched
+ * without the mutex while it is out of the runnable queue. Input is fed under the mutex, and
+ * a guest is only marked as waiting under the mutex after checking its input once more, so
+ * no input can arrive unnoticed between a guest stopping and it being put aside.
+ */
+void Scheduler::run(OutputCallback on_output, ExitCallback on_exit, bool until_empty) {
+    while (true) {
+        Guest* guest;
+        {
+            unique_lock<std::mutex> lock(mutex);
+            wakeup.wait(lock, [&] { return !runnable.empty() || (until_empty && guests.empty()); });
+            if (runnable.empty()) return;
+            guest = runnable.front();
+            runnable.pop_front();
+        }
+
+        RunStatus status = guest->cpu->step(slice);
+
+        string output = guest->output.str();
+        if (!output.empty()) {
+            guest->output.str("");
+            on_output(guest->id, output);
+        }
+
+        if (status == RunStatus::EXITED) {
+            on_exit(guest->id, *guest->cpu);
+            lock_guard<std::mutex> lock(mutex);
+            guests.erase(guest->id);
+            continue;
+        }
+
+        lock_guard<std::mutex> lock(mutex);
+        if (status == RunStatus::WAITING_FOR_INPUT && !guest->input.ready()) {
+            guest->waiting = true;
+        } else {
+            make_runnable(*guest);
+        }
+    }
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+
+#include "cpu.hpp"
+#include "input_buffer.hpp"
+#include "program_image.hpp"
+
+/**
+ * Runs any number of guest programs on a single host thread.
+ *
+ * Guests take turns running for a time slice of instructions. A guest that reads getc while
+ * its input buffer is empty is put aside until input is fed to it, so idle guests cost
+ * nothing but their memory. Guests can be added and fed from any thread while run() is
+ * running on another.
+ */
+class Scheduler {
+    public:
+        // Called on the scheduler's thread with a guest's new output after each of its time
+        // slices, and with its CPU once it has exited (just before the guest is removed).
+        using OutputCallback = std::function<void(size_t id, const std::string& output)>;
+        using ExitCallback = std::function<void(size_t id, const CPU& cpu)>;
+
+    private:
+        struct Guest {
+            size_t id;
+            std::unique_ptr<CPU> cpu;
+            InputBuffer input;
+            std::ostringstream output;
+            bool waiting = false;
+        };
+
+        uint64_t slice;
+
+        std::mutex mutex;
+        std::condition_variable wakeup;
+        std::unordered_map<size_t, std::unique_ptr<Guest>> guests;
+        std::deque<Guest*> runnable;
+        size_t next_id = 0;
+
+        void make_runnable(Guest& guest);
+
+    public:
+        explicit Scheduler(uint64_t slice = 10000) : slice(slice) {}
+
+        // Start running a new guest. Returns its id
+        size_t add(std::shared_ptr<const ProgramImage> image, uint64_t max_instructions = UINT64_MAX, bool fusion = true);
+        // Feed input to a guest's getc. Unknown (e.g. exited) guests are ignored
+        void feed(size_t id, const std::string& data);
+        // End a guest's input: once it has read what was fed it reads EOF
+        void close_input(size_t id);
+
+        size_t guest_count();
+
+        // Run guests until all of them have exited. Unless `until_empty`, keep waiting for new
+        // guests instead, for good
+        void run(OutputCallback on_output, ExitCallback on_exit, bool until_empty = true);
+};
@@ -0,0 +1,630 @@
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "server.hpp"
+#include "cpu.hpp"
+#include "hash.hpp"
+#include "loader.hpp"
+#include "program_image.hpp"
+#include "scheduler.hpp"
+#include "show.hpp"
+
+using namespace std;
+
+namespace {
+
+const uint8_t protocol_version = 2;
+const uint8_t flag_image_bytes = 1;
+const uint8_t flag_no_fusion = 2;
+const uint8_t flag_interactive = 4;
+
+// The first byte of each message after an interactive job, from the client
+const uint8_t session_input = 1;
+const uint8_t session_end_of_input = 2;
+// and from the daemon
+const uint8_t session_output = 1;
+const uint8_t session_result = 2;
+
+// Larger messages are rejected rather than allocated
+const uint32_t max_message_size = 256 << 20;
+// Least recently used images are dropped beyond this
+const size_t max_cached_images = 64;
+
+bool read_exact(int fd, void* data, size_t size) {
+    char* bytes = static_cast<char*>(data);
+    while (size > 0) {
+        ssize_t n = read(fd, bytes, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        bytes += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool write_all(int fd, const void* data, size_t size) {
+    const char* bytes = static_cast<const char*>(data);
+    while (size > 0) {
+        ssize_t n = send(fd, bytes, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        bytes += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool read_message(int fd, string& message) {
+    unsigned char length[4];
+    if (!read_exact(fd, length, 4)) return false;
+    uint32_t size = (length[0] << 24) | (length[1] << 16) | (length[2] << 8) | length[3];
+    if (size > max_message_size) return false;
+    message.resize(size);
+    return read_exact(fd, &message[0], size);
+}
+
+bool write_message(int fd, const string& message) {
+    uint32_t size = message.size();
+    unsigned char length[4] = {
+        static_cast<unsigned char>(size >> 24), static_cast<unsigned char>(size >> 16),
+        static_cast<unsigned char>(size >> 8),  static_cast<unsigned char>(size) };
+    return write_all(fd, length, 4) && write_all(fd, message.data(), message.size());
+}
+
+/**
+ * Builds a message payload
+ */
+class Writer {
+    private:
+        string data;
+
+    public:
+        void u8(uint8_t value) { data += static_cast<char>(value); }
+        void u32(uint32_t value) {
+            for (int shift = 24; shift >= 0; shift -= 8) u8(value >> shift);
+        }
+        void u64(uint64_t value) {
+            u32(value >> 32);
+            u32(value);
+        }
+        void bytes(const string& value) {
+            u32(value.size());
+            data += value;
+        }
+        const string& str() const { return data; }
+};
+
+/**
+ * Reads a message payload. Reading past the end sets `ok` to false and returns zeros
+ */
+class Reader {
+    private:
+        const string& data;
+        size_t position = 0;
+
+    public:
+        bool ok = true;
+
+        Reader(const string& i_data) : data(i_data) {}
+
+        uint8_t u8() {
+            if (position >= data.size()) {
+                ok = false;
+                return 0;
+            }
+            return static_cast<unsigned char>(data[position++]);
+        }
+        uint32_t u32() {
+            uint32_t value = 0;
+            for (int i = 0; i < 4; i++) value = (value << 8) | u8();
+            return value;
+        }
+        uint64_t u64() {
+            uint64_t high = u32();
+            return (high << 32) | u32();
+        }
+        string bytes() {
+            uint32_t size = u32();
+            if (!ok || data.size() - position < size) {
+                ok = false;
+                return "";
+            }
+            string value = data.substr(position, size);
+            position += size;
+            return value;
+        }
+};
+
+/**
+ * Predecoded images by the hash of their bytes, least recently used first
+ */
+class ImageCache {
+    private:
+        struct Entry {
+            uint64_t hash;
+            string bytes;
+            shared_ptr<const ProgramImage> image;
+        };
+
+        mutex cache_mutex;
+        list<Entry> entries;
+        unordered_map<uint64_t, list<Entry>::iterator> by_hash;
+
+    public:
+        shared_ptr<const ProgramImage> get(const string& bytes) {
+            uint64_t hash = hash_bytes(bytes.data(), bytes.size());
+            {
+                lock_guard<mutex> lock(cache_mutex);
+                auto found = by_hash.find(hash);
+                if (found != by_hash.end() && found->second->bytes == bytes) {
+                    entries.splice(entries.end(), entries, found->second);
+                    return found->second->image;
+                }
+            }
+
+            // Predecode outside of the lock. Two threads may both miss and predecode the
+            // same image, which is harmless
+            auto image = is_elf(bytes) ? elf_image(ElfFile("The program", bytes))
+                                       : make_shared<const ProgramImage>(words_from_bytes(bytes));
+
+            lock_guard<mutex> lock(cache_mutex);
+            auto found = by_hash.find(hash);
+            if (found != by_hash.end()) {
+                entries.erase(found->second);
+                by_hash.erase(found);
+            }
+            if (entries.size() >= max_cached_images) {
+                by_hash.erase(entries.front().hash);
+                entries.pop_front();
+            }
+            entries.push_back(Entry { hash, bytes, image });
+            by_hash[hash] = prev(entries.end());
+            return image;
+        }
+};
+
+/**
+ * A job read off the wire, with its image predecoded
+ */
+struct ParsedJob {
+    uint8_t flags = 0;
+    uint64_t max_instructions = 0;
+    shared_ptr<const ProgramImage> program;
+    string input;
+};
+
+// Returns false, with the reason in `result`, if the job can't be run
+bool parse_job(ImageCache& images, const string& request, ParsedJob& job, JobResult& result) {
+    Reader reader(request);
+
+    uint8_t version = reader.u8();
+    job.flags = reader.u8();
+    job.max_instructions = reader.u64();
+    string image = reader.bytes();
+    job.input = reader.bytes();
+
+    if (!reader.ok || version != protocol_version) {
+        result.exit_code = -21;
+        result.error = "Malformed job";
+        return false;
+    }
+
+    if (!(job.flags & flag_image_bytes)) {
+        ifstream file(image, ios::binary);
+        if (!file.is_open()) {
+            result.exit_code = -21;
+            result.error = "Can't open " + image;
+            return false;
+        }
+        image.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+    }
+
+    try {
+        job.program = images.get(image);
+    } catch (ElfError& err) {
+        result.exit_code = -21;
+        result.error = err.what();
+        return false;
+    }
+    return true;
+}
+
+// Everything but the output, once the CPU has stopped
+void finish_result(const CPU& cpu, JobResult& result) {
+    result.exit_code = cpu.get_exit_code();
+    result.instructions = cpu.get_stats().instructions;
+    result.dispatches = cpu.get_stats().dispatches;
+    if (cpu.get_fault().raised()) result.error = show(cpu.get_fault());
+    result.stopped = cpu.get_fault().stopped();
+}
+
+JobResult run_job(const ParsedJob& job) {
+    istringstream guest_input(job.input);
+    ostringstream guest_output;
+
+    CPU cpu(job.program);
+    cpu.set_io(&guest_input, &guest_output);
+    cpu.set_fusion(!(job.flags & flag_no_fusion));
+    if (job.max_instructions != 0) cpu.set_max_instructions(job.max_instructions);
+    cpu.run(false);
+
+    JobResult result;
+    finish_result(cpu, result);
+    result.output = guest_output.str();
+    return result;
+}
+
+void write_result(Writer& writer, const JobResult& result) {
+    writer.u32(static_cast<uint32_t>(result.exit_code));
+    writer.u64(result.instructions);
+    writer.u64(result.dispatches);
+    writer.bytes(result.output);
+    writer.bytes(result.error);
+    writer.u8(result.stopped);
+}
+
+bool read_result(Reader& reader, JobResult& result) {
+    result.exit_code = static_cast<int32_t>(reader.u32());
+    result.instructions = reader.u64();
+    result.dispatches = reader.u64();
+    result.output = reader.bytes();
+    result.error = reader.bytes();
+    result.stopped = reader.u8();
+    return reader.ok;
+}
+
+/**
+ * Interactive jobs. Their guests all run on one Scheduler thread, which streams their output
+ * back as it comes, so a guest waiting for input costs no thread. One more thread polls every
+ * session's connection for input, and closes the connection once its result has been sent.
+ *
+ * A client that stops reading its output holds up the other sessions' guests, and one that
+ * sends half a message holds up the others' input: the clients are trusted like the images.
+ */
+class Sessions {
+    private:
+        struct Session {
+            int fd;
+            // Until the client ends its input
+            bool reading = true;
+            // Until the client stops taking output
+            bool writing = true;
+            // Once the result has been sent, for the polling thread to close the connection
+            bool finished = false;
+        };
+
+        Scheduler scheduler;
+        mutex sessions_mutex;
+        // By guest id
+        unordered_map<size_t, Session> sessions;
+        // Written to to wake the polling thread up to look at `sessions` again
+        int wake[2];
+
+        void wake_up() {
+            char byte = 0;
+            // A full pipe means the thread is awake already
+            if (write(wake[1], &byte, 1) < 0) return;
+        }
+
+        // On the scheduler's thread, which is the only one writing to the connections
+        void send(size_t id, const string& message) {
+            int fd;
+            {
+                lock_guard<mutex> lock(sessions_mutex);
+                Session& session = sessions.at(id);
+                if (!session.writing) return;
+                fd = session.fd;
+            }
+            if (write_message(fd, message)) return;
+
+            // The client is gone: let the guest read EOF, and drop the rest of its output
+            scheduler.close_input(id);
+            lock_guard<mutex> lock(sessions_mutex);
+            sessions.at(id).writing = false;
+        }
+
+        void send_output(size_t id, const string& output) {
+            send(id, static_cast<char>(session_output) + output);
+        }
+
+        void send_result(size_t id, const CPU& cpu) {
+            JobResult result;
+            finish_result(cpu, result);
+            Writer writer;
+            writer.u8(session_result);
+            write_result(writer, result);
+            send(id, writer.str());
+
+            lock_guard<mutex> lock(sessions_mutex);
+            sessions.at(id).finished = true;
+            wake_up();
+        }
+
+        void poll_input() {
+            vector<pollfd> polled;
+            vector<size_t> ids;
+            char drained[256];
+
+            while (true) {
+                polled.assign(1, pollfd { wake[0], POLLIN, 0 });
+                ids.assign(1, 0);
+                {
+                    lock_guard<mutex> lock(sessions_mutex);
+                    for (auto it = sessions.begin(); it != sessions.end();) {
+                        if (it->second.finished) {
+                            close(it->second.fd);
+                            it = sessions.erase(it);
+                            continue;
+                        }
+                        if (it->second.reading) {
+                            polled.push_back(pollfd { it->second.fd, POLLIN, 0 });
+                            ids.push_back(it->first);
+                        }
+                        ++it;
+                    }
+                }
+
+                if (poll(polled.data(), polled.size(), -1) < 0) continue;
+                if (polled[0].revents) {
+                    while (read(wake[0], drained, sizeof(drained)) > 0) {}
+                }
+
+                // Only this thread erases sessions, so those polled are all still there
+                for (size_t i = 1; i < polled.size(); i++) {
+                    if (!polled[i].revents) continue;
+
+                    string message;
+                    if (read_message(polled[i].fd, message) && !message.empty()
+                            && static_cast<uint8_t>(message[0]) == session_input) {
+                        scheduler.feed(ids[i], message.substr(1));
+                        continue;
+                    }
+
+                    // The end of the input, or of the connection
+                    scheduler.close_input(ids[i]);
+                    lock_guard<mutex> lock(sessions_mutex);
+                    sessions.at(ids[i]).reading = false;
+                }
+            }
+        }
+
+    public:
+        // Starts the scheduler's thread and the polling thread, which run for good
+        Sessions() {
+            if (pipe2(wake, O_NONBLOCK | O_CLOEXEC) < 0) throw runtime_error("Can't create a pipe");
+
+            thread([this] {
+                scheduler.run(
+                    [this] (size_t id, const string& output) { send_output(id, output); },
+                    [this] (size_t id, const CPU& cpu) { send_result(id, cpu); },
+                    false);
+            }).detach();
+            thread([this] { poll_input(); }).detach();
+        }
+
+        // Run the job, talking over `fd` from now on. The session closes it when done
+        void start(const ParsedJob& job, int fd) {
+            lock_guard<mutex> lock(sessions_mutex);
+            // The guest can't send anything before it is in `sessions`: that needs the lock
+            size_t id = scheduler.add(job.program,
+                                      job.max_instructions == 0 ? UINT64_MAX : job.max_instructions,
+                                      !(job.flags & flag_no_fusion));
+            Session session;
+            session.fd = fd;
+            sessions[id] = session;
+            if (!job.input.empty()) scheduler.feed(id, job.input);
+            wake_up();
+        }
+};
+
+void serve_connection(ImageCache& images, Sessions& sessions, int fd) {
+    string request;
+    while (read_message(fd, request)) {
+        ParsedJob job;
+        JobResult result;
+        if (parse_job(images, request, job, result)) {
+            if (job.flags & flag_interactive) {
+                sessions.start(job, fd);
+                return;
+            }
+            result = run_job(job);
+        }
+
+        Writer writer;
+        write_result(writer, result);
+        if (!write_message(fd, writer.str())) break;
+    }
+    close(fd);
+}
+
+bool make_address(const string& socket_path, sockaddr_un& address) {
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(address.sun_path)) return false;
+    strcpy(address.sun_path, socket_path.c_str());
+    return true;
+}
+
+// Returns -1, with a message in result.error, if the daemon can't be reached
+int connect_to(const string& socket_path, JobResult& result) {
+    sockaddr_un address;
+    if (!make_address(socket_path, address)) {
+        result.error = "Socket path too long: " + socket_path;
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+        if (fd >= 0) close(fd);
+        result.error = "Can't connect to " + socket_path;
+        return -1;
+    }
+    return fd;
+}
+
+string job_message(const Job& job, bool interactive) {
+    Writer writer;
+    writer.u8(protocol_version);
+    writer.u8((job.image_is_path ? 0 : flag_image_bytes) | (job.fusion ? 0 : flag_no_fusion)
+              | (interactive ? flag_interactive : 0));
+    writer.u64(job.max_instructions == UINT64_MAX ? 0 : job.max_instructions);
+    writer.bytes(job.image);
+    writer.bytes(job.input);
+    return writer.str();
+}
+
+}
+
+int serve(const string& socket_path, unsigned int threads) {
+    sockaddr_un address;
+    if (!make_address(socket_path, address)) return -21;
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) return -21;
+    unlink(socket_path.c_str());
+    if (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0
+            || listen(listener, 128) < 0) {
+        close(listener);
+        return -21;
+    }
+
+    ImageCache images;
+    // Its threads never return either, so it is never destroyed
+    Sessions& sessions = *new Sessions();
+    mutex queue_mutex;
+    condition_variable queue_ready;
+    queue<int> connections;
+
+    auto worker = [&] () {
+        while (true) {
+            int fd;
+            {
+                unique_lock<mutex> lock(queue_mutex);
+                queue_ready.wait(lock, [&] { return !connections.empty(); });
+                fd = connections.front();
+                connections.pop();
+            }
+            serve_connection(images, sessions, fd);
+        }
+    };
+
+    vector<thread> pool;
+    for (unsigned int i = 0; i < max(threads, 1u); i++) pool.emplace_back(worker);
+
+    while (true) {
+        int fd = accept(listener, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            break;
+        }
+        lock_guard<mutex> lock(queue_mutex);
+        connections.push(fd);
+        queue_ready.notify_one();
+    }
+
+    // Only reached if accept() fails for good; the workers never return
+    close(listener);
+    for (auto& t : pool) t.detach();
+    return -21;
+}
+
+bool submit_job(const string& socket_path, const Job& job, JobResult& result) {
+    int fd = connect_to(socket_path, result);
+    if (fd < 0) return false;
+
+    string response;
+    bool ok = write_message(fd, job_message(job, false)) && read_message(fd, response);
+    close(fd);
+    if (!ok) {
+        result.error = "No result from " + socket_path;
+        return false;
+    }
+
+    Reader reader(response);
+    if (!read_result(reader, result)) {
+        result.error = "Malformed result from " + socket_path;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Input is forwarded from another thread, which is told to stop through a pipe once the
+ * result is in, so that it isn't left blocked on `input_fd`
+ */
+bool run_session(const string& socket_path, const Job& job, int input_fd, ostream& output, JobResult& result) {
+    int fd = connect_to(socket_path, result);
+    if (fd < 0) return false;
+    if (!write_message(fd, job_message(job, true))) {
+        close(fd);
+        result.error = "No result from " + socket_path;
+        return false;
+    }
+
+    int stop[2];
+    if (pipe2(stop, O_CLOEXEC) < 0) {
+        close(fd);
+        result.error = "Can't create a pipe";
+        return false;
+    }
+
+    thread forwarder([&] {
+        pollfd polled[2] = { pollfd { input_fd, POLLIN, 0 }, pollfd { stop[0], POLLIN, 0 } };
+        char buffer[4096];
+        while (true) {
+            int ready = poll(polled, 2, -1);
+            if (ready < 0 && errno == EINTR) continue;
+            if (ready > 0 && polled[1].revents) return;
+
+            ssize_t n = ready < 0 ? -1 : read(input_fd, buffer, sizeof(buffer));
+            if (n < 0 && errno == EINTR) continue;
+            string message(1, static_cast<char>(n > 0 ? session_input : session_end_of_input));
+            if (n > 0) message.append(buffer, n);
+            if (!write_message(fd, message) || n <= 0) return;
+        }
+    });
+
+    bool ok = false;
+    string message;
+    while (read_message(fd, message) && !message.empty()) {
+        if (static_cast<uint8_t>(message[0]) == session_output) {
+            output.write(message.data() + 1, message.size() - 1);
+            output.flush();
+            continue;
+        }
+        if (static_cast<uint8_t>(message[0]) == session_result) {
+            Reader reader(message);
+            reader.u8();
+            ok = read_result(reader, result);
+        }
+        break;
+    }
+
+    char byte = 0;
+    if (write(stop[1], &byte, 1) < 0) {}
+    forwarder.join();
+    close(stop[0]);
+    close(stop[1]);
+    close(fd);
+
+    if (!ok) result.error = "No result from " + socket_path;
+    return ok;
+}
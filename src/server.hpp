@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+/**
+ * A job for the simulation daemon: run a program over some input.
+ */
+struct Job {
+    // `image` is the path of the binary (as seen by the daemon), or its bytes
+    bool image_is_path = true;
+    std::string image;
+    std::string input;
+    uint64_t max_instructions = UINT64_MAX;
+    bool fusion = true;
+};
+
+struct JobResult {
+    int exit_code = 0;
+    uint64_t instructions = 0;
+    uint64_t dispatches = 0;
+    std::string output;
+    // The fault message, or why the job could not be run at all
+    std::string error;
+    // See Fault::stopped
+    bool stopped = false;
+};
+
+/**
+ * Serve jobs on a Unix domain socket at `socket_path` until killed, on `threads` worker threads.
+ *
+ * Each connection sends any number of jobs, one after the other, and gets a result for each.
+ * Every message is a 4-byte big-endian length followed by the payload (integers big-endian):
+ *
+ *   job:    u8 version (2), u8 flags (1: image is bytes rather than a path, 2: no fusion,
+ *           4: interactive), u64 instruction budget (0: none), u32 + image, u32 + input
+ *   result: i32 exit code, u64 instructions, u64 dispatches, u32 + output, u32 + error,
+ *           u8 stopped (1 if the budget ran out or the program was stuck, see Fault::stopped)
+ *
+ * An interactive job is the last one on its connection. The client then sends its input as it
+ * comes, as u8 1 followed by the bytes, and u8 2 at its end. The daemon sends the output as
+ * it comes, as u8 1 followed by the bytes, then u8 2 followed by the result (with no output).
+ * Interactive guests all share one thread, and a guest waiting for input takes no time.
+ *
+ * Images are predecoded once and cached by the hash of their bytes. Returns -21 if the
+ * socket can't be set up.
+ */
+int serve(const std::string& socket_path, unsigned int threads);
+
+/**
+ * Send a job to the daemon at `socket_path` and wait for its result.
+ *
+ * Returns false (with a message in result.error) if the daemon can't be reached.
+ */
+bool submit_job(const std::string& socket_path, const Job& job, JobResult& result);
+
+/**
+ * Run a job interactively in the daemon at `socket_path`: forward what can be read from
+ * `input_fd` (after job.input) while the program runs, and write its output as it comes.
+ *
+ * Returns false (with a message in result.error) if the daemon can't be reached.
+ */
+bool run_session(const std::string& socket_path, const Job& job, int input_fd, std::ostream& output, JobResult& result);
@@ -0,0 +1,47 @@
+#include <atomic>
+
+#include "shared_memory.hpp"
+
+using namespace std;
+
+SharedMemory::SharedMemory(size_t i_page_count) :
+    page_count(i_page_count),
+    pages(new atomic<SharedPage*>[i_page_count]) {
+        for (size_t i = 0; i < page_count; i++) pages[i].store(nullptr, memory_order_relaxed);
+    }
+
+SharedMemory::~SharedMemory() {
+    for (size_t i = 0; i < page_count; i++) delete pages[i].load(memory_order_relaxed);
+}
+
+SharedMemory::SharedPage& SharedMemory::page_for_write(size_t index) {
+    SharedPage* page = pages[index].load(memory_order_acquire);
+    if (page) return *page;
+
+    SharedPage* fresh = new SharedPage();
+    for (auto& word : fresh->words) word.store(0, memory_order_relaxed);
+
+    // Another hart may have allocated the page in the meantime, in which case theirs is used
+    if (pages[index].compare_exchange_strong(page, fresh, memory_order_acq_rel, memory_order_acquire)) {
+        return *fresh;
+    }
+    delete fresh;
+    return *page;
+}
+
+Word SharedMemory::load_linked(size_t index, uint32_t& version) const {
+    const SharedPage* page = pages[index / page_words].load(memory_order_acquire);
+    VersionedWord word = page ? page->words[index % page_words].load(memory_order_seq_cst) : 0;
+    version = word >> 32;
+    return static_cast<Word>(word);
+}
+
+/**
+ * A page that was never written reads as 0 with version 0, which is what a fresh page holds
+ */
+bool SharedMemory::store_conditional(size_t index, uint32_t version, Word value) {
+    atomic<VersionedWord>& word = page_for_write(index / page_words).words[index % page_words];
+    VersionedWord current = word.load(memory_order_relaxed);
+    if ((current >> 32) != version) return false;
+    return word.compare_exchange_strong(current, next_version(current, value), memory_order_seq_cst);
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "typedefs.hpp"
+#include "page_table.hpp"
+
+/**
+ * Data memory shared by several harts running on their own threads.
+ *
+ * Like a PageTable, pages are allocated on the first write to them, but here the page table
+ * entries are atomic and a page is allocated with a compare-and-swap, so two harts writing to
+ * a new page at once end up with the same page. Words are atomic too (relaxed, apart from
+ * LL and SC): the guest orders its accesses with SYNC and LL/SC, just as on real hardware.
+ *
+ * Each word is kept together with a count of the stores to it, which every store bumps, so SC
+ * can tell whether the word was stored to since LL read it, even with the value LL read.
+ */
+class SharedMemory {
+    private:
+        // The store count in the high half, the word in the low half
+        using VersionedWord = uint64_t;
+
+        struct SharedPage {
+            std::array<std::atomic<VersionedWord>, page_words> words;
+        };
+
+        size_t page_count;
+        std::unique_ptr<std::atomic<SharedPage*>[]> pages;
+
+        SharedPage& page_for_write(size_t index);
+
+        // `value`, one store after `current`
+        static inline VersionedWord next_version(VersionedWord current, Word value) {
+            return ((current >> 32) + 1) << 32 | value;
+        }
+
+    public:
+        explicit SharedMemory(size_t page_count);
+        ~SharedMemory();
+        SharedMemory(const SharedMemory&) = delete;
+        SharedMemory& operator=(const SharedMemory&) = delete;
+
+        // Word `index` (counting from data_start). Pages that were never written read as 0
+        inline Word read(size_t index) const {
+            const SharedPage* page = pages[index / page_words].load(std::memory_order_acquire);
+            return page ? static_cast<Word>(page->words[index % page_words].load(std::memory_order_relaxed)) : 0;
+        }
+
+        inline void write(size_t index, Word value) {
+            update(index, [value] (Word) { return value; });
+        }
+
+        // Replace word `index` with f(word), atomically
+        template<typename F>
+        void update(size_t index, F f) {
+            std::atomic<VersionedWord>& word = page_for_write(index / page_words).words[index % page_words];
+            VersionedWord current = word.load(std::memory_order_relaxed);
+            while (!word.compare_exchange_weak(current, next_version(current, f(static_cast<Word>(current))),
+                                               std::memory_order_relaxed)) {}
+        }
+
+        // LL: read word `index`, and its store count for store_conditional
+        Word load_linked(size_t index, uint32_t& version) const;
+        // SC: replace word `index` with `value` if it wasn't stored to since load_linked gave
+        // `version`, atomically
+        bool store_conditional(size_t index, uint32_t version, Word value);
+};
@@ -0,0 +1,172 @@
+#include <array>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "snapshot.hpp"
+#include "cpu.hpp"
+#include "memory.hpp"
+
+using namespace std;
+
+namespace {
+
+const char snapshot_magic[8] = { 'M', 'I', 'P', 'S', 'S', 'N', 'A', 'P' };
+const uint32_t snapshot_version = 3;
+const uint32_t byte_order_mark = 0x01020304;
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t page_size;
+    uint32_t page_count;
+
+    // Identifies the program the snapshot was taken from
+    uint64_t program_hash;
+    uint64_t program_words;
+
+    uint64_t instructions;
+    uint64_t input_position;
+    uint64_t output_position;
+
+    int32_t registers[31];
+    int32_t hi;
+    int32_t lo;
+    uint32_t pc;
+    uint32_t npc;
+
+    uint32_t program_break;
+    // Address, length, descriptor and status
+    uint32_t dma_registers[4];
+};
+
+static_assert(sizeof(SnapshotHeader) <= page_size, "Snapshot header must fit in a page");
+
+size_t round_to_page(size_t size) {
+    return (size + page_size - 1) / page_size * page_size;
+}
+
+}
+
+void save_snapshot(const CPU& cpu, const string& filename) {
+    const Memory& memory = cpu.memory;
+    // A host descriptor can't be carried over to another process
+    if (memory.get_files().any_open()) {
+        throw SnapshotError("Can't take a snapshot while the program has host files open");
+    }
+
+    vector<uint32_t> page_indices;
+    for (size_t i = 0; i < data_page_count; i++) {
+        if (memory.get_page(i)) page_indices.push_back(i);
+    }
+
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, snapshot_magic, sizeof(snapshot_magic));
+    header.version = snapshot_version;
+    header.byte_order = byte_order_mark;
+    header.page_size = page_size;
+    header.page_count = page_indices.size();
+    header.program_hash = memory.get_image().get_hash();
+    header.program_words = memory.get_image().size();
+    header.instructions = cpu.stats.instructions;
+    header.input_position = memory.get_input_position();
+    header.output_position = memory.get_output_position();
+    for (size_t i = 0; i < cpu.registers.size(); i++) header.registers[i] = cpu.registers[i];
+    header.hi = cpu.HI;
+    header.lo = cpu.LO;
+    header.pc = cpu.PC;
+    header.npc = cpu.nPC;
+    header.program_break = memory.get_program_break();
+    array<Word, 4> dma_registers = memory.get_dma_registers();
+    for (size_t i = 0; i < dma_registers.size(); i++) header.dma_registers[i] = dma_registers[i];
+
+    ofstream out(filename, ios::binary | ios::trunc);
+    if (!out.is_open()) throw SnapshotError("Can't open " + filename + " for writing");
+
+    vector<char> padding(page_size, 0);
+    auto write_padded = [&] (const void* data, size_t size) {
+        out.write(static_cast<const char*>(data), size);
+        out.write(padding.data(), round_to_page(size) - size);
+    };
+
+    write_padded(&header, sizeof(header));
+    write_padded(page_indices.data(), page_indices.size() * sizeof(uint32_t));
+    for (uint32_t index : page_indices) {
+        out.write(reinterpret_cast<const char*>(memory.get_page(index)->data()), page_size);
+    }
+
+    if (!out.good()) throw SnapshotError("Error writing " + filename);
+}
+
+void restore_snapshot(CPU& cpu, const string& filename) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) throw SnapshotError("Can't open " + filename);
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < page_size) {
+        close(fd);
+        throw SnapshotError(filename + " is not a snapshot");
+    }
+
+    size_t size = st.st_size;
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) throw SnapshotError("Can't map " + filename);
+
+    const char* base = static_cast<const char*>(mapping);
+    const SnapshotHeader& header = *reinterpret_cast<const SnapshotHeader*>(base);
+    const ProgramImage& image = cpu.memory.get_image();
+
+    string error;
+    size_t indices_size = round_to_page(header.page_count * sizeof(uint32_t));
+    if (memcmp(header.magic, snapshot_magic, sizeof(snapshot_magic)) != 0) {
+        error = filename + " is not a snapshot";
+    } else if (header.version != snapshot_version) {
+        error = filename + " has unsupported snapshot version " + to_string(header.version);
+    } else if (header.byte_order != byte_order_mark || header.page_size != page_size) {
+        error = filename + " was written on an incompatible host";
+    } else if (header.page_count > data_page_count
+            || size < page_size + indices_size + static_cast<size_t>(header.page_count) * page_size) {
+        error = filename + " is truncated";
+    } else if (header.program_words != image.size() || header.program_hash != image.get_hash()) {
+        error = filename + " was taken from a different program";
+    }
+
+    if (!error.empty()) {
+        munmap(mapping, size);
+        throw SnapshotError(error);
+    }
+
+    const uint32_t* page_indices = reinterpret_cast<const uint32_t*>(base + page_size);
+    const Page* pages = reinterpret_cast<const Page*>(base + page_size + indices_size);
+    for (uint32_t i = 0; i < header.page_count; i++) {
+        if (page_indices[i] >= data_page_count) {
+            munmap(mapping, size);
+            throw SnapshotError(filename + " is corrupt");
+        }
+        cpu.memory.set_page(page_indices[i], pages[i]);
+    }
+
+    for (size_t i = 0; i < cpu.registers.size(); i++) cpu.registers[i] = header.registers[i];
+    cpu.HI = header.hi;
+    cpu.LO = header.lo;
+    cpu.PC = header.pc;
+    cpu.nPC = header.npc;
+    cpu.stats.instructions = header.instructions;
+    cpu.memory.skip_input(header.input_position);
+    cpu.memory.set_output_position(header.output_position);
+    cpu.memory.set_program_break(header.program_break);
+    array<Word, 4> dma_registers;
+    for (size_t i = 0; i < dma_registers.size(); i++) dma_registers[i] = header.dma_registers[i];
+    cpu.memory.set_dma_registers(dma_registers);
+
+    munmap(mapping, size);
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdexcept>
+#include <string>
+
+class CPU;
+
+/**
+ * A snapshot file could not be written, or does not match the program it is restored into
+ */
+class SnapshotError : public std::runtime_error {
+    public:
+        using std::runtime_error::runtime_error;
+};
+
+/**
+ * Write the full machine state of `cpu` to `filename`.
+ *
+ * File layout, every section starting on a page boundary so that it can be used straight
+ * from an mmap of the file:
+ *
+ *   SnapshotHeader
+ *   uint32_t page_indices[header.page_count]  data page numbers, counting from data_start
+ *   Page pages[header.page_count]             contents of those pages
+ *
+ * All fields are in host byte order; the header records which.
+ *
+ * Throws SnapshotError if the program has host files open (see HostFiles), which a restored
+ * run couldn't use.
+ */
+void save_snapshot(const CPU& cpu, const std::string& filename);
+
+/**
+ * Restore a snapshot written by save_snapshot into a CPU running the same program.
+ *
+ * The CPU's input is advanced past the characters that had been read when the snapshot was
+ * taken, so feeding the same input again continues where the snapshot left off.
+ */
+void restore_snapshot(CPU& cpu, const std::string& filename);
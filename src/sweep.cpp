@@ -0,0 +1,160 @@
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "sweep.hpp"
+#include "cpu.hpp"
+#include "loader.hpp"
+#include "show.hpp"
+#include "lockstep.hpp"
+
+using namespace std;
+
+namespace {
+
+/**
+ * Append `text` to `out` as a JSON string.
+ *
+ * Guest output is bytes rather than UTF-8, so everything outside printable ASCII is escaped
+ * as \u00XX, i.e. byte values map to the code points U+0000 to U+00FF.
+ */
+void append_json_string(string& out, const string& text) {
+    out += '"';
+    for (unsigned char c : text) {
+        if      (c == '"')  out += "\\\"";
+        else if (c == '\\') out += "\\\\";
+        else if (c == '\n') out += "\\n";
+        else if (c == '\t') out += "\\t";
+        else if (c >= 0x20 && c < 0x7F) out += static_cast<char>(c);
+        else {
+            char escaped[7];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out += escaped;
+        }
+    }
+    out += '"';
+}
+
+}
+
+bool split_records(const string& contents, bool length_prefixed, vector<string>& records) {
+    size_t position = 0;
+    while (position < contents.size()) {
+        if (length_prefixed) {
+            if (contents.size() - position < 4) return false;
+            uint32_t length = 0;
+            for (int i = 0; i < 4; i++) {
+                length = (length << 8) | static_cast<unsigned char>(contents[position + i]);
+            }
+            position += 4;
+            if (contents.size() - position < length) return false;
+            records.push_back(contents.substr(position, length));
+            position += length;
+        } else {
+            size_t end = contents.find('\n', position);
+            end = (end == string::npos) ? contents.size() : end;
+            records.push_back(contents.substr(position, end - position) + "\n");
+            position = end + 1;
+        }
+    }
+    return true;
+}
+
+int sweep(const string& binary, const string& inputs, const SweepOptions& options, ostream& out) {
+    ifstream inputs_stream(inputs, ios::binary);
+    if (!inputs_stream.is_open()) return -21;
+    string contents((istreambuf_iterator<char>(inputs_stream)), istreambuf_iterator<char>());
+
+    vector<string> records;
+    if (!split_records(contents, options.length_prefixed, records)) return -21;
+
+    auto image = load_image(binary);
+
+    atomic<size_t> next_record(0);
+    mutex out_mutex;
+
+    LockstepStats lockstep_stats;
+
+    // Records are taken a batch at a time: one per CPU
+    size_t batch = options.lockstep ? lockstep_lanes : 1;
+
+    auto worker = [&] () {
+        vector<unique_ptr<CPU>> cpus;
+        for (size_t lane = 0; lane < batch; lane++) {
+            cpus.emplace_back(new CPU(image));
+            cpus.back()->set_fusion(options.fusion);
+            cpus.back()->set_max_instructions(options.max_instructions);
+        }
+        vector<istringstream> lane_inputs(batch);
+        vector<ostringstream> lane_outputs(batch);
+        LockstepStats thread_stats;
+
+        string line;
+        for (size_t first = next_record.fetch_add(batch); first < records.size(); first = next_record.fetch_add(batch)) {
+            size_t count = min(batch, records.size() - first);
+            vector<CPU*> lanes;
+            for (size_t lane = 0; lane < count; lane++) {
+                lane_inputs[lane].clear();
+                lane_inputs[lane].str(records[first + lane]);
+                lane_outputs[lane].str("");
+
+                cpus[lane]->reset();
+                cpus[lane]->set_io(&lane_inputs[lane], &lane_outputs[lane]);
+                lanes.push_back(cpus[lane].get());
+            }
+
+            if (options.lockstep) {
+                LockstepGroup group(lanes);
+                group.run();
+                thread_stats.lane_instructions += group.get_stats().lane_instructions;
+                thread_stats.fallback_instructions += group.get_stats().fallback_instructions;
+                thread_stats.spills += group.get_stats().spills;
+            } else {
+                lanes[0]->run(false);
+            }
+
+            for (size_t lane = 0; lane < count; lane++) {
+                const CPU& cpu = *lanes[lane];
+                line = "{\"input\":" + to_string(first + lane)
+                    + ",\"exit\":" + to_string(cpu.get_exit_code())
+                    + ",\"instructions\":" + to_string(cpu.get_stats().instructions)
+                    + ",\"output\":";
+                append_json_string(line, lane_outputs[lane].str());
+                if (cpu.get_fault().raised()) {
+                    line += ",\"fault\":";
+                    append_json_string(line, show(cpu.get_fault()));
+                }
+                line += "}\n";
+
+                lock_guard<mutex> lock(out_mutex);
+                out << line;
+            }
+        }
+
+        lock_guard<mutex> lock(out_mutex);
+        lockstep_stats.lane_instructions += thread_stats.lane_instructions;
+        lockstep_stats.fallback_instructions += thread_stats.fallback_instructions;
+        lockstep_stats.spills += thread_stats.spills;
+    };
+
+    unsigned int threads = max(options.threads, 1u);
+    vector<thread> pool;
+    for (unsigned int i = 0; i < threads; i++) pool.emplace_back(worker);
+    for (auto& t : pool) t.join();
+    out.flush();
+
+    if (options.lockstep) {
+        cerr << "lockstep: " << lockstep_stats.lane_instructions << " lane instructions ("
+             << lockstep_stats.fallback_instructions << " through the fallback), "
+             << lockstep_stats.spills << " lanes spilled" << endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+struct SweepOptions {
+    unsigned int threads = 1;
+    // Records are a 4-byte big-endian length followed by that many bytes, rather than lines
+    bool length_prefixed = false;
+    bool fusion = true;
+    // Run the inputs in groups of lockstep_lanes with a LockstepGroup
+    bool lockstep = false;
+    uint64_t max_instructions = UINT64_MAX;
+};
+
+/**
+ * Split the contents of an inputs file into records.
+ *
+ * Lines keep their newline, so that each one is the input `echo $line | mips_simulator` would
+ * see. Returns false if a length-prefixed record runs past the end of the file.
+ */
+bool split_records(const std::string& contents, bool length_prefixed, std::vector<std::string>& records);
+
+/**
+ * Run the program in `binary` once for every record in the `inputs` file, on a pool of threads
+ * with one reusable CPU each.
+ *
+ * Writes one JSON object per record to `out`, in the order the runs finish:
+ *   {"input":N,"exit":CODE,"instructions":COUNT,"output":"...","fault":"..."}
+ * where input is the record's index and fault is only present if the run faulted.
+ * Returns 0, or -21 if the inputs can't be read.
+ */
+int sweep(const std::string& binary, const std::string& inputs, const SweepOptions& options, std::ostream& out);
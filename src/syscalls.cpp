@@ -0,0 +1,116 @@
+#include <array>
+#include <string>
+
+#include "syscalls.hpp"
+#include "memory.hpp"
+#include "host_files.hpp"
+
+using namespace std;
+
+namespace {
+
+// Longest string PRINT_STRING and OPEN read before giving up
+const size_t max_string = 64 * 1024;
+
+const Word failed = static_cast<Word>(-1);
+
+/**
+ * Read the NUL-terminated string at `addr`. Returns false if it faults or is too long
+ */
+bool read_string(const Memory& memory, Address addr, string& text) {
+    char buffer[256];
+    while (text.size() < max_string) {
+        // Up to the end of the page, so a string at the very end of memory doesn't fault
+        size_t length = min(sizeof(buffer), static_cast<size_t>(page_size - addr % page_size));
+        if (!memory.read_block(addr, buffer, length)) return false;
+        for (size_t i = 0; i < length; i++) {
+            if (buffer[i] == '\0') return true;
+            text += buffer[i];
+        }
+        addr += length;
+    }
+    return false;
+}
+
+Word print_int_service(SyscallContext& context) {
+    string text = to_string(static_cast<int32_t>(context.a0));
+    context.memory.write_output(text.data(), text.size());
+    return context.a0;
+}
+
+Word print_string_service(SyscallContext& context) {
+    string text;
+    if (read_string(context.memory, context.a0, text)) context.memory.write_output(text.data(), text.size());
+    return context.a0;
+}
+
+Word print_char_service(SyscallContext& context) {
+    char c = context.a0;
+    context.memory.write_output(&c, 1);
+    return context.a0;
+}
+
+Word read_char_service(SyscallContext& context) {
+    char c;
+    return context.memory.read_input(&c, 1) == 1 ? static_cast<Byte>(c) : failed;
+}
+
+Word sbrk_service(SyscallContext& context) {
+    return context.memory.sbrk(context.a0);
+}
+
+Word exit_service(SyscallContext& context) {
+    context.exit = true;
+    return 0;
+}
+
+Word exit2_service(SyscallContext& context) {
+    context.exit = true;
+    return context.a0;
+}
+
+Word open_service(SyscallContext& context) {
+    string path;
+    if (!read_string(context.memory, context.a0, path)) return failed;
+    return context.memory.get_files().open(path, context.a1);
+}
+
+Word read_service(SyscallContext& context) {
+    if (!context.memory.check_block(context.a1, context.a2, true)) return failed;
+    return context.memory.read_from(context.a0, context.a1, context.a2);
+}
+
+Word write_service(SyscallContext& context) {
+    if (!context.memory.check_block(context.a1, context.a2, false)) return failed;
+    return context.memory.write_to(context.a0, context.a1, context.a2);
+}
+
+Word close_service(SyscallContext& context) {
+    return context.memory.get_files().close(context.a0) ? 0 : failed;
+}
+
+array<SyscallHandler, syscall_count> make_syscall_table() {
+    array<SyscallHandler, syscall_count> table;
+    table.fill(nullptr);
+    table[static_cast<size_t>(Syscall::PRINT_INT)]    = print_int_service;
+    table[static_cast<size_t>(Syscall::PRINT_STRING)] = print_string_service;
+    table[static_cast<size_t>(Syscall::SBRK)]         = sbrk_service;
+    table[static_cast<size_t>(Syscall::EXIT)]         = exit_service;
+    table[static_cast<size_t>(Syscall::PRINT_CHAR)]   = print_char_service;
+    table[static_cast<size_t>(Syscall::READ_CHAR)]    = read_char_service;
+    table[static_cast<size_t>(Syscall::OPEN)]         = open_service;
+    table[static_cast<size_t>(Syscall::READ)]         = read_service;
+    table[static_cast<size_t>(Syscall::WRITE)]        = write_service;
+    table[static_cast<size_t>(Syscall::CLOSE)]        = close_service;
+    table[static_cast<size_t>(Syscall::EXIT2)]        = exit2_service;
+    return table;
+}
+
+}
+
+const array<SyscallHandler, syscall_count> syscall_table = make_syscall_table();
+
+bool syscall_reads_input(Word service, Word a0) {
+    return service == static_cast<Word>(Syscall::READ_CHAR)
+        || (service == static_cast<Word>(Syscall::READ) && a0 == 0);
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+
+#include "typedefs.hpp"
+
+class Memory;
+
+/**
+ * The services SYSCALL provides, numbered as in SPIM and MARS. The service number is passed in
+ * $v0, the arguments in $a0 to $a2, and the result comes back in $v0.
+ *
+ * Descriptors are those of HostFiles. Buffers are copied between guest memory and the host a
+ * block at a time, so moving a buffer costs one instruction.
+ */
+enum class Syscall : Word {
+    PRINT_INT    = 1,   // Write $a0 in decimal
+    PRINT_STRING = 4,   // Write the NUL-terminated string at $a0
+    SBRK         = 9,   // Grow the heap by $a0 bytes. Returns the start of the new space
+    EXIT         = 10,  // Exit with code 0
+    PRINT_CHAR   = 11,  // Write the low byte of $a0
+    READ_CHAR    = 12,  // Returns the next character of input, or -1 at the end
+    OPEN         = 13,  // Open the file named at $a0, with flags $a1 (0 read, 1 write, 9 append).
+                        // Returns a descriptor, or -1
+    READ         = 14,  // Read up to $a2 bytes from descriptor $a0 to $a1. Returns how many
+                        // were read, 0 at the end of the file or -1
+    WRITE        = 15,  // Write $a2 bytes at $a1 to descriptor $a0. Returns how many, or -1
+    CLOSE        = 16,  // Close descriptor $a0
+    EXIT2        = 17,  // Exit with code $a0
+};
+
+/**
+ * What a service can see and change
+ */
+struct SyscallContext {
+    Memory& memory;
+    Word a0, a1, a2;
+    // Set by the exit services: the program ends with $v0 as its exit code
+    bool exit;
+};
+
+// Returns the new value of $v0
+typedef Word (*SyscallHandler)(SyscallContext&);
+
+const size_t syscall_count = 18;
+
+// Indexed by service number. Null for services that don't exist
+extern const std::array<SyscallHandler, syscall_count> syscall_table;
+
+// True if the service reads getc's input, so it may have to wait for it
+bool syscall_reads_input(Word service, Word a0);
@@ -14,4 +14,7 @@ struct RegisterId {
     uint8_t value;
 };
 
+inline bool operator==(const RegisterId& a, const RegisterId& b) { return a.value == b.value; }
+inline bool operator!=(const RegisterId& a, const RegisterId& b) { return a.value != b.value; }
+
 const RegisterId rRA = RegisterId { 31 };
\ No newline at end of file
@@ -0,0 +1,37 @@
+.text
+    # cache1 with an L1I and an L2 given instead: write 4 KiB of words, then
+    # read them back in a different order. Exits with the sum of the words
+    # read, over 256
+    li $s0, 0x20000000
+    li $t0, 0
+    li $t1, 1024
+write:
+    sll $t2, $t0, 2
+    addu $t2, $t2, $s0
+    sw $t0, 0($t2)
+    addiu $t0, $t0, 1
+    bne $t0, $t1, write
+    nop
+
+    # Every 8th word (one per 32-byte line), starting from each of the 8
+    li $v0, 0
+    li $t3, 0
+next_start:
+    move $t0, $t3
+read:
+    sll $t2, $t0, 2
+    addu $t2, $t2, $s0
+    lw $t4, 0($t2)
+    addu $v0, $v0, $t4
+    addiu $t0, $t0, 8
+    slt $t5, $t0, $t1
+    bne $t5, $0, read
+    nop
+    addiu $t3, $t3, 1
+    li $t5, 8
+    bne $t3, $t5, next_start
+    nop
+
+    srl $v0, $v0, 8
+    jr $0
+    nop
@@ -0,0 +1,19 @@
+.text
+    # Store "dma" to data memory, and have the DMA device write it to
+    # descriptor 1 (the output). The status is the number of bytes written
+    li $s0, 0x20000000
+    li $t0, 0x646D610A
+    sw $t0, ($s0)
+
+    li $s1, 0x30000010
+    sw $s0, 0($s1)
+    li $t0, 4
+    sw $t0, 4($s1)
+    li $t0, 1
+    sw $t0, 8($s1)
+    li $t0, 1
+    sw $t0, 12($s1)
+
+    lw $v0, 16($s1)
+    jr $0
+    nop
@@ -0,0 +1,34 @@
+.text
+    # Have the DMA device read 4 bytes of input (descriptor 0) into data
+    # memory, then try a descriptor that isn't open, which sets status to -1
+    li $s0, 0x20000010
+    li $s1, 0x30000010
+    sw $s0, 0($s1)
+    li $t0, 4
+    sw $t0, 4($s1)
+    sw $0, 8($s1)
+    li $t0, 2
+    sw $t0, 12($s1)
+    lw $t1, 16($s1)
+    li $t0, 4
+    bne $t1, $t0, nok
+    nop
+
+    li $t0, 9
+    sw $t0, 8($s1)
+    li $t0, 2
+    sw $t0, 12($s1)
+    lw $t1, 16($s1)
+    li $t0, -1
+    bne $t1, $t0, nok
+    nop
+
+    # The last byte read, 'd' of "abcd"
+    lbu $v0, 3($s0)
+    jr $0
+    nop
+
+nok:
+    li $v0, 1
+    jr $0
+    nop
@@ -0,0 +1,28 @@
+.text
+    # Set up a DMA write of "Hi" to the output, spin for a while, then start
+    # it. Under make test_snapshots the run is split in the spin, so the
+    # registers have to come back from the snapshot. Exits with the status + 1
+    li $s0, 0x20000000
+    li $t0, 0x48690000
+    sw $t0, ($s0)
+
+    li $s1, 0x30000010
+    sw $s0, 0($s1)
+    li $t0, 2
+    sw $t0, 4($s1)
+    li $t0, 1
+    sw $t0, 8($s1)
+
+    li $t1, 100
+.spin:
+    addiu $t1, $t1, -1
+    bne $t1, $0, .spin
+    nop
+
+    li $t0, 1
+    sw $t0, 12($s1)
+
+    lw $v0, 16($s1)
+    addiu $v0, $v0, 1
+    jr $0
+    nop
@@ -0,0 +1,50 @@
+.text
+    # Run as the linked ELF: .data is loaded, and .bss starts as zeros
+    la $s0, numbers
+    lw $t0, 0($s0)
+    lw $t1, 4($s0)
+    addu $s1, $t0, $t1
+
+    # Print the string in .data
+    la $t0, message
+    li $t2, 0x30000004
+print:
+    lbu $t1, ($t0)
+    beq $t1, $0, printed
+    nop
+    sw $t1, ($t2)
+    addiu $t0, $t0, 1
+    j print
+    nop
+printed:
+
+    # Every word of .bss is 0, and can be written
+    la $t0, buffer
+    addiu $t3, $t0, 64
+zeros:
+    lw $t1, ($t0)
+    bne $t1, $0, nok
+    nop
+    sw $s1, ($t0)
+    addiu $t0, $t0, 4
+    bne $t0, $t3, zeros
+    nop
+
+    lw $v0, -4($t3)
+    jr $0
+    nop
+
+nok:
+    li $v0, 1
+    jr $0
+    nop
+
+.data
+numbers:
+    .word 40, 2
+message:
+    .asciiz "elf"
+
+.bss
+buffer:
+    .space 64
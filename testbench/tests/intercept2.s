@@ -0,0 +1,88 @@
+.text
+    # intercept1 with --verify-intercepts: the guest code runs, and each call
+    # is checked against the native routine. Exits with
+    # 10 * strlen(copy) + strcmp("hello", "help")
+main:
+    la $a0, copy
+    la $a1, hello
+    li $a2, 6
+    jal memcpy
+    nop
+    move $a0, $v0
+    jal strlen
+    nop
+    move $s0, $v0
+
+    la $a0, copy
+    la $a1, help
+    jal strcmp
+    nop
+
+    sll $t0, $s0, 3
+    sll $s0, $s0, 1
+    addu $s0, $s0, $t0
+    addu $v0, $v0, $s0
+    jr $0
+    nop
+
+    .globl memcpy
+    .type memcpy, @function
+memcpy:
+    move $v0, $a0
+    beq $a2, $0, memcpy_done
+    nop
+memcpy_loop:
+    lbu $t0, 0($a1)
+    sb $t0, 0($a0)
+    addiu $a0, $a0, 1
+    addiu $a1, $a1, 1
+    addiu $a2, $a2, -1
+    bne $a2, $0, memcpy_loop
+    nop
+memcpy_done:
+    jr $ra
+    nop
+
+    .globl strlen
+    .type strlen, @function
+strlen:
+    move $v0, $a0
+strlen_loop:
+    lbu $t0, 0($v0)
+    beq $t0, $0, strlen_done
+    nop
+    addiu $v0, $v0, 1
+    j strlen_loop
+    nop
+strlen_done:
+    subu $v0, $v0, $a0
+    jr $ra
+    nop
+
+    .globl strcmp
+    .type strcmp, @function
+strcmp:
+    lbu $t0, 0($a0)
+    lbu $t1, 0($a1)
+    bne $t0, $t1, strcmp_done
+    nop
+    beq $t0, $0, strcmp_done
+    nop
+    addiu $a0, $a0, 1
+    addiu $a1, $a1, 1
+    j strcmp
+    nop
+strcmp_done:
+    subu $v0, $t0, $t1
+    jr $ra
+    nop
+
+.data
+hello:
+    .asciiz "hello"
+help:
+    .asciiz "help"
+
+.bss
+copy:
+    .space 8
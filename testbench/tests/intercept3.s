@@ -0,0 +1,51 @@
+.text
+.set noreorder
+    # memset and strlen intercepted by address with --intercept, so the layout
+    # is fixed: memset at 0x10000008 and strlen at 0x10000028. Exits with
+    # strlen of the 10 bytes memset wrote, plus 20 if memset returned its
+    # destination
+    j main
+    nop
+
+memset:
+    beq $a2, $0, memset_done
+    move $v0, $a0
+memset_loop:
+    sb $a1, 0($a0)
+    addiu $a2, $a2, -1
+    bne $a2, $0, memset_loop
+    addiu $a0, $a0, 1
+memset_done:
+    jr $ra
+    nop
+
+strlen:
+    move $v1, $a0
+strlen_loop:
+    lbu $t0, 0($v1)
+    bne $t0, $0, strlen_loop
+    addiu $v1, $v1, 1
+    subu $v0, $v1, $a0
+    jr $ra
+    addiu $v0, $v0, -1
+
+main:
+    li $s0, 0x20000000
+    sb $0, 10($s0)
+    move $a0, $s0
+    li $a1, 'x'
+    li $a2, 10
+    jal memset
+    nop
+    move $s1, $v0
+
+    move $a0, $s0
+    jal strlen
+    nop
+
+    bne $s1, $s0, exit
+    nop
+    addiu $v0, $v0, 20
+exit:
+    jr $0
+    nop
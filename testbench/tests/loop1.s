@@ -0,0 +1,40 @@
+.text
+.set noreorder
+    # Fill loops for --loop-accel: 16 words of 7 forward, up to an end address,
+    # then 16 bytes of 3 backward, counting down to 0. Exits with what the
+    # induction registers and the filled memory add up to
+    li $t0, 0x20000000
+    li $t1, 0x20000040
+    li $t2, 7
+fill_up:
+    sw $t2, 0($t0)
+    addiu $t0, $t0, 4
+    bne $t0, $t1, fill_up
+    nop
+
+    li $t3, 16
+    li $t4, 0x2000004F
+    li $t5, 3
+fill_down:
+    sb $t5, 0($t4)
+    addiu $t4, $t4, -1
+    addiu $t3, $t3, -1
+    bne $t3, $0, fill_down
+    nop
+
+    # 0x40 + 0x3F + 0 + 7 + 7 + 3 + 3
+    li $s0, 0x20000000
+    subu $v0, $t0, $s0
+    subu $t6, $t4, $s0
+    addu $v0, $v0, $t6
+    addu $v0, $v0, $t3
+    lw $t6, 0($s0)
+    addu $v0, $v0, $t6
+    lw $t6, 0x3C($s0)
+    addu $v0, $v0, $t6
+    lbu $t6, 0x40($s0)
+    addu $v0, $v0, $t6
+    lbu $t6, 0x4F($s0)
+    addu $v0, $v0, $t6
+    jr $0
+    nop
@@ -0,0 +1,57 @@
+.text
+.set noreorder
+    # Copy loops for --loop-accel: 8 bytes forward, stepping the source up to
+    # an end address, then 4 halfwords backward with the offset before the
+    # step, counting down to 0. Exits with what the induction registers, the
+    # last element loaded and the copies add up to
+    li $s0, 0x20000000
+    li $t0, 0x01020304
+    sw $t0, 0($s0)
+    li $t0, 0x05060708
+    sw $t0, 4($s0)
+
+    move $t0, $s0
+    addiu $t1, $s0, 0x100
+    addiu $t2, $s0, 8
+copy_up:
+    lbu $t3, 0($t0)
+    sb $t3, 0($t1)
+    addiu $t0, $t0, 1
+    addiu $t1, $t1, 1
+    bne $t0, $t2, copy_up
+    nop
+
+    li $t4, 4
+    addiu $t5, $s0, 8
+    addiu $t6, $s0, 0x208
+copy_down:
+    addiu $t5, $t5, -2
+    lhu $t7, 0($t5)
+    addiu $t6, $t6, -2
+    sh $t7, 0($t6)
+    addiu $t4, $t4, -1
+    bne $t4, $0, copy_down
+    nop
+
+    # 8 + 0x108 + 8 (last byte) + 0 + 0 + 0x200 + 0x0102 (last halfword)
+    #   + 8 + 1 + 0x0708 + 0x0102 = 3117, which exits as 45
+    subu $v0, $t0, $s0
+    subu $t8, $t1, $s0
+    addu $v0, $v0, $t8
+    addu $v0, $v0, $t3
+    addu $v0, $v0, $t4
+    subu $t8, $t5, $s0
+    addu $v0, $v0, $t8
+    subu $t8, $t6, $s0
+    addu $v0, $v0, $t8
+    addu $v0, $v0, $t7
+    lbu $t8, 0x107($s0)
+    addu $v0, $v0, $t8
+    lbu $t8, 0x100($s0)
+    addu $v0, $v0, $t8
+    lhu $t8, 0x206($s0)
+    addu $v0, $v0, $t8
+    lhu $t8, 0x200($s0)
+    addu $v0, $v0, $t8
+    jr $0
+    nop
@@ -0,0 +1,41 @@
+.text
+.set noreorder
+    # A copy loop whose ranges overlap: each byte is copied one up, onto the
+    # next one to be read, so --loop-accel has to leave it to the guest code
+    # (all but the last iteration), which smears the first byte over all 9.
+    # Exits with the sum of the bytes plus how far the pointers went
+    li $s0, 0x20000000
+    li $t0, 0x05020304
+    sw $t0, 0($s0)
+    li $t0, 0x05060708
+    sw $t0, 4($s0)
+
+    move $t0, $s0
+    addiu $t1, $s0, 1
+    li $t2, 8
+smear:
+    lbu $t3, 0($t0)
+    sb $t3, 0($t1)
+    addiu $t0, $t0, 1
+    addiu $t1, $t1, 1
+    addiu $t2, $t2, -1
+    bne $t2, $0, smear
+    nop
+
+    # 9 bytes of 5, plus 8 and 9
+    li $v0, 0
+    move $t4, $s0
+    addiu $t5, $s0, 9
+sum:
+    lbu $t6, 0($t4)
+    addu $v0, $v0, $t6
+    addiu $t4, $t4, 1
+    bne $t4, $t5, sum
+    nop
+    subu $t6, $t0, $s0
+    addu $v0, $v0, $t6
+    subu $t6, $t1, $s0
+    addu $v0, $v0, $t6
+    addu $v0, $v0, $t2
+    jr $0
+    nop
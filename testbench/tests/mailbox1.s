@@ -0,0 +1,29 @@
+.text
+    # Stage 0 sends 1 to 10 on channel 0, and stage 1 adds them up
+    li $t0, 0x30000008
+    lw $t0, ($t0)
+    li $t1, 0x30001000
+    bne $t0, $0, receive
+    nop
+
+    li $t2, 1
+    li $t3, 11
+send:
+    sw $t2, ($t1)
+    addiu $t2, $t2, 1
+    bne $t2, $t3, send
+    nop
+    jr $0
+    nop
+
+receive:
+    li $t3, 10
+    li $v0, 0
+sum:
+    lw $t2, ($t1)
+    addu $v0, $v0, $t2
+    addiu $t3, $t3, -1
+    bne $t3, $0, sum
+    nop
+    jr $0
+    nop
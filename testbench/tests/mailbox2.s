@@ -0,0 +1,36 @@
+.text
+    # Stage 0 sends its input on channel 0, ending with -1. Stage 1 polls
+    # the channel's count register, and writes what it receives to putc
+    li $t0, 0x30000008
+    lw $t0, ($t0)
+    li $t1, 0x30001000
+    li $t2, -1
+    bne $t0, $0, receive
+    nop
+
+    li $t3, 0x30000000
+send:
+    lw $t4, ($t3)
+    sw $t4, ($t1)
+    bne $t4, $t2, send
+    nop
+    jr $0
+    nop
+
+receive:
+    li $t3, 0x30000004
+poll:
+    lw $t4, 4($t1)
+    beq $t4, $0, poll
+    nop
+    lw $t4, ($t1)
+    beq $t4, $t2, done
+    nop
+    sb $t4, 3($t3)
+    j poll
+    nop
+
+done:
+    li $v0, 7
+    jr $0
+    nop
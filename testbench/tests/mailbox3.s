@@ -0,0 +1,20 @@
+.text
+    # Stage 0 sends on channel 1, which only stage 1 may send on, while stage 1
+    # waits on channel 0. The send is a Memory Exception
+    li $t0, 0x30000008
+    lw $t0, ($t0)
+    bne $t0, $0, receive
+    nop
+
+    li $t1, 0x30001010
+    li $t2, 7
+    sw $t2, ($t1)
+    li $v0, 1
+    jr $0
+    nop
+
+receive:
+    li $t1, 0x30001000
+    lw $v0, ($t1)
+    jr $0
+    nop
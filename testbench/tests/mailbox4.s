@@ -0,0 +1,17 @@
+.text
+    # Stage 1 receives from channel 1, which only stage 2 may receive from. The
+    # load is a Memory Exception
+    li $t0, 0x30000008
+    lw $t0, ($t0)
+    bne $t0, $0, receive
+    nop
+
+    li $v0, 1
+    jr $0
+    nop
+
+receive:
+    li $t1, 0x30001010
+    lw $v0, ($t1)
+    jr $0
+    nop
@@ -0,0 +1,43 @@
+.text
+    # The test's own binary is mapped at 0x50000000: its size is at
+    # 0x30000100, and its words are the instructions of this program
+    li $t0, 0x30000100
+    lw $s0, ($t0)
+    la $s1, end
+    li $t0, 0x10000000
+    subu $s1, $s1, $t0
+    sltu $t1, $s0, $s1
+    bne $t1, $0, nok
+    nop
+
+    li $t0, 0x10000000
+    li $t1, 0x50000000
+    addu $s1, $s1, $t0
+compare:
+    lw $t2, ($t0)
+    lw $t3, ($t1)
+    bne $t2, $t3, nok
+    nop
+    addiu $t0, $t0, 4
+    addiu $t1, $t1, 4
+    bne $t0, $s1, compare
+    nop
+
+    # Bytes are in order too: the top byte of the first word
+    li $t1, 0x50000000
+    lbu $t2, ($t1)
+    li $t0, 0x10000000
+    lw $t3, ($t0)
+    srl $t3, $t3, 24
+    bne $t2, $t3, nok
+    nop
+
+    li $v0, 42
+    jr $0
+    nop
+
+nok:
+    li $v0, 1
+    jr $0
+    nop
+end:
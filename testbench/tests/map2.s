@@ -0,0 +1,8 @@
+.text
+    # Mapped files are read-only
+    li $t0, 0x50000000
+    lw $t1, ($t0)
+    sw $t1, ($t0)
+    li $v0, 1
+    jr $0
+    nop
@@ -0,0 +1,46 @@
+.text
+    # Every hart adds 1 to the counter 100000 times with LL/SC, then
+    # adds 1 to the count of harts done. Hart 0 waits for all of them
+    li $s0, 0x20000000
+    li $t0, 0x3000000C
+    lw $s1, ($t0)
+    li $t0, 0x30000008
+    lw $s2, ($t0)
+
+    li $t0, 100000
+count:
+    ll $t1, 0($s0)
+    addiu $t1, $t1, 1
+    sc $t1, 0($s0)
+    beq $t1, $0, count
+    nop
+    addiu $t0, $t0, -1
+    bne $t0, $0, count
+    nop
+
+done:
+    ll $t1, 4($s0)
+    addiu $t1, $t1, 1
+    sc $t1, 4($s0)
+    beq $t1, $0, done
+    nop
+
+    bne $s2, $0, exit
+    nop
+
+wait:
+    lw $t1, 4($s0)
+    bne $t1, $s1, wait
+    nop
+
+    # 42 if no increment was lost
+    li $t0, 100000
+    multu $t0, $s1
+    mflo $t0
+    lw $t1, 0($s0)
+    subu $v0, $t1, $t0
+    addiu $v0, $v0, 42
+
+exit:
+    jr $0
+    nop
@@ -0,0 +1,28 @@
+.text
+    li $t0, 0x20000000
+    li $t1, 7
+    sw $t1, ($t0)
+
+    # A store in between makes SC fail, even of the value LL read
+    ll $t2, ($t0)
+    sw $t1, ($t0)
+    li $t2, 8
+    sc $t2, ($t0)
+    bne $t2, $0, nok
+    nop
+
+    # Nothing in between: SC succeeds
+    ll $t2, ($t0)
+    li $t2, 9
+    sc $t2, ($t0)
+    beq $t2, $0, nok
+    nop
+
+    lw $v0, ($t0)
+    jr $0
+    nop
+
+nok:
+    li $v0, 1
+    jr $0
+    nop
@@ -0,0 +1,18 @@
+.text
+    # Echo each character of the input twice, and exit with how many there
+    # were. Under make test_snapshots the run is split halfway through, with
+    # part of the input read and part of the output written
+        li $t5, 0x30000000 # Address of getc
+        li $t4, -1         # EOF
+        li $v0, 0
+
+.read:  lw $t1, 0($t5)
+        beq $t1, $t4, .exit
+        nop
+
+        sw $t1, 4($t5)
+        sw $t1, 4($t5)
+        addiu $v0, $v0, 1
+        j .read
+
+.exit:  jr $0
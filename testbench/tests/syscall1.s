@@ -0,0 +1,28 @@
+.text
+    # READ up to 16 bytes of input, WRITE them back out, then EXIT2 with
+    # how many there were
+    li $s0, 0x20000100
+
+    li $v0, 14
+    li $a0, 0
+    move $a1, $s0
+    li $a2, 16
+    syscall
+    move $s1, $v0
+
+    li $v0, 15
+    li $a0, 1
+    move $a1, $s0
+    move $a2, $s1
+    syscall
+    bne $v0, $s1, nok
+    nop
+
+    li $v0, 17
+    move $a0, $s1
+    syscall
+
+nok:
+    li $v0, 1
+    jr $0
+    nop
@@ -0,0 +1,30 @@
+.text
+    # SBRK twice: the second block starts where the first ended, and can be
+    # stored to. PRINT_INT the gap, then EXIT
+    li $v0, 9
+    li $a0, 12
+    syscall
+    move $s0, $v0
+
+    li $v0, 9
+    li $a0, 4
+    syscall
+    move $s1, $v0
+
+    li $t0, 0x12345678
+    sw $t0, ($s1)
+    lw $t1, ($s1)
+    bne $t0, $t1, nok
+    nop
+
+    li $v0, 1
+    subu $a0, $s1, $s0
+    syscall
+
+    li $v0, 10
+    syscall
+
+nok:
+    li $v0, 1
+    jr $0
+    nop